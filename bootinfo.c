@@ -19,13 +19,21 @@
  * MA 02111-1307 USA
  */
 
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#ifndef NO_MMAP
+  #include <sys/mman.h>
+#endif
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "common.h"
+#include "portable_endian.h"
 #include "types.h"
 
 /* boot_file_head copied from mksunxiboot */
@@ -148,7 +156,10 @@ typedef struct _boot_sdcard_info_t {
 #define BOOT0_MAGIC                     "eGON.BT0"
 #define BOOT1_MAGIC                     "eGON.BT1"
 
-union {
+/* checksum stamp, the value check_sum holds while summing up the image */
+#define BOOT_CHECKSUM_STAMP		0x5F0A6C39
+
+union boot_header {
 	boot_file_head_t boot;
 	boot0_file_head_t boot0;
 	boot1_file_head_t boot1;
@@ -336,48 +347,440 @@ void print_boot1_file_head(boot1_file_head_t *hdr, loader_type type)
 		printf("Unknown boot0 header version\n");
 }
 
+/*
+ * An input file, mmap'ed if possible. Anything else (like stdin) gets
+ * read into a buffer instead.
+ */
+struct boot_image {
+	const char *filename;
+	const u8 *data;
+	size_t size;
+	int allocated;
+};
+
+static u8 *read_all(int fd, size_t *size)
+{
+	size_t count = 0, buf_size = 0;
+	u8 *buf = NULL;
+	ssize_t n;
+
+	do {
+		if (count == buf_size) {
+			u8 *p = realloc(buf, buf_size += 65536);
+			if (!p) {
+				free(buf);
+				return NULL;
+			}
+			buf = p;
+		}
+		n = read(fd, buf + count, buf_size - count);
+		if (n < 0) {
+			free(buf);
+			return NULL;
+		}
+		count += n;
+	} while (n > 0);
+
+	*size = count;
+	return buf;
+}
+
+/* returns an error message on failure, NULL otherwise */
+static const char *map_image(struct boot_image *img)
+{
+	const char *err = NULL;
+	int fd = 0; /* stdin */
+	struct stat sb;
+
+	if (!img->filename)
+		img->filename = "<stdin>";
+	else if ((fd = open(img->filename, O_RDONLY)) < 0)
+		return strerror(errno);
+
+	img->data = NULL;
+	if (fstat(fd, &sb) == -1) {
+		err = strerror(errno);
+#ifndef NO_MMAP
+	} else if (S_ISREG(sb.st_mode) && sb.st_size > 0) {
+		void *buf = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (buf == MAP_FAILED) {
+			err = strerror(errno);
+		} else {
+			img->data = buf;
+			img->size = sb.st_size;
+			img->allocated = 0;
+		}
+#endif
+	} else {
+		img->data = read_all(fd, &img->size);
+		img->allocated = 1;
+		if (!img->data)
+			err = strerror(errno);
+	}
+
+	if (fd != 0)
+		close(fd);
+	return err;
+}
+
+static void unmap_image(struct boot_image *img)
+{
+	if (img->allocated)
+		free((void *)img->data);
+#ifndef NO_MMAP
+	else
+		munmap((void *)img->data, img->size);
+#endif
+	img->data = NULL;
+}
+
+/*
+ * Get a (zero padded) copy of the headers, to allow accessing any field
+ * regardless of the file size. Returns an error message on failure.
+ */
+static const char *get_header(const struct boot_image *img,
+			      union boot_header *hdr)
+{
+	size_t len = img->size < sizeof(*hdr) ? img->size : sizeof(*hdr);
+
+	if (len < sizeof(boot_file_head_t))
+		return "File too short for a boot header";
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr, img->data, len);
+
+	if (strncmp((char *)hdr->boot.magic, BOOT0_MAGIC, strlen(BOOT0_MAGIC)) &&
+	    strncmp((char *)hdr->boot.magic, BOOT1_MAGIC, strlen(BOOT1_MAGIC)) &&
+	    strncmp((char *)hdr->boot.magic, BROM_MAGIC, strlen(BROM_MAGIC)))
+		return "Invalid magic";
+	return NULL;
+}
+
+/*
+ * Verify the eGON checksum: summing up all words of the image, with the
+ * check_sum field holding BOOT_CHECKSUM_STAMP, has to result in the
+ * stored check_sum. (Same as in sunxi-fel's aw_fel_write_and_execute_spl.)
+ * Returns an error message if the image length is unusable, NULL otherwise.
+ */
+static const char *verify_checksum(const struct boot_image *img,
+				   u32 *stored, u32 *computed)
+{
+	const boot_file_head_t *head = (const boot_file_head_t *)img->data;
+	u32 length = le32toh(head->length);
+	u32 sum = 0, word;
+	size_t i;
+
+	*stored = le32toh(head->check_sum);
+	*computed = 0;
+	if (length < sizeof(boot_file_head_t))
+		return "Length too small";
+	if (length > img->size)
+		return "Length exceeds file size";
+	if (length % 4)
+		return "Length not a multiple of 4";
+
+	for (i = 0; i < length; i += 4) {
+		memcpy(&word, img->data + i, 4);
+		sum += le32toh(word);
+	}
+	*computed = sum - *stored + BOOT_CHECKSUM_STAMP;
+	return NULL;
+}
+
+static void print_image(const char *filename, loader_type type)
+{
+	struct boot_image img = { .filename = filename };
+	const char *err = map_image(&img);
+
+	if (!err) {
+		err = get_header(&img, &boot_hdr);
+		unmap_image(&img);
+	}
+	if (err) {
+		fprintf(stderr, "%s: %s\n", img.filename, err);
+		exit(1);
+	}
+
+	if (strncmp((char *)boot_hdr.boot.magic, BOOT0_MAGIC, strlen(BOOT0_MAGIC)) == 0)
+		print_boot0_file_head(&boot_hdr.boot0, type);
+	else if (strncmp((char *)boot_hdr.boot.magic, BOOT1_MAGIC, strlen(BOOT1_MAGIC)) == 0)
+		print_boot1_file_head(&boot_hdr.boot1, type);
+	else
+		print_brom_file_head(&boot_hdr.brom);
+}
+
+/*
+ * JSON output: one record (line) per file, built up in memory so that
+ * several files can get analyzed in parallel and reported in order.
+ */
+struct record {
+	char *buf;
+	size_t len, size;
+	int failed;
+};
+
+static void rec_printf(struct record *rec, const char *fmt, ...)
+{
+	char *end = rec->buf ? rec->buf + rec->len : NULL;
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(end, rec->size - rec->len, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		fail("vsnprintf");
+
+	if (rec->len + n >= rec->size) {
+		rec->size = (rec->len + n + 1) * 2;
+		rec->buf = realloc(rec->buf, rec->size);
+		if (!rec->buf)
+			fail("realloc");
+		va_start(ap, fmt);
+		vsnprintf(rec->buf + rec->len, rec->size - rec->len, fmt, ap);
+		va_end(ap);
+	}
+	rec->len += n;
+}
+
+/* a (not necessarily terminated) string of up to 'size' chars, as a member */
+static void rec_string(struct record *rec, const char *key,
+		       const void *str, size_t size)
+{
+	const u8 *s = str;
+
+	rec_printf(rec, "%s\"%s\":\"",
+		   rec->buf[rec->len - 1] == '{' ? "" : ",", key);
+	for (; size && *s; size--, s++) {
+		if (*s == '"' || *s == '\\')
+			rec_printf(rec, "\\%c", *s);
+		else if (*s < 0x20 || *s >= 0x7F)
+			rec_printf(rec, "\\u%04x", *s);
+		else
+			rec_printf(rec, "%c", *s);
+	}
+	rec_printf(rec, "\"");
+}
+
+static void json_dram_para(struct record *rec, const boot_dram_para_t *dram)
+{
+	rec_printf(rec, ",\"dram\":{\"baseaddr\":%u,\"clk\":%u,\"type\":%u,"
+		   "\"rank_num\":%u,\"chip_density\":%u,\"io_width\":%u,"
+		   "\"bus_width\":%u,\"cas\":%u,\"zq\":%u,\"odt_en\":%u,"
+		   "\"size\":%u,\"tpr\":[%u,%u,%u,%u,%u,%u],\"emr\":[%u,%u,%u]}",
+		   dram->dram_baseaddr, dram->dram_clk, dram->dram_type,
+		   dram->dram_rank_num, dram->dram_chip_density,
+		   dram->dram_io_width, dram->dram_bus_width, dram->dram_cas,
+		   dram->dram_zq, dram->dram_odt_en, dram->dram_size,
+		   dram->dram_tpr0, dram->dram_tpr1, dram->dram_tpr2,
+		   dram->dram_tpr3, dram->dram_tpr4, dram->dram_tpr5,
+		   dram->dram_emr1, dram->dram_emr2, dram->dram_emr3);
+}
+
+static void json_sdcard_info(struct record *rec, const u8 *storage_data)
+{
+	const boot_sdcard_info_t *info = (const boot_sdcard_info_t *)storage_data;
+
+	rec_printf(rec, ",\"sdcard\":{\"card_ctrl_num\":%d,\"boot_offset\":%u}",
+		   info->card_ctrl_num, (u32)info->boot_offset);
+}
+
+static void json_image(struct record *rec, const char *filename,
+		       loader_type type, union boot_header *hdr)
+{
+	struct boot_image img = { .filename = filename };
+	const char *err = map_image(&img);
+	u32 stored, computed;
+
+	rec_printf(rec, "{");
+	rec_string(rec, "file", img.filename, strlen(img.filename));
+	if (!err)
+		err = get_header(&img, hdr);
+	if (err) {
+		rec_string(rec, "error", err, strlen(err));
+		rec_printf(rec, "}\n");
+		rec->failed = 1;
+		if (img.data)
+			unmap_image(&img);
+		return;
+	}
+
+	rec_printf(rec, ",\"size\":%zu", img.size);
+	rec_string(rec, "magic", hdr->boot.magic, sizeof(hdr->boot.magic));
+	if (strncmp((char *)hdr->boot.magic, BROM_MAGIC, strlen(BROM_MAGIC)) == 0) {
+		brom_file_head_t *brom = &hdr->brom;
+		rec_printf(rec, ",\"length\":%u", brom->length);
+		rec_string(rec, "boot_version", brom->Boot_vsn, 4);
+		rec_string(rec, "egon_version", brom->eGON_vsn, 4);
+		rec_string(rec, "platform", brom->platform, 8);
+		rec_printf(rec, "}\n");
+		unmap_image(&img);
+		return;
+	}
+
+	rec_printf(rec, ",\"length\":%u,\"header_size\":%u",
+		   hdr->boot.length, hdr->boot.pub_head_size);
+	rec_string(rec, "head_version", hdr->boot.pub_head_vsn, 4);
+	rec_string(rec, "file_version", hdr->boot.file_head_vsn, 4);
+	rec_string(rec, "boot_version", hdr->boot.Boot_vsn, 4);
+	rec_string(rec, "egon_version", hdr->boot.eGON_vsn, 4);
+	rec_string(rec, "platform", hdr->boot.platform, 8);
+
+	err = verify_checksum(&img, &stored, &computed);
+	unmap_image(&img);
+	rec_printf(rec, ",\"checksum\":\"0x%08x\"", stored);
+	if (err) {
+		rec_printf(rec, ",\"checksum_ok\":false");
+		rec_string(rec, "checksum_error", err, strlen(err));
+	} else {
+		rec_printf(rec, ",\"checksum_computed\":\"0x%08x\""
+			   ",\"checksum_ok\":%s", computed,
+			   stored == computed ? "true" : "false");
+	}
+
+	if (strncmp((char *)hdr->boot.file_head_vsn, "1230", 4) == 0) {
+		if (strncmp((char *)hdr->boot.magic, BOOT0_MAGIC, strlen(BOOT0_MAGIC)) == 0) {
+			boot0_private_head_t *prvt = &hdr->boot0.prvt_head;
+			rec_printf(rec, ",\"uart_port\":%d", prvt->uart_port);
+			json_dram_para(rec, &prvt->dram_para);
+			if (type == ALLWINNER_SD_LOADER)
+				json_sdcard_info(rec, prvt->storage_data);
+		} else {
+			boot1_private_head_t *prvt = &hdr->boot1.prvt_head;
+			rec_printf(rec, ",\"uart_port\":%d", prvt->uart_port);
+			json_dram_para(rec, &prvt->dram_para);
+			if (type == ALLWINNER_SD_LOADER)
+				json_sdcard_info(rec, prvt->storage_data);
+		}
+	}
+	rec_printf(rec, "}\n");
+}
+
+/* a pool of threads, each picking the next file to analyze */
+struct json_batch {
+	loader_type type;
+	const char **files;
+	struct record *records;
+	size_t count, next;
+	pthread_mutex_t lock;
+};
+
+static void *json_worker(void *arg)
+{
+	struct json_batch *batch = arg;
+	union boot_header *hdr = malloc(sizeof(*hdr));
+
+	if (!hdr)
+		fail("malloc");
+	while (1) {
+		size_t i;
+
+		pthread_mutex_lock(&batch->lock);
+		i = batch->next++;
+		pthread_mutex_unlock(&batch->lock);
+		if (i >= batch->count)
+			break;
+
+		json_image(&batch->records[i], batch->files[i],
+			   batch->type, hdr);
+	}
+	free(hdr);
+	return NULL;
+}
+
+static int run_json(loader_type type, int threads, int count,
+		    const char **files)
+{
+	static const char *no_files[] = { NULL }; /* stdin */
+	struct json_batch batch = {
+		.type = type,
+		.files = count ? files : no_files,
+		.count = count ? count : 1,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_t *tid;
+	int i, failed = 0;
+
+	batch.records = calloc(batch.count, sizeof(*batch.records));
+	if (threads > (int)batch.count)
+		threads = batch.count;
+	if (threads < 1)
+		threads = 1;
+	tid = calloc(threads, sizeof(*tid));
+	if (!batch.records || !tid)
+		fail("malloc");
+
+	for (i = 1; i < threads; i++) {
+		if (pthread_create(&tid[i], NULL, json_worker, &batch) != 0) {
+			fprintf(stderr, "pthread_create failed\n");
+			threads = i;
+			break;
+		}
+	}
+	json_worker(&batch);
+	for (i = 1; i < threads; i++)
+		pthread_join(tid[i], NULL);
+
+	for (i = 0; i < (int)batch.count; i++) {
+		fwrite(batch.records[i].buf, 1, batch.records[i].len, stdout);
+		failed |= batch.records[i].failed;
+		free(batch.records[i].buf);
+	}
+	free(batch.records);
+	free(tid);
+	return failed;
+}
+
 static void usage(const char *cmd)
 {
 	puts("sunxi-bootinfo " VERSION "\n");
-	printf("Usage: %s [<filename>]\n", cmd);
+	printf("Usage: %s [--type=sd|nand] [--json [--jobs=<n>]] [<filename>...]\n", cmd);
 	printf("       With no <filename> given, will read from stdin instead\n");
+	printf("       --json prints one JSON record per file, including the result\n"
+	       "       of verifying its checksum. Files get analyzed using <n>\n"
+	       "       threads (default: one per CPU).\n");
 }
 
 int main(int argc, char * argv[])
 {
-	FILE *in = stdin;
 	loader_type type = ALLWINNER_UNKNOWN_LOADER;
-	if (argc > 1 && strcmp(argv[1], "--type=sd") == 0) {
-		type = ALLWINNER_SD_LOADER;
-		argc--;
-		argv++;
+	int json = 0, threads = 0;
+
+	for (; argc > 1 && strncmp(argv[1], "--", 2) == 0; argc--, argv++) {
+		if (strcmp(argv[1], "--type=sd") == 0)
+			type = ALLWINNER_SD_LOADER;
+		else if (strcmp(argv[1], "--type=nand") == 0)
+			type = ALLWINNER_NAND_LOADER;
+		else if (strcmp(argv[1], "--json") == 0)
+			json = 1;
+		else if (strncmp(argv[1], "--jobs=", 7) == 0)
+			threads = strtol(argv[1] + 7, NULL, 0);
+		else
+			break;
 	}
-	if (argc > 1 && strcmp(argv[1], "--type=nand") == 0) {
-		type = ALLWINNER_NAND_LOADER;
-		argc--;
-		argv++;
-	}
-	if (argc > 1) {
-		in = fopen(argv[1], "rb");
-		if (!in) {
-			if (*argv[1] == '-')
-				usage(argv[0]);
-			fail("open input");
+
+	for (int i = 1; i < argc; i++) {
+		if (*argv[i] == '-' && access(argv[i], F_OK) != 0) {
+			usage(argv[0]);
+			return 1;
 		}
 	}
-	int len;
 
-	len = fread(&boot_hdr, 1, sizeof(boot_hdr), in);
-	if (len < (int)sizeof(boot_file_head_t))
-		fail("Failed to read header:");
-	if (strncmp((char *)boot_hdr.boot.magic, BOOT0_MAGIC, strlen(BOOT0_MAGIC)) == 0) {
-		print_boot0_file_head(&boot_hdr.boot0, type);
-	} else if (strncmp((char *)boot_hdr.boot.magic, BOOT1_MAGIC, strlen(BOOT1_MAGIC)) == 0) {
-		print_boot1_file_head(&boot_hdr.boot1, type);
-	} else if (strncmp((char *)boot_hdr.boot.magic, BROM_MAGIC, strlen(BROM_MAGIC)) == 0) {
-		print_brom_file_head(&boot_hdr.brom);
-	} else {
-		fail("Invalid magic\n");
+	if (json) {
+#ifdef _SC_NPROCESSORS_ONLN
+		if (threads <= 0)
+			threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		return run_json(type, threads, argc - 1,
+				(const char **)argv + 1);
+	}
+
+	if (argc <= 2) {
+		print_image(argv[1], type);
+		return 0;
+	}
+	for (int i = 1; i < argc; i++) {
+		printf("%s%s:\n", i > 1 ? "\n" : "", argv[i]);
+		print_image(argv[i], type);
 	}
 
 	return 0;
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2016  The sunxi-tools contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SUNXI_TOOLS_CRC32_H
+#define _SUNXI_TOOLS_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32 as used by zlib and U-Boot (IEEE 802.3 polynomial, reflected).
+ * Like zlib's crc32(), pass 0 as initial value and previous results to
+ * continue a calculation.
+ */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
+
+#endif /* _SUNXI_TOOLS_CRC32_H */
@@ -19,6 +19,10 @@
 #include "portable_endian.h"
 #include "progress.h"
 #include "soc_info.h"
+#include "lz4.h"
+#include "trace.h"
+#include "crc32.h"
+#include "pio_cmd.h"
 
 #include <libusb.h>
 #include <stdint.h>
@@ -32,6 +36,13 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#ifndef NO_MMAP
+  #include <sys/mman.h>
+#endif
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#endif
 
 static const uint16_t AW_USB_VENDOR_ID  = 0x1F3A;
 static const uint16_t AW_USB_PRODUCT_ID = 0xEFE8;
@@ -70,8 +81,16 @@ static int AW_USB_FEL_BULK_EP_IN;
 static int timeout = 10000; /* 10 seconds */
 
 static bool verbose = false; /* If set, makes the 'fel' tool more talkative */
+static bool fel_worker = false; /* set for each process of a multi-device run */
+static bool uboot_autostart = false; /* flag for "uboot" command = U-Boot autostart */
+static bool pflag_active = false; /* -p switch, causing "write" to output progress */
+static progress_cb_t pflag_style = progress_bar; /* --progress=json changes it */
+static bool compress_uploads = false; /* -z switch, LZ4 compressed "write" */
+static bool verify_uploads = false; /* --verify switch, check CRC after writes */
+static bool fast_mode = false; /* --fast switch, optimized MMU setup for the session */
 static uint32_t uboot_entry = 0; /* entry point (address) of U-Boot */
 static uint32_t uboot_size  = 0; /* size of U-Boot binary */
+static bool dram_initialized = false; /* set after successful SPL execution */
 
 static void pr_info(const char *fmt, ...)
 {
@@ -84,52 +103,247 @@ static void pr_info(const char *fmt, ...)
 }
 
 /*
- * AW_USB_MAX_BULK_SEND and the timeout constant are related.
- * Both need to be selected in a way that transferring the maximum chunk size
- * with (SoC-specific) slow transfer speed won't time out.
+ * Bulk chunk sizes and the timeout constant are related: a chunk must not time
+ * out even with (SoC-specific) slow transfer speeds. Since the actual speed
+ * varies a lot, the transfer engine measures the throughput of each chunk and
+ * adapts the size of the following ones, see usb_bulk_chunk_size().
  *
- * The 512 KiB here are chosen based on the assumption that we want a 10 seconds
- * timeout, and "slow" transfers take place at approx. 64 KiB/sec - so we can
- * expect the maximum chunk being transmitted within 8 seconds or less.
+ * Until there's a measurement, AW_USB_MAX_BULK_SEND is used. The 512 KiB here
+ * are chosen based on the assumption that we want a 10 seconds timeout, and
+ * "slow" transfers take place at approx. 64 KiB/sec - so we can expect the
+ * chunk being transmitted within 8 seconds or less.
  */
 static const int AW_USB_MAX_BULK_SEND = 512 * 1024; /* 512 KiB per bulk request */
+/* smaller transfers are dominated by latency, and don't tell us the rate */
+#define AW_USB_RATE_SAMPLE_MIN	(64 * 1024)
 
-void usb_bulk_send(libusb_device_handle *usb, int ep, const void *data,
-		   size_t length, bool progress)
+/*
+ * Number of bulk transfers that the transfer engine keeps queued ("in flight")
+ * at the same time. Having more than one pending request ensures that the
+ * host controller always has a follow-up transfer ready to go, so the bus
+ * won't sit idle while we're processing completions.
+ */
+#define AW_USB_MAX_TRANSFERS	4
+
+/*
+ * All queued transfers together must fit into the buffer memory that usbfs
+ * allows (on Linux this defaults to usbfs_memory_mb=16), otherwise submitting
+ * them fails with LIBUSB_ERROR_NO_MEM. Should that still happen (with a lower
+ * limit), the transfer engine retries with smaller chunks.
+ */
+#define AW_USB_MAX_IN_FLIGHT	(16 * 1024 * 1024)
+#define AW_USB_MIN_BULK_CHUNK	(16 * 1024)
+#define AW_USB_MAX_BULK_CHUNK	(AW_USB_MAX_IN_FLIGHT / AW_USB_MAX_TRANSFERS)
+
+/* translate a (failed) libusb transfer status to a libusb error code */
+static int usb_transfer_error(enum libusb_transfer_status status)
 {
-	/*
-	 * With no progress notifications, we'll use the maximum chunk size.
-	 * Otherwise, it's useful to lower the size (have more chunks) to get
-	 * more frequent status updates. 128 KiB per request seem suitable.
-	 * (Worst case of "slow" transfers -> one update every two seconds.)
-	 */
-	size_t max_chunk = progress ? 128 * 1024 : AW_USB_MAX_BULK_SEND;
-
-	size_t chunk;
-	int rc, sent;
-	while (length > 0) {
-		chunk = length < max_chunk ? length : max_chunk;
-		rc = libusb_bulk_transfer(usb, ep, (void *)data, chunk, &sent, timeout);
-		if (rc != 0)
-			usb_error(rc, "usb_bulk_send()", 2);
-		length -= sent;
-		data += sent;
+	switch (status) {
+	case LIBUSB_TRANSFER_TIMED_OUT: return LIBUSB_ERROR_TIMEOUT;
+	case LIBUSB_TRANSFER_STALL:	return LIBUSB_ERROR_PIPE;
+	case LIBUSB_TRANSFER_NO_DEVICE:	return LIBUSB_ERROR_NO_DEVICE;
+	case LIBUSB_TRANSFER_OVERFLOW:	return LIBUSB_ERROR_OVERFLOW;
+	case LIBUSB_TRANSFER_CANCELLED:	return LIBUSB_ERROR_INTERRUPTED;
+	default:			return LIBUSB_ERROR_IO;
+	}
+}
 
-		if (progress)
-			progress_update(sent); /* notification after each chunk */
+/* measured throughput (bytes per second) for OUT and IN, 0 if unknown */
+static double usb_bulk_rate[2];
+/* chunk size limit for OUT and IN, lowered when running into NO_MEM errors */
+static size_t usb_bulk_chunk_limit[2] = {
+	AW_USB_MAX_BULK_CHUNK, AW_USB_MAX_BULK_CHUNK
+};
+
+/*
+ * Pick the chunk size for the next bulk transfer on endpoint 'ep'. A queued
+ * transfer may have to wait for all others ahead of it, while its timeout
+ * is already running. So each chunk should take no more than a fraction of
+ * timeout / AW_USB_MAX_TRANSFERS at the current rate - we use half of that.
+ */
+static size_t usb_bulk_chunk_size(int ep)
+{
+	double rate = usb_bulk_rate[(ep & LIBUSB_ENDPOINT_IN) ? 1 : 0];
+	size_t limit = usb_bulk_chunk_limit[(ep & LIBUSB_ENDPOINT_IN) ? 1 : 0];
+	double chunk;
+
+	if (rate <= 0)
+		chunk = AW_USB_MAX_BULK_SEND;
+	else
+		chunk = rate * timeout / 1000. / AW_USB_MAX_TRANSFERS / 2;
+	if (chunk < AW_USB_MIN_BULK_CHUNK)
+		return AW_USB_MIN_BULK_CHUNK;
+	if (chunk > limit)
+		return limit;
+	return (size_t)chunk & ~(size_t)0xFFF; /* multiple of 4 KiB */
+}
+
+/*
+ * Submitting a 'chunk' sized transfer failed for lack of (usbfs) memory.
+ * Halve the chunk size limit, returns false if it's at the minimum already.
+ */
+static bool usb_bulk_reduce_chunk(int ep, size_t chunk)
+{
+	size_t *limit = &usb_bulk_chunk_limit[(ep & LIBUSB_ENDPOINT_IN) ? 1 : 0];
+
+	if (chunk <= AW_USB_MIN_BULK_CHUNK)
+		return false;
+	*limit = (chunk / 2) & ~(size_t)0xFFF;
+	if (*limit < AW_USB_MIN_BULK_CHUNK)
+		*limit = AW_USB_MIN_BULK_CHUNK;
+	pr_info("Out of USB buffer memory, reducing bulk chunks to %zu KiB\n",
+		*limit / 1024);
+	return true;
+}
+
+/* update the throughput estimate with a completed chunk */
+static void usb_bulk_update_rate(int ep, size_t bytes, double elapsed)
+{
+	double *rate = &usb_bulk_rate[(ep & LIBUSB_ENDPOINT_IN) ? 1 : 0];
+
+	if (bytes < AW_USB_RATE_SAMPLE_MIN || elapsed <= 0)
+		return;
+	/* moving average, so that a single outlier doesn't matter too much */
+	if (*rate > 0)
+		*rate = (*rate + bytes / elapsed) / 2;
+	else
+		*rate = bytes / elapsed;
+}
+
+/* completion callback, simply flags the transfer as done */
+static void LIBUSB_CALL usb_transfer_done(struct libusb_transfer *transfer)
+{
+	int *completed = transfer->user_data;
+	*completed = 1;
+}
+
+/*
+ * Asynchronous bulk transfer engine. The data gets split into chunks (sized
+ * by usb_bulk_chunk_size()), and up to AW_USB_MAX_TRANSFERS of these are
+ * submitted to libusb at once. Completions are processed in order, each one
+ * immediately gets replaced by a new submission (if data remains), and we
+ * issue a progress notification for it (if requested). Short reads get
+ * continued from where the data ends; any other short transfer is an error.
+ *
+ * Progress notifications don't affect the chunk size. As chunks are sized
+ * by time, there will still be an update every second or so.
+ */
+static void usb_bulk_transfer_async(libusb_device_handle *usb, int ep,
+				    void *data, size_t length,
+				    bool progress, const char *caption)
+{
+	struct libusb_transfer *transfer[AW_USB_MAX_TRANSFERS];
+	int completed[AW_USB_MAX_TRANSFERS];
+	double submitted[AW_USB_MAX_TRANSFERS];
+	double last_done = 0; /* completion time of the previous chunk */
+	uint8_t *pos = data; /* end of the data received (or sent) so far */
+	uint8_t *end = pos + length;
+	bool resync = false;
+	unsigned int head = 0, pending = 0, i;
+	int rc;
+
+	for (i = 0; i < AW_USB_MAX_TRANSFERS; i++) {
+		transfer[i] = libusb_alloc_transfer(0);
+		if (!transfer[i])
+			usb_error(LIBUSB_ERROR_NO_MEM, caption, 2);
+	}
+
+	while (length > 0 || pending > 0) {
+		/* (re)fill the queue */
+		while (!resync && length > 0 && pending < AW_USB_MAX_TRANSFERS) {
+			size_t max_chunk = usb_bulk_chunk_size(ep);
+			size_t chunk = length < max_chunk ? length : max_chunk;
+			i = (head + pending) % AW_USB_MAX_TRANSFERS;
+			completed[i] = 0;
+			libusb_fill_bulk_transfer(transfer[i], usb, ep, data, chunk,
+						  usb_transfer_done, &completed[i],
+						  timeout);
+			submitted[i] = gettime();
+			rc = libusb_submit_transfer(transfer[i]);
+			if (rc == LIBUSB_ERROR_NO_MEM) {
+				/* retry smaller, or once pending ones are done */
+				if (usb_bulk_reduce_chunk(ep, chunk))
+					continue;
+				if (pending > 0)
+					break;
+			}
+			if (rc != 0)
+				usb_error(rc, caption, 2);
+			pending++;
+			length -= chunk;
+			data += chunk;
+		}
+
+		/* wait for the oldest transfer to complete */
+		while (!completed[head]) {
+			rc = libusb_handle_events_completed(NULL, &completed[head]);
+			if (rc != 0 && rc != LIBUSB_ERROR_INTERRUPTED)
+				usb_error(rc, caption, 2);
+		}
+		if (transfer[head]->status != LIBUSB_TRANSFER_COMPLETED)
+			usb_error(usb_transfer_error(transfer[head]->status),
+				  caption, 2);
+		/*
+		 * A short read is fine (like with libusb_bulk_transfer()), but
+		 * the transfers queued behind it already received what follows.
+		 * So move their data up to join it, and once the queue has run
+		 * empty, request the rest from where the received data ends.
+		 */
+		if (transfer[head]->actual_length != transfer[head]->length &&
+		    (!(ep & LIBUSB_ENDPOINT_IN) || transfer[head]->actual_length == 0)) {
+			fprintf(stderr, "%s short transfer (%d of %d bytes)\n",
+				caption, transfer[head]->actual_length,
+				transfer[head]->length);
+			exit(2);
+		}
+		if (transfer[head]->buffer != pos)
+			memmove(pos, transfer[head]->buffer,
+				transfer[head]->actual_length);
+		pos += transfer[head]->actual_length;
+		if (transfer[head]->actual_length != transfer[head]->length)
+			resync = true;
+
+		/*
+		 * The chunk was being transferred since it got submitted,
+		 * or since the one before it completed - whichever is later.
+		 */
+		double now = gettime();
+		double started = last_done > submitted[head] ?
+				 last_done : submitted[head];
+		usb_bulk_update_rate(ep, transfer[head]->actual_length,
+				     now - started);
+		last_done = now;
+
+		/* (time spent waiting in the queue doesn't count) */
+		trace_bulk(ep & LIBUSB_ENDPOINT_IN, started, now,
+			   transfer[head]->actual_length);
+		if (progress) /* notification after each chunk */
+			progress_update(transfer[head]->actual_length);
+
+		head = (head + 1) % AW_USB_MAX_TRANSFERS;
+		pending--;
+		if (resync && pending == 0) {
+			data = pos;
+			length = end - pos;
+			resync = false;
+		}
 	}
+
+	for (i = 0; i < AW_USB_MAX_TRANSFERS; i++)
+		libusb_free_transfer(transfer[i]);
+}
+
+void usb_bulk_send(libusb_device_handle *usb, int ep, const void *data,
+		   size_t length, bool progress)
+{
+	usb_bulk_transfer_async(usb, ep, (void *)data, length,
+				progress, "usb_bulk_send()");
 }
 
 void usb_bulk_recv(libusb_device_handle *usb, int ep, void *data, int length)
 {
-	int rc, recv;
-	while (length > 0) {
-		rc = libusb_bulk_transfer(usb, ep, data, length, &recv, timeout);
-		if (rc != 0)
-			usb_error(rc, "usb_bulk_recv()", 2);
-		length -= recv;
-		data += recv;
-	}
+	usb_bulk_transfer_async(usb, ep, data, length,
+				false, "usb_bulk_recv()");
 }
 
 /* Constants taken from ${U-BOOT}/include/image.h */
@@ -202,7 +416,7 @@ void aw_usb_write(libusb_device_handle *usb, const void *data, size_t len,
 void aw_usb_read(libusb_device_handle *usb, const void *data, size_t len)
 {
 	aw_send_usb_request(usb, AW_USB_READ, len);
-	usb_bulk_send(usb, AW_USB_FEL_BULK_EP_IN, data, len, false);
+	usb_bulk_recv(usb, AW_USB_FEL_BULK_EP_IN, (void *)data, len);
 	aw_read_usb_response(usb);
 }
 
@@ -213,32 +427,53 @@ struct aw_fel_request {
 	uint32_t pad;
 };
 
+/*
+ * FEL device session. This wraps the libusb handle, and keeps per-device
+ * state that would otherwise have to be requested again over USB: the BROM
+ * version information (and the SoC info derived from it) gets queried only
+ * once, and we track which helper code is currently resident in SRAM.
+ */
+typedef struct {
+	libusb_device_handle *usb;
+	struct aw_fel_version soc_version; /* valid if soc_info is set */
+	const soc_info_t *soc_info;
+	const uint32_t *resident_helper; /* code in the helper area */
+	uint32_t resident_helper_addr;
+	struct {
+		uint32_t *backup; /* saved table/SRAM, set while fast mode is on */
+		bool mmu_enabled; /* MMU state before fast mode */
+		uint32_t dacr, ttbcr, ttbr0;
+	} fast;
+} feldev_handle;
+
 static const int AW_FEL_VERSION = 0x001;
 static const int AW_FEL_1_WRITE = 0x101;
 static const int AW_FEL_1_EXEC  = 0x102;
 static const int AW_FEL_1_READ  = 0x103;
 
-void aw_send_fel_request(libusb_device_handle *usb, int type, uint32_t addr, uint32_t length)
+void aw_send_fel_request(feldev_handle *dev, int type, uint32_t addr, uint32_t length)
 {
 	struct aw_fel_request req = {
 		.request = htole32(type),
 		.address = htole32(addr),
 		.length = htole32(length)
 	};
-	aw_usb_write(usb, &req, sizeof(req), false);
+	aw_usb_write(dev->usb, &req, sizeof(req), false);
 }
 
-void aw_read_fel_status(libusb_device_handle *usb)
+void aw_read_fel_status(feldev_handle *dev)
 {
 	char buf[8];
-	aw_usb_read(usb, &buf, sizeof(buf));
+	aw_usb_read(dev->usb, &buf, sizeof(buf));
 }
 
-void aw_fel_get_version(libusb_device_handle *usb, struct aw_fel_version *buf)
+void aw_fel_get_version(feldev_handle *dev, struct aw_fel_version *buf)
 {
-	aw_send_fel_request(usb, AW_FEL_VERSION, 0, 0);
-	aw_usb_read(usb, buf, sizeof(*buf));
-	aw_read_fel_status(usb);
+	double start = gettime();
+	aw_send_fel_request(dev, AW_FEL_VERSION, 0, 0);
+	aw_usb_read(dev->usb, buf, sizeof(*buf));
+	aw_read_fel_status(dev);
+	trace_request("fel-version", start, 0, 0);
 
 	buf->soc_id = (le32toh(buf->soc_id) >> 8) & 0xFFFF;
 	buf->unknown_0a = le32toh(buf->unknown_0a);
@@ -248,63 +483,103 @@ void aw_fel_get_version(libusb_device_handle *usb, struct aw_fel_version *buf)
 	buf->pad[1] = le32toh(buf->pad[1]);
 }
 
-void aw_fel_print_version(libusb_device_handle *usb)
+/* BROM version information, queried once per session */
+struct aw_fel_version *aw_fel_get_soc_version(feldev_handle *dev)
 {
-	struct aw_fel_version buf;
-	aw_fel_get_version(usb, &buf);
-
-	const char *soc_name="unknown";
-	switch (buf.soc_id) {
-	case 0x1623: soc_name="A10"; break;
-	case 0x1625: soc_name="A13"; break;
-	case 0x1633: soc_name="A31"; break;
-	case 0x1651: soc_name="A20"; break;
-	case 0x1650: soc_name="A23"; break;
-	case 0x1689: soc_name="A64"; break;
-	case 0x1639: soc_name="A80"; break;
-	case 0x1667: soc_name="A33"; break;
-	case 0x1673: soc_name="A83T"; break;
-	case 0x1680: soc_name="H3"; break;
-	case 0x1718: soc_name="H5"; break;
+	if (dev->soc_info == NULL) {
+		aw_fel_get_version(dev, &dev->soc_version);
+		dev->soc_info = get_soc_info_from_version(&dev->soc_version);
 	}
+	return &dev->soc_version;
+}
+
+/* SoC information for the device, retrieved once and cached in the session */
+const soc_info_t *aw_fel_get_soc_info(feldev_handle *dev)
+{
+	if (dev->soc_info == NULL)
+		aw_fel_get_soc_version(dev);
+	return dev->soc_info;
+}
+
+void aw_fel_print_version(feldev_handle *dev)
+{
+	struct aw_fel_version buf = *aw_fel_get_soc_version(dev);
 
 	printf("%.8s soc=%08x(%s) %08x ver=%04x %02x %02x scratchpad=%08x %08x %08x\n",
-		buf.signature, buf.soc_id, soc_name, buf.unknown_0a,
+		buf.signature, buf.soc_id, dev->soc_info->name, buf.unknown_0a,
 		buf.protocol, buf.unknown_12, buf.unknown_13,
 		buf.scratchpad, buf.pad[0], buf.pad[1]);
 }
 
-void aw_fel_read(libusb_device_handle *usb, uint32_t offset, void *buf, size_t len)
+/*
+ * Resident helper code: Some of our ARM helper routines are meant to stay in
+ * SRAM once they have been uploaded, so repeated use only has to transfer
+ * parameters. They all share a single "helper area" right after the scratch
+ * space for one-shot code, at soc_info->scratch_addr + FEL_HELPER_OFFSET.
+ * We keep track of which code is currently resident there, and forget about
+ * it whenever a FEL write touches the area.
+ */
+#define FEL_HELPER_OFFSET	0x400 /* offset from scratch_addr */
+#define FEL_HELPER_SIZE		0x400 /* size in bytes, code plus data */
+
+/* invalidate resident helper if the memory range [offset, offset+len) hits it */
+static void helper_area_check(feldev_handle *dev, uint32_t offset, size_t len)
+{
+	if (dev->resident_helper
+	    && offset < dev->resident_helper_addr + FEL_HELPER_SIZE
+	    && offset + len > dev->resident_helper_addr)
+		dev->resident_helper = NULL;
+}
+
+/* operation table for the register access engine, see fel_batch_run() */
+#define LCODE_ENGINE_WORDS	19 /* word count of the engine code */
+#define LCODE_BATCH_WORDS	((FEL_HELPER_SIZE >> 2) - LCODE_ENGINE_WORDS)
+#define FEL_BATCH_MAX_READS	32 /* max. number of queued read operations */
+
+typedef struct {
+	uint32_t table[LCODE_BATCH_WORDS]; /* little endian, as sent to device */
+	size_t used; /* number of words used in table[] */
+	size_t nops; /* number of queued operations */
+	struct {
+		uint32_t *dst; /* destination buffer */
+		size_t pos;    /* index of first value in table[] */
+		size_t count;  /* word count */
+	} reads[FEL_BATCH_MAX_READS];
+	size_t nreads;
+} fel_batch_t;
+
+void fel_batch_run(feldev_handle *dev, fel_batch_t *batch);
+
+void aw_fel_read(feldev_handle *dev, uint32_t offset, void *buf, size_t len)
 {
-	aw_send_fel_request(usb, AW_FEL_1_READ, offset, len);
-	aw_usb_read(usb, buf, len);
-	aw_read_fel_status(usb);
+	double start = gettime();
+	aw_send_fel_request(dev, AW_FEL_1_READ, offset, len);
+	aw_usb_read(dev->usb, buf, len);
+	aw_read_fel_status(dev);
+	trace_request("fel-read", start, offset, len);
 }
 
-void aw_fel_write(libusb_device_handle *usb, void *buf, uint32_t offset, size_t len)
+void aw_fel_write(feldev_handle *dev, void *buf, uint32_t offset, size_t len)
 {
-	aw_send_fel_request(usb, AW_FEL_1_WRITE, offset, len);
-	aw_usb_write(usb, buf, len, false);
-	aw_read_fel_status(usb);
+	double start = gettime();
+	helper_area_check(dev, offset, len);
+	aw_send_fel_request(dev, AW_FEL_1_WRITE, offset, len);
+	aw_usb_write(dev->usb, buf, len, false);
+	aw_read_fel_status(dev);
+	trace_request("fel-write", start, offset, len);
 }
 
-void aw_fel_execute(libusb_device_handle *usb, uint32_t offset)
+void aw_fel_execute(feldev_handle *dev, uint32_t offset)
 {
-	aw_send_fel_request(usb, AW_FEL_1_EXEC, offset, 0);
-	aw_read_fel_status(usb);
+	double start = gettime();
+	aw_send_fel_request(dev, AW_FEL_1_EXEC, offset, 0);
+	aw_read_fel_status(dev);
+	trace_request("fel-exec", start, offset, 0);
 }
 
-/*
- * This function is a higher-level wrapper for the FEL write functionality.
- * Unlike aw_fel_write() above - which is reserved for internal use - this
- * routine is meant to be called from "user" code, and supports (= allows)
- * progress callbacks.
- * The return value represents elapsed time in seconds (needed for execution).
- */
-double aw_write_buffer(libusb_device_handle *usb, void *buf, uint32_t offset,
-		       size_t len, bool progress)
+/* safeguard against overwriting an already loaded U-Boot binary */
+static void uboot_overlap_check(uint32_t offset, size_t len)
 {
-	/* safeguard against overwriting an already loaded U-Boot binary */
 	if (uboot_size > 0 && offset <= uboot_entry + uboot_size
 			   && offset + len >= uboot_entry)
 	{
@@ -314,10 +589,59 @@ double aw_write_buffer(libusb_device_handle *usb, void *buf, uint32_t offset,
 			uboot_entry, uboot_entry + uboot_size);
 		exit(1);
 	}
+}
+
+/*
+ * The translation table that fast mode installs is in use for the whole
+ * session, so user writes must not touch it. Returns the start address of
+ * the table if [offset, offset+len) overlaps it, 0 otherwise.
+ */
+static uint32_t fast_mode_overlap(feldev_handle *dev, uint32_t offset, size_t len)
+{
+	uint32_t tt;
+
+	if (!dev->fast.backup)
+		return 0;
+	tt = dev->fast.mmu_enabled ? dev->fast.ttbr0 : dev->soc_info->mmu_tt_addr;
+	if (offset < tt + 16 * 1024 && offset + len > tt)
+		return tt;
+	return 0;
+}
+
+void aw_fel_restore_fast_mode(feldev_handle *dev);
+
+static void fast_mode_overlap_check(feldev_handle *dev, uint32_t offset, size_t len)
+{
+	uint32_t tt = fast_mode_overlap(dev, offset, len);
+
+	if (tt) {
+		fprintf(stderr, "ERROR: Attempt to overwrite the MMU translation "
+			"table! Request 0x%08X-0x%08X overlaps 0x%08X-0x%08X "
+			"(in use by --fast).\n", offset, (uint32_t)(offset + len),
+			tt, tt + 16 * 1024);
+		aw_fel_restore_fast_mode(dev);
+		exit(1);
+	}
+}
+
+/*
+ * This function is a higher-level wrapper for the FEL write functionality.
+ * Unlike aw_fel_write() above - which is reserved for internal use - this
+ * routine is meant to be called from "user" code, and supports (= allows)
+ * progress callbacks.
+ * The return value represents elapsed time in seconds (needed for execution).
+ */
+double aw_write_buffer(feldev_handle *dev, void *buf, uint32_t offset,
+		       size_t len, bool progress)
+{
+	uboot_overlap_check(offset, len);
+	fast_mode_overlap_check(dev, offset, len);
+	helper_area_check(dev, offset, len);
 	double start = gettime();
-	aw_send_fel_request(usb, AW_FEL_1_WRITE, offset, len);
-	aw_usb_write(usb, buf, len, progress);
-	aw_read_fel_status(usb);
+	aw_send_fel_request(dev, AW_FEL_1_WRITE, offset, len);
+	aw_usb_write(dev->usb, buf, len, progress);
+	aw_read_fel_status(dev);
+	trace_request("fel-write", start, offset, len);
 	return gettime() - start;
 }
 
@@ -404,37 +728,66 @@ void *load_file(const char *name, size_t *size)
 	return buf;
 }
 
-void aw_fel_hexdump(libusb_device_handle *usb, uint32_t offset, size_t size)
+/*
+ * Retrieve file contents for uploading. Regular files get memory-mapped
+ * (read-only), so that the USB transfer reads directly from the page cache
+ * instead of requiring a full copy in a malloc'ed buffer. Other input
+ * (e.g. "-" for stdin, or pipes) falls back to load_file().
+ * The 'mapped' flag tells unmap_file() how to release the buffer.
+ */
+void *map_file(const char *name, size_t *size, bool *mapped)
 {
-	unsigned char buf[size];
-	aw_fel_read(usb, offset, buf, size);
-	hexdump(buf, offset, size);
+	*mapped = false;
+#ifndef NO_MMAP
+	struct stat st;
+	int fd;
+	if (strcmp(name, "-") != 0 && stat(name, &st) == 0
+	    && S_ISREG(st.st_mode) && st.st_size > 0) {
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			perror("Failed to open input file");
+			exit(1);
+		}
+		void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (buf != MAP_FAILED) {
+			/* we'll read the data once, from start to end */
+			posix_madvise(buf, st.st_size, POSIX_MADV_SEQUENTIAL);
+			*size = st.st_size;
+			*mapped = true;
+			return buf;
+		}
+		pr_info("mmap() failed on \"%s\", reading file instead\n", name);
+	}
+#endif
+	return load_file(name, size);
 }
 
-void aw_fel_dump(libusb_device_handle *usb, uint32_t offset, size_t size)
+void unmap_file(void *buf, size_t size, bool mapped)
 {
-	unsigned char buf[size];
-	aw_fel_read(usb, offset, buf, size);
-	fwrite(buf, size, 1, stdout);
+#ifndef NO_MMAP
+	if (mapped) {
+		munmap(buf, size);
+		return;
+	}
+#else
+	(void)size; (void)mapped;
+#endif
+	free(buf);
 }
-void aw_fel_fill(libusb_device_handle *usb, uint32_t offset, size_t size, unsigned char value)
+
+void aw_fel_hexdump(feldev_handle *dev, uint32_t offset, size_t size)
 {
 	unsigned char buf[size];
-	memset(buf, value, size);
-	aw_write_buffer(usb, buf, offset, size, false);
+	aw_fel_read(dev, offset, buf, size);
+	hexdump(buf, offset, size);
 }
 
-soc_info_t *aw_fel_get_soc_info(libusb_device_handle *usb)
+void aw_fel_dump(feldev_handle *dev, uint32_t offset, size_t size)
 {
-	/* persistent SoC info, retrieves result pointer once and caches it */
-	static soc_info_t *result = NULL;
-	if (result == NULL) {
-		struct aw_fel_version buf;
-		aw_fel_get_version(usb, &buf);
-
-		result = get_soc_info_from_version(&buf);
-	}
-	return result;
+	unsigned char buf[size];
+	aw_fel_read(dev, offset, buf, size);
+	fwrite(buf, size, 1, stdout);
 }
 
 static uint32_t fel_to_spl_thunk[] = {
@@ -444,7 +797,7 @@ static uint32_t fel_to_spl_thunk[] = {
 #define	DRAM_BASE		0x40000000
 #define	DRAM_SIZE		0x80000000
 
-uint32_t aw_read_arm_cp_reg(libusb_device_handle *usb, soc_info_t *soc_info,
+uint32_t aw_read_arm_cp_reg(feldev_handle *dev, const soc_info_t *soc_info,
 			    uint32_t coproc, uint32_t opc1, uint32_t crn,
 			    uint32_t crm, uint32_t opc2)
 {
@@ -460,13 +813,13 @@ uint32_t aw_read_arm_cp_reg(libusb_device_handle *usb, soc_info_t *soc_info,
 		htole32(0xe58f0000), /* str  r0, [pc]                         */
 		htole32(0xe12fff1e), /* bx   lr                               */
 	};
-	aw_fel_write(usb, arm_code, soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(usb, soc_info->scratch_addr);
-	aw_fel_read(usb, soc_info->scratch_addr + 12, &val, sizeof(val));
+	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
+	aw_fel_execute(dev, soc_info->scratch_addr);
+	aw_fel_read(dev, soc_info->scratch_addr + 12, &val, sizeof(val));
 	return le32toh(val);
 }
 
-void aw_write_arm_cp_reg(libusb_device_handle *usb, soc_info_t *soc_info,
+void aw_write_arm_cp_reg(feldev_handle *dev, const soc_info_t *soc_info,
 			 uint32_t coproc, uint32_t opc1, uint32_t crn,
 			 uint32_t crm, uint32_t opc2, uint32_t val)
 {
@@ -484,206 +837,817 @@ void aw_write_arm_cp_reg(libusb_device_handle *usb, soc_info_t *soc_info,
 		htole32(0xe12fff1e), /* bx   lr                               */
 		htole32(val)
 	};
-	aw_fel_write(usb, arm_code, soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(usb, soc_info->scratch_addr);
+	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
+	aw_fel_execute(dev, soc_info->scratch_addr);
 }
 
 /*
- * We don't want the scratch code/buffer to exceed a maximum size of 0x400 bytes
- * (256 32-bit words) on readl_n/writel_n transfers. To guarantee this, we have
- * to account for the amount of space the ARM code uses.
+ * Upload a resident helper (unless it's already in place), and return its
+ * address. The code array is expected in host byte order, sizes are given
+ * in bytes.
  */
-#define LCODE_ARM_WORDS  12 /* word count of the [read/write]l_n scratch code */
-#define LCODE_ARM_SIZE   (LCODE_ARM_WORDS << 2) /* code size in bytes */
-#define LCODE_MAX_TOTAL  0x100 /* max. words in buffer */
-#define LCODE_MAX_WORDS  (LCODE_MAX_TOTAL - LCODE_ARM_WORDS) /* data words */
-
-/* multiple "readl" from sequential addresses to a destination buffer */
-void aw_fel_readl_n(libusb_device_handle *usb, uint32_t addr,
-		    uint32_t *dst, size_t count)
+static uint32_t aw_fel_load_helper(feldev_handle *dev,
+				   const uint32_t *code, size_t size)
 {
-	if (count == 0) return;
-	if (count > LCODE_MAX_WORDS) {
-		fprintf(stderr,
-			"ERROR: Max. word count exceeded, truncating aw_fel_readl_n() transfer\n");
-		count = LCODE_MAX_WORDS;
-	}
-	soc_info_t *soc_info = aw_fel_get_soc_info(usb);
+	const soc_info_t *soc_info = aw_fel_get_soc_info(dev);
+	uint32_t addr = soc_info->scratch_addr + FEL_HELPER_OFFSET;
 
-	assert(LCODE_MAX_WORDS < 256); /* protect against corruption of ARM code */
-	uint32_t arm_code[] = {
-		htole32(0xe59f0020), /* ldr  r0, [pc, #32] ; ldr r0,[read_addr]  */
-		htole32(0xe28f1024), /* add  r1, pc, #36   ; adr r1, read_data   */
-		htole32(0xe59f201c), /* ldr  r2, [pc, #28] ; ldr r2,[read_count] */
-		htole32(0xe3520000 + LCODE_MAX_WORDS), /* cmp	r2, #LCODE_MAX_WORDS */
-		htole32(0xc3a02000 + LCODE_MAX_WORDS), /* movgt	r2, #LCODE_MAX_WORDS */
-		/* read_loop: */
-		htole32(0xe2522001), /* subs r2, r2, #1    ; r2 -= 1             */
-		htole32(0x412fff1e), /* bxmi lr            ; return if (r2 < 0)  */
-		htole32(0xe4903004), /* ldr  r3, [r0], #4  ; load and post-inc   */
-		htole32(0xe4813004), /* str  r3, [r1], #4  ; store and post-inc  */
-		htole32(0xeafffffa), /* b    read_loop                           */
-		htole32(addr),       /* read_addr */
-		htole32(count)       /* read_count */
-		/* read_data (buffer) follows, i.e. values go here */
-	};
-	assert(sizeof(arm_code) == LCODE_ARM_SIZE);
-
-	/* scratch buffer setup: transfers ARM code, including addr and count */
-	aw_fel_write(usb, arm_code, soc_info->scratch_addr, sizeof(arm_code));
-	/* execute code, read back the result */
-	aw_fel_execute(usb, soc_info->scratch_addr);
-	uint32_t buffer[count];
-	aw_fel_read(usb, soc_info->scratch_addr + LCODE_ARM_SIZE,
-		    buffer, sizeof(buffer));
-	/* extract values to destination buffer */
-	uint32_t *val = buffer;
-	while (count-- > 0)
-		*dst++ = le32toh(*val++);
+	assert(size <= FEL_HELPER_SIZE);
+	if (dev->resident_helper != code || dev->resident_helper_addr != addr) {
+		uint32_t buf[size / sizeof(uint32_t)];
+		size_t i;
+		for (i = 0; i < ARRAY_SIZE(buf); i++)
+			buf[i] = htole32(code[i]);
+		aw_fel_write(dev, buf, addr, size);
+		dev->resident_helper = code;
+		dev->resident_helper_addr = addr;
+	}
+	return addr;
 }
 
-/* "readl" of a single value */
-uint32_t aw_fel_readl(libusb_device_handle *usb, uint32_t addr)
+/*
+ * Run a resident helper: upload it (if necessary), pass the parameters - which
+ * are placed right after the code - and execute it. Returns the address of
+ * the parameter area, so callers may read back results from there.
+ */
+static uint32_t aw_fel_run_helper(feldev_handle *dev,
+				  const uint32_t *code, size_t code_size,
+				  void *params, size_t params_size)
 {
-	uint32_t val;
-	aw_fel_readl_n(usb, addr, &val, 1);
-	return val;
+	uint32_t addr = aw_fel_load_helper(dev, code, code_size);
+
+	assert(code_size + params_size <= FEL_HELPER_SIZE);
+	aw_fel_write(dev, params, addr + code_size, params_size);
+	/* writing the parameters doesn't affect the code itself */
+	dev->resident_helper = code;
+	aw_fel_execute(dev, addr);
+	return addr + code_size;
 }
 
 /*
- * aw_fel_readl_n() wrapper that can handle large transfers. If necessary,
- * those will be done in separate 'chunks' of no more than LCODE_MAX_WORDS.
+ * Memory fill and copy helper. It takes four parameter words: destination
+ * and source addresses, byte count and mode. Mode 0 selects copying (with
+ * memmove() semantics, i.e. overlapping areas are fine), otherwise the
+ * destination gets filled with the byte value passed as 'source'.
+ */
+#define MEMOPS_COPY	0
+#define MEMOPS_FILL	1
+
+static const uint32_t memops_helper[] = {
+	0xe92d4030, /* push  {r4, r5, lr} */
+	0xe28fc0bc, /* adr   ip, params */
+	0xe89c000f, /* ldm   ip, {r0, r1, r2, r3}  ; dst, src/value, length, mode */
+	0xe3530000, /* cmp   r3, #0 */
+	0x1a000017, /* bne   fill                  ; mode != 0: fill */
+	/* copy: */
+	0xe1500001, /* cmp   r0, r1 */
+	0x9a000008, /* bls   copy_fwd              ; dst <= src */
+	0xe0813002, /* add   r3, r1, r2 */
+	0xe1500003, /* cmp   r0, r3 */
+	0x2a000005, /* bcs   copy_fwd              ; dst >= src + length */
+	0xe0800002, /* add   r0, r0, r2            ; overlap, copy backwards */
+	/* copy_bwd: */
+	0xe2522001, /* subs  r2, r2, #1 */
+	0x4a000023, /* bmi   done */
+	0xe5734001, /* ldrb  r4, [r3, #-1]! */
+	0xe5604001, /* strb  r4, [r0, #-1]! */
+	0xeafffffa, /* b     copy_bwd */
+	/* copy_fwd: */
+	0xe1803001, /* orr   r3, r0, r1 */
+	0xe3130003, /* tst   r3, #3                ; both word aligned? */
+	0x1a000004, /* bne   copy_bytes */
+	/* copy_words: */
+	0xe2522010, /* subs  r2, r2, #16 */
+	0x28b11038, /* ldmcs r1!, {r3, r4, r5, ip} ; 16 bytes at a time */
+	0x28a01038, /* stmcs r0!, {r3, r4, r5, ip} */
+	0x2afffffb, /* bcs   copy_words */
+	0xe2822010, /* add   r2, r2, #16 */
+	/* copy_bytes: */
+	0xe2522001, /* subs  r2, r2, #1 */
+	0x4a000016, /* bmi   done */
+	0xe4d13001, /* ldrb  r3, [r1], #1 */
+	0xe4c03001, /* strb  r3, [r0], #1 */
+	0xeafffffa, /* b     copy_bytes */
+	/* fill: */
+	0xe20110ff, /* and   r1, r1, #0xff         ; replicate fill byte */
+	0xe1811401, /* orr   r1, r1, r1, lsl #8 */
+	0xe1811801, /* orr   r1, r1, r1, lsl #16 */
+	/* fill_align: */
+	0xe3100003, /* tst   r0, #3 */
+	0x0a000003, /* beq   fill_aligned */
+	0xe2522001, /* subs  r2, r2, #1 */
+	0x4a00000c, /* bmi   done */
+	0xe4c01001, /* strb  r1, [r0], #1 */
+	0xeafffff9, /* b     fill_align */
+	/* fill_aligned: */
+	0xe1a03001, /* mov   r3, r1 */
+	0xe1a04001, /* mov   r4, r1 */
+	0xe1a05001, /* mov   r5, r1 */
+	/* fill_words: */
+	0xe2522010, /* subs  r2, r2, #16 */
+	0x28a0003a, /* stmcs r0!, {r1, r3, r4, r5} ; 16 bytes at a time */
+	0x2afffffc, /* bcs   fill_words */
+	0xe2822010, /* add   r2, r2, #16 */
+	/* fill_bytes: */
+	0xe2522001, /* subs  r2, r2, #1 */
+	0x4a000001, /* bmi   done */
+	0xe4c01001, /* strb  r1, [r0], #1 */
+	0xeafffffb, /* b     fill_bytes */
+	/* done: */
+	0xe8bd8030, /* pop   {r4, r5, pc} */
+	/* params follow */
+};
+
+/*
+ * The time a helper may take is limited by the USB timeout for the FEL
+ * status response, so we split large requests. The ldm/stm loops (fill, and
+ * copies with word aligned addresses) manage well above 16 MiB per second
+ * even on "slow" SoCs. The byte loops are several times slower - all the
+ * more so with the BROM's default (strongly ordered) DRAM mapping - so copies
+ * using them (unaligned, or overlapping upwards) get much smaller chunks.
  */
-void fel_readl_n(libusb_device_handle *usb, uint32_t addr,
-		 uint32_t *dst, size_t count)
+#define MEMOPS_MAX_CHUNK	(64 * 1024 * 1024)
+#define MEMOPS_MAX_BYTE_CHUNK	(4 * 1024 * 1024)
+
+static void aw_fel_memops(feldev_handle *dev, uint32_t dst, uint32_t src,
+			  size_t size, uint32_t mode)
 {
-	while (count > 0) {
-		size_t n = count > LCODE_MAX_WORDS ? LCODE_MAX_WORDS : count;
-		aw_fel_readl_n(usb, addr, dst, n);
-		addr += n * sizeof(uint32_t);
-		dst += n;
-		count -= n;
+	/* (chunks are multiples of 4, so this doesn't change along the way) */
+	bool bytewise = mode == MEMOPS_COPY &&
+			(((dst | src) & 3) || (dst > src && dst < src + size));
+	size_t max_chunk = bytewise ? MEMOPS_MAX_BYTE_CHUNK : MEMOPS_MAX_CHUNK;
+
+	while (size > 0) {
+		size_t chunk = size < max_chunk ? size : max_chunk;
+		uint32_t params[] = {
+			htole32(dst),
+			htole32(src),
+			htole32(chunk),
+			htole32(mode)
+		};
+		/* copy backwards in chunks if moving data to higher addresses */
+		if (mode == MEMOPS_COPY && dst > src && dst < src + size) {
+			params[0] = htole32(dst + size - chunk);
+			params[1] = htole32(src + size - chunk);
+		} else {
+			dst += chunk;
+			if (mode == MEMOPS_COPY)
+				src += chunk;
+		}
+		aw_fel_run_helper(dev, memops_helper, sizeof(memops_helper),
+				  params, sizeof(params));
+		size -= chunk;
 	}
 }
 
-/* multiple "writel" from a source buffer to sequential addresses */
-void aw_fel_writel_n(libusb_device_handle *usb, uint32_t addr,
-		     uint32_t *src, size_t count)
+/* check if [offset, offset+len) hits the scratch and helper areas */
+static bool scratch_area_overlap(feldev_handle *dev, uint32_t offset, size_t len)
 {
-	if (count == 0) return;
-	if (count > LCODE_MAX_WORDS) {
-		fprintf(stderr,
-			"ERROR: Max. word count exceeded, truncating aw_fel_writel_n() transfer\n");
-		count = LCODE_MAX_WORDS;
-	}
-	soc_info_t *soc_info = aw_fel_get_soc_info(usb);
+	const soc_info_t *soc_info = aw_fel_get_soc_info(dev);
+	uint32_t start = soc_info->scratch_addr;
+	uint32_t end = start + FEL_HELPER_OFFSET + FEL_HELPER_SIZE;
+	return offset < end && offset + len > start;
+}
 
-	assert(LCODE_MAX_WORDS < 256); /* protect against corruption of ARM code */
-	/*
-	 * We need a fixed array size to allow for (partial) initialization,
-	 * so we'll claim the maximum total number of words (0x100) here.
-	 */
-	uint32_t arm_code[LCODE_MAX_TOTAL] = {
-		htole32(0xe59f0020), /* ldr  r0, [pc, #32] ; ldr r0,[write_addr] */
-		htole32(0xe28f1024), /* add  r1, pc, #36   ; adr r1, write_data  */
-		htole32(0xe59f201c), /* ldr  r2, [pc, #28] ; ldr r2,[write_count]*/
-		htole32(0xe3520000 + LCODE_MAX_WORDS), /* cmp	r2, #LCODE_MAX_WORDS */
-		htole32(0xc3a02000 + LCODE_MAX_WORDS), /* movgt	r2, #LCODE_MAX_WORDS */
-		/* write_loop: */
-		htole32(0xe2522001), /* subs r2, r2, #1    ; r2 -= 1             */
-		htole32(0x412fff1e), /* bxmi lr            ; return if (r2 < 0)  */
-		htole32(0xe4913004), /* ldr  r3, [r1], #4  ; load and post-inc   */
-		htole32(0xe4803004), /* str  r3, [r0], #4  ; store and post-inc  */
-		htole32(0xeafffffa), /* b    write_loop                          */
-		htole32(addr),       /* write_addr */
-		htole32(count)       /* write_count */
-		/* write_data (buffer) follows, i.e. values taken from here */
-	};
+/*
+ * LZ4 decompression helper. Parameters are the destination address, plus
+ * start and end address of the compressed data (a single LZ4 block).
+ */
+static const uint32_t lz4_helper[] = {
+	0xe92d4070, /* push  {r4, r5, r6, lr} */
+	0xe28fc088, /* adr   ip, params */
+	0xe89c0007, /* ldm   ip, {r0, r1, r2}      ; dst, src, src end */
+	/* seq: */
+	0xe1510002, /* cmp   r1, r2 */
+	0x2a00001e, /* bhs   done */
+	0xe4d13001, /* ldrb  r3, [r1], #1          ; token */
+	0xe1a04223, /* lsr   r4, r3, #4            ; literal length */
+	0xe354000f, /* cmp   r4, #15 */
+	0x1a000003, /* bne   lit_copy */
+	/* lit_len: */
+	0xe4d15001, /* ldrb  r5, [r1], #1 */
+	0xe0844005, /* add   r4, r4, r5 */
+	0xe35500ff, /* cmp   r5, #255 */
+	0x0afffffb, /* beq   lit_len */
+	/* lit_copy: */
+	0xe2544001, /* subs  r4, r4, #1 */
+	0x54d15001, /* ldrbpl r5, [r1], #1 */
+	0x54c05001, /* strbpl r5, [r0], #1 */
+	0x5afffffb, /* bpl   lit_copy */
+	0xe1510002, /* cmp   r1, r2 */
+	0x2a000010, /* bhs   done                  ; last sequence has no match */
+	0xe4d15001, /* ldrb  r5, [r1], #1 */
+	0xe4d16001, /* ldrb  r6, [r1], #1 */
+	0xe1855406, /* orr   r5, r5, r6, lsl #8    ; match offset */
+	0xe0405005, /* sub   r5, r0, r5            ; match source */
+	0xe203400f, /* and   r4, r3, #15           ; match length - 4 */
+	0xe354000f, /* cmp   r4, #15 */
+	0x1a000003, /* bne   match_copy4 */
+	/* match_len: */
+	0xe4d16001, /* ldrb  r6, [r1], #1 */
+	0xe0844006, /* add   r4, r4, r6 */
+	0xe35600ff, /* cmp   r6, #255 */
+	0x0afffffb, /* beq   match_len */
+	/* match_copy4: */
+	0xe2844004, /* add   r4, r4, #4 */
+	/* match_copy: */
+	0xe2544001, /* subs  r4, r4, #1 */
+	0x54d56001, /* ldrbpl r6, [r5], #1 */
+	0x54c06001, /* strbpl r6, [r0], #1 */
+	0x5afffffb, /* bpl   match_copy */
+	0xeaffffde, /* b     seq */
+	/* done: */
+	0xe8bd8070, /* pop   {r4, r5, r6, pc} */
+	/* params follow */
+};
 
-	/* copy values from source buffer */
-	size_t i;
-	for (i = 0; i < count; i++)
-		arm_code[LCODE_ARM_WORDS + i] = htole32(*src++);
-	/* scratch buffer setup: transfers ARM code and data */
-	aw_fel_write(usb, arm_code, soc_info->scratch_addr,
-	             (LCODE_ARM_WORDS + count) * sizeof(uint32_t));
-	/* execute, and we're done */
-	aw_fel_execute(usb, soc_info->scratch_addr);
-}
+/*
+ * Compressed uploads get processed in blocks of this size. Each block costs
+ * an extra FEL "execute" for the decompression, but keeps host memory usage
+ * low and provides reasonable progress granularity.
+ */
+#define LZ4_BLOCK_SIZE		(256 * 1024)
 
-/* "writel" of a single value */
-void aw_fel_writel(libusb_device_handle *usb, uint32_t addr, uint32_t val)
+/* bytes actually sent by aw_write_compressed(), for the upload summary */
+static size_t lz4_bytes_sent;
+
+/*
+ * Write a buffer with on-target decompression: each block gets LZ4-compressed
+ * on the host, uploaded to the end of its own destination area, and then
+ * decompressed in place by the lz4_helper. (If needed, the compressed data is
+ * shifted up into the following block's area, which gets written later.)
+ * Blocks that don't compress well - or would require a margin beyond the end
+ * of the buffer - are sent as they are. The result is always identical to a
+ * plain aw_write_buffer(). Progress is reported in terms of original data.
+ */
+double aw_write_compressed(feldev_handle *dev, uint8_t *buf, uint32_t offset,
+			   size_t len, bool progress)
 {
-	aw_fel_writel_n(usb, addr, &val, 1);
+	uint8_t *cbuf;
+	size_t done, sent = 0;
+	double start = gettime();
+
+	/* the helper can't decompress over its own memory area */
+	if (scratch_area_overlap(dev, offset, len)) {
+		lz4_bytes_sent += len;
+		return aw_write_buffer(dev, buf, offset, len, progress);
+	}
+
+	uboot_overlap_check(offset, len);
+	fast_mode_overlap_check(dev, offset, len);
+	cbuf = malloc(LZ4_COMPRESS_BOUND(LZ4_BLOCK_SIZE));
+	if (!cbuf) {
+		fprintf(stderr, "LZ4: out of memory\n");
+		exit(1);
+	}
+
+	for (done = 0; done < len; ) {
+		size_t n = len - done < LZ4_BLOCK_SIZE ? len - done : LZ4_BLOCK_SIZE;
+		size_t overhang, margin = 0;
+		size_t csize = lz4_compress(buf + done, n, cbuf, &overhang);
+
+		if (csize < n && overhang > n - csize)
+			margin = overhang - (n - csize);
+		if (csize < n - n / 8 && margin <= len - done - n) {
+			uint32_t stage = offset + done + n - csize + margin;
+			uint32_t params[] = {
+				htole32(offset + done),
+				htole32(stage),
+				htole32(stage + csize)
+			};
+			aw_write_buffer(dev, cbuf, stage, csize, false);
+			aw_fel_run_helper(dev, lz4_helper, sizeof(lz4_helper),
+					  params, sizeof(params));
+			sent += csize;
+		} else {
+			aw_write_buffer(dev, buf + done, offset + done, n, false);
+			sent += n;
+		}
+		done += n;
+		if (progress)
+			progress_update(n);
+	}
+	free(cbuf);
+
+	double elapsed = gettime() - start;
+	lz4_bytes_sent += sent;
+	pr_info("LZ4: 0x%08X: %zu bytes sent as %zu (%.1f%%), %.1f kB/s effective\n",
+		offset, len, sent, len > 0 ? 100. * sent / len : 0.,
+		kilo(rate(len, elapsed)));
+	return elapsed;
 }
 
 /*
- * aw_fel_writel_n() wrapper that can handle large transfers. If necessary,
- * those will be done in separate 'chunks' of no more than LCODE_MAX_WORDS.
+ * CRC32 helper, computing the same checksum as crc32_update() on the device.
+ * It takes four parameter words: start address, block size, block count and
+ * the initial CRC value. For each block, the resulting CRC gets stored in an
+ * array following the parameters. To keep the code small, it processes
+ * nibbles with a 16-entry lookup table.
+ */
+static const uint32_t crc32_helper[] = {
+	0xe92d40f0, /* push  {r4, r5, r6, r7, lr} */
+	0xe28fc094, /* adr   ip, params */
+	0xe89c0027, /* ldm   ip, {r0, r1, r2, r5}  ; addr, block size, count, crc */
+	0xe28f404c, /* adr   r4, crc_table */
+	0xe28c6010, /* add   r6, ip, #16           ; results follow the params */
+	/* block: */
+	0xe2522001, /* subs  r2, r2, #1 */
+	0x3a00000f, /* bcc   done */
+	0xe1e07005, /* mvn   r7, r5 */
+	0xe1a0c001, /* mov   ip, r1 */
+	/* loop: */
+	0xe25cc001, /* subs  ip, ip, #1 */
+	0x3a000008, /* bcc   next */
+	0xe4d03001, /* ldrb  r3, [r0], #1 */
+	0xe0277003, /* eor   r7, r7, r3 */
+	0xe207300f, /* and   r3, r7, #15           ; process low nibble */
+	0xe7943103, /* ldr   r3, [r4, r3, lsl #2] */
+	0xe0237227, /* eor   r7, r3, r7, lsr #4 */
+	0xe207300f, /* and   r3, r7, #15           ; process high nibble */
+	0xe7943103, /* ldr   r3, [r4, r3, lsl #2] */
+	0xe0237227, /* eor   r7, r3, r7, lsr #4 */
+	0xeafffff4, /* b     loop */
+	/* next: */
+	0xe1e07007, /* mvn   r7, r7 */
+	0xe4867004, /* str   r7, [r6], #4          ; store block result */
+	0xeaffffed, /* b     block */
+	/* done: */
+	0xe8bd80f0, /* pop   {r4, r5, r6, r7, pc} */
+	/* crc_table: */
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+	/* params follow */
+};
+
+/*
+ * Even at 24 MHz CPU clock (before the SPL sets up PLLs), the helper will
+ * process this amount of data well within the USB timeout.
+ */
+#define CRC32_MAX_CHUNK		(4 * 1024 * 1024)
+
+/* maximum number of block results, limited by the helper area size */
+#define CRC32_MAX_BLOCKS	128
+
+/*
+ * Calculate CRCs of 'count' consecutive blocks on the device, each one
+ * starting from the initial value 'crc'. Results get stored to 'result'.
  */
-void fel_writel_n(libusb_device_handle *usb, uint32_t addr,
-		  uint32_t *src, size_t count)
+static void aw_fel_crc32_blocks(feldev_handle *dev, uint32_t offset,
+				size_t block_size, size_t count, uint32_t crc,
+				uint32_t *result)
 {
-	while (count > 0) {
-		size_t n = count > LCODE_MAX_WORDS ? LCODE_MAX_WORDS : count;
-		aw_fel_writel_n(usb, addr, src, n);
-		addr += n * sizeof(uint32_t);
-		src += n;
-		count -= n;
-	}
+	assert(count <= CRC32_MAX_BLOCKS && block_size * count <= CRC32_MAX_CHUNK);
+	uint32_t params[] = {
+		htole32(offset),
+		htole32(block_size),
+		htole32(count),
+		htole32(crc)
+	};
+	size_t i;
+	uint32_t addr = aw_fel_run_helper(dev, crc32_helper,
+					  sizeof(crc32_helper),
+					  params, sizeof(params));
+	aw_fel_read(dev, addr + sizeof(params), result, count * sizeof(*result));
+	for (i = 0; i < count; i++)
+		result[i] = le32toh(result[i]);
 }
 
-void aw_fel_print_sid(libusb_device_handle *usb)
+/* Calculate the CRC32 of a memory area on the device */
+uint32_t aw_fel_crc32(feldev_handle *dev, uint32_t offset, size_t len)
 {
-	soc_info_t *soc_info = aw_fel_get_soc_info(usb);
-	if (soc_info->sid_addr) {
-		pr_info("SID key (e-fuses) at 0x%08X\n", soc_info->sid_addr);
+	uint32_t crc = 0;
 
-		uint32_t key[4];
-		aw_fel_readl_n(usb, soc_info->sid_addr, key, 4);
+	/*
+	 * Running the helper would clobber data in the scratch area,
+	 * so read back that memory instead.
+	 */
+	if (scratch_area_overlap(dev, offset, len)) {
+		uint8_t *buf = malloc(len);
+		if (!buf) {
+			fprintf(stderr, "CRC32: out of memory\n");
+			exit(1);
+		}
+		aw_fel_read(dev, offset, buf, len);
+		crc = crc32_update(0, buf, len);
+		free(buf);
+		return crc;
+	}
 
-		unsigned int i;
-		/* output SID in "xxxxxxxx:xxxxxxxx:xxxxxxxx:xxxxxxxx" format */
-		for (i = 0; i <= 3; i++)
-			printf("%08x%c", key[i], i < 3 ? ':' : '\n');
-	} else {
-		printf("SID registers for your SoC (id=%04X) are unknown or inaccessible.\n",
-			soc_info->soc_id);
+	while (len > 0) {
+		size_t chunk = len < CRC32_MAX_CHUNK ? len : CRC32_MAX_CHUNK;
+		aw_fel_crc32_blocks(dev, offset, chunk, 1, crc, &crc);
+		offset += chunk;
+		len -= chunk;
 	}
+	return crc;
 }
 
-void aw_enable_l2_cache(libusb_device_handle *usb, soc_info_t *soc_info)
+/*
+ * Verify data written to the device, by comparing checksums. This avoids
+ * transferring the memory content back to the host.
+ */
+void aw_fel_verify(feldev_handle *dev, const void *buf, uint32_t offset,
+		   size_t len)
 {
-	uint32_t arm_code[] = {
-		htole32(0xee112f30), /* mrc        15, 0, r2, cr1, cr0, {1}  */
-		htole32(0xe3822002), /* orr        r2, r2, #2                */
-		htole32(0xee012f30), /* mcr        15, 0, r2, cr1, cr0, {1}  */
-		htole32(0xe12fff1e), /* bx         lr                        */
-	};
+	uint32_t expected = crc32_update(0, buf, len);
+	uint32_t actual = aw_fel_crc32(dev, offset, len);
 
-	aw_fel_write(usb, arm_code, soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(usb, soc_info->scratch_addr);
+	if (actual != expected) {
+		fprintf(stderr, "ERROR: Verification failed for 0x%08X-0x%08X: "
+			"CRC32 is 0x%08X, expected 0x%08X.\n",
+			offset, (uint32_t)(offset + len), actual, expected);
+		exit(1);
+	}
+	pr_info("Verified %zu bytes @ 0x%08X, CRC32 0x%08X.\n",
+		len, offset, actual);
 }
 
-void aw_get_stackinfo(libusb_device_handle *usb, soc_info_t *soc_info,
-                      uint32_t *sp_irq, uint32_t *sp)
+/* helper for aw_write_delta(), transfer a range of changed blocks */
+static void send_blocks(feldev_handle *dev, uint8_t *buf, uint32_t offset,
+			size_t start, size_t len)
 {
-	uint32_t results[2] = { 0 };
-#if 0
-	/* Does not work on Cortex-A8 (needs Virtualization Extensions) */
-	uint32_t arm_code[] = {
-		htole32(0xe1010300), /* mrs        r0, SP_irq                */
-		htole32(0xe58f0004), /* str        r0, [pc, #4]              */
-		htole32(0xe58fd004), /* str        sp, [pc, #4]              */
-		htole32(0xe12fff1e), /* bx         lr                        */
-	};
+	if (compress_uploads)
+		aw_write_compressed(dev, buf + start, offset + start, len, false);
+	else
+		aw_write_buffer(dev, buf + start, offset + start, len, false);
+}
 
-	aw_fel_write(usb, arm_code, soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(usb, soc_info->scratch_addr);
-	aw_fel_read(usb, soc_info->scratch_addr + 0x10, results, 8);
-#else
-	/* Works everywhere */
-	uint32_t arm_code[] = {
+/*
+ * Block size for "write --delta". Smaller blocks allow finer granularity,
+ * at the cost of more CRC results to transfer (and less efficient writes).
+ */
+#define DELTA_BLOCK_SIZE	(64 * 1024)
+
+/*
+ * Write a buffer to the device, skipping blocks that already hold the
+ * desired content. The device calculates CRCs of all blocks within the
+ * target area, and only blocks with mismatching CRCs get transferred.
+ * Consecutive changed blocks are sent in one go. This keeps re-uploading
+ * a slightly modified image fast, but relies on CRC32 - there's a (very)
+ * small chance of a changed block going unnoticed.
+ */
+double aw_write_delta(feldev_handle *dev, uint8_t *buf, uint32_t offset,
+		      size_t len, bool progress)
+{
+	uint32_t crc[CRC32_MAX_BLOCKS];
+	size_t batch = CRC32_MAX_CHUNK / DELTA_BLOCK_SIZE;
+	size_t done = 0, pending = 0, sent = 0, i;
+	double start = gettime();
+
+	/* the helper can't hash its own memory area, just send everything */
+	if (scratch_area_overlap(dev, offset, len))
+		return aw_write_buffer(dev, buf, offset, len, progress);
+
+	if (batch > CRC32_MAX_BLOCKS)
+		batch = CRC32_MAX_BLOCKS;
+	uboot_overlap_check(offset, len);
+	fast_mode_overlap_check(dev, offset, len);
+
+	while (done < len) {
+		size_t count = (len - done) / DELTA_BLOCK_SIZE;
+		size_t block_size = DELTA_BLOCK_SIZE;
+
+		/* trailing partial block gets handled on its own */
+		if (count == 0) {
+			count = 1;
+			block_size = len - done;
+		} else if (count > batch) {
+			count = batch;
+		}
+		aw_fel_crc32_blocks(dev, offset + done, block_size, count, 0, crc);
+
+		for (i = 0; i < count; i++) {
+			if (crc[i] != crc32_update(0, buf + done, block_size)) {
+				pending += block_size;
+			} else if (pending > 0) {
+				/* flush the run of changed blocks before this one */
+				send_blocks(dev, buf, offset, done - pending, pending);
+				sent += pending;
+				pending = 0;
+			}
+			done += block_size;
+			if (progress)
+				progress_update(block_size);
+		}
+	}
+	if (pending > 0) {
+		send_blocks(dev, buf, offset, done - pending, pending);
+		sent += pending;
+	}
+
+	double elapsed = gettime() - start;
+	pr_info("Delta: %zu of %zu bytes changed, %.1f kB/s effective\n",
+		sent, len, kilo(rate(len, elapsed)));
+	return elapsed;
+}
+
+/*
+ * Fill memory on the device. This uses the memops helper, so that we only
+ * need to transfer a few parameters, instead of the whole memory content.
+ * The helper can't fill its own memory area, so in that case we fall back
+ * to sending a buffer.
+ */
+void aw_fel_fill(feldev_handle *dev, uint32_t offset, size_t size, unsigned char value)
+{
+	uboot_overlap_check(offset, size);
+	fast_mode_overlap_check(dev, offset, size);
+	if (scratch_area_overlap(dev, offset, size)) {
+		unsigned char buf[size];
+		memset(buf, value, size);
+		aw_write_buffer(dev, buf, offset, size, false);
+		return;
+	}
+	aw_fel_memops(dev, offset, value, size, MEMOPS_FILL);
+}
+
+/* Copy memory on the device ("memmove"), without a round-trip to the host */
+void aw_fel_copy(feldev_handle *dev, uint32_t dst, uint32_t src, size_t size)
+{
+	uboot_overlap_check(dst, size);
+	fast_mode_overlap_check(dev, dst, size);
+	if (scratch_area_overlap(dev, dst, size)) {
+		fprintf(stderr, "ERROR: copy destination 0x%08X-0x%08X overlaps "
+			"the FEL scratch area.\n", dst, (uint32_t)(dst + size));
+		exit(1);
+	}
+	aw_fel_memops(dev, dst, src, size, MEMOPS_COPY);
+}
+
+/*
+ * Register access engine, a resident helper for batched "readl" and "writel"
+ * operations. It processes an operation table, which follows right after the
+ * code: a word count of operations, then for each one the address (with bit 0
+ * set for writes) and a word count, followed by 'count' data words. Write
+ * operations take their values from there, reads store the results in place.
+ */
+static const uint32_t lcode_engine[] = {
+	0xe28f0044, /*     add  r0, pc, #68    ; adr r0, op_table           */
+	0xe4901004, /*     ldr  r1, [r0], #4   ; number of operations       */
+	/* op_loop: */
+	0xe2511001, /*     subs r1, r1, #1     ; r1 -= 1                    */
+	0x412fff1e, /*     bxmi lr             ; return if (r1 < 0)         */
+	0xe4902004, /*     ldr  r2, [r0], #4   ; address (and write flag)   */
+	0xe4903004, /*     ldr  r3, [r0], #4   ; word count                 */
+	0xe3120001, /*     tst  r2, #1         ; write operation?           */
+	0xe3c22003, /*     bic  r2, r2, #3     ; (clear flag bits)          */
+	0x1a000004, /*     bne  write_loop                                  */
+	/* read_loop: */
+	0xe2533001, /*     subs r3, r3, #1     ; r3 -= 1                    */
+	0x4afffff6, /*     bmi  op_loop        ; next op if (r3 < 0)        */
+	0xe492c004, /*     ldr  ip, [r2], #4   ; load and post-inc          */
+	0xe480c004, /*     str  ip, [r0], #4   ; store and post-inc         */
+	0xeafffffa, /*     b    read_loop                                   */
+	/* write_loop: */
+	0xe2533001, /*     subs r3, r3, #1     ; r3 -= 1                    */
+	0x4afffff1, /*     bmi  op_loop        ; next op if (r3 < 0)        */
+	0xe490c004, /*     ldr  ip, [r0], #4   ; load and post-inc          */
+	0xe482c004, /*     str  ip, [r2], #4   ; store and post-inc         */
+	0xeafffffa, /*     b    write_loop                                  */
+	/* op_table follows */
+};
+
+/* queue an operation header, returning the number of data words it may use */
+static size_t fel_batch_op(feldev_handle *dev, fel_batch_t *batch,
+			   uint32_t addr, size_t count)
+{
+	/* flush the batch if there's no room for header plus one data word */
+	if (batch->used + 3 > LCODE_BATCH_WORDS
+	    || batch->nreads >= FEL_BATCH_MAX_READS)
+		fel_batch_run(dev, batch);
+
+	size_t room = LCODE_BATCH_WORDS - batch->used - 2;
+	if (count > room)
+		count = room;
+	batch->table[batch->used++] = htole32(addr);
+	batch->table[batch->used++] = htole32(count);
+	batch->nops++;
+	return count;
+}
+
+void fel_batch_init(fel_batch_t *batch)
+{
+	batch->used = 1; /* first word is the operation count */
+	batch->nops = 0;
+	batch->nreads = 0;
+}
+
+/*
+ * Queue reading 'count' words from sequential addresses. The values will be
+ * stored to 'dst' by fel_batch_run(), so the buffer has to remain valid until
+ * then. Large requests get split as necessary, which may cause intermediate
+ * (implicit) runs of the batch.
+ */
+void fel_batch_readl_n(feldev_handle *dev, fel_batch_t *batch,
+		       uint32_t addr, uint32_t *dst, size_t count)
+{
+	while (count > 0) {
+		size_t n = fel_batch_op(dev, batch, addr, count);
+		batch->reads[batch->nreads].dst = dst;
+		batch->reads[batch->nreads].pos = batch->used;
+		batch->reads[batch->nreads].count = n;
+		batch->nreads++;
+		batch->used += n;
+		addr += n * sizeof(uint32_t);
+		dst += n;
+		count -= n;
+	}
+}
+
+/* Queue writing 'count' words to sequential addresses (values get copied) */
+void fel_batch_writel_n(feldev_handle *dev, fel_batch_t *batch,
+			uint32_t addr, const uint32_t *src, size_t count)
+{
+	while (count > 0) {
+		size_t i, n = fel_batch_op(dev, batch, addr | 1, count);
+		for (i = 0; i < n; i++)
+			batch->table[batch->used++] = htole32(*src++);
+		addr += n * sizeof(uint32_t);
+		count -= n;
+	}
+}
+
+void fel_batch_writel(feldev_handle *dev, fel_batch_t *batch,
+		      uint32_t addr, uint32_t val)
+{
+	fel_batch_writel_n(dev, batch, addr, &val, 1);
+}
+
+/*
+ * Execute all queued operations (with a single FEL "execute" request), then
+ * retrieve the results of any reads. The batch is empty afterwards.
+ */
+void fel_batch_run(feldev_handle *dev, fel_batch_t *batch)
+{
+	size_t i, first;
+
+	assert(ARRAY_SIZE(lcode_engine) == LCODE_ENGINE_WORDS);
+	if (batch->nops == 0)
+		return;
+
+	batch->table[0] = htole32(batch->nops);
+	uint32_t table_addr = aw_fel_run_helper(dev, lcode_engine,
+				sizeof(lcode_engine), batch->table,
+				batch->used * sizeof(uint32_t));
+
+	if (batch->nreads > 0) {
+		/* read back everything from the first result on */
+		first = batch->reads[0].pos;
+		aw_fel_read(dev, table_addr + first * sizeof(uint32_t),
+			    batch->table + first,
+			    (batch->used - first) * sizeof(uint32_t));
+		for (i = 0; i < batch->nreads; i++) {
+			uint32_t *val = batch->table + batch->reads[i].pos;
+			uint32_t *dst = batch->reads[i].dst;
+			size_t n = batch->reads[i].count;
+			while (n-- > 0)
+				*dst++ = le32toh(*val++);
+		}
+	}
+	fel_batch_init(batch);
+}
+
+/* multiple "readl" from sequential addresses to a destination buffer */
+void aw_fel_readl_n(feldev_handle *dev, uint32_t addr,
+		    uint32_t *dst, size_t count)
+{
+	fel_batch_t batch;
+	fel_batch_init(&batch);
+	fel_batch_readl_n(dev, &batch, addr, dst, count);
+	fel_batch_run(dev, &batch);
+}
+
+/* "readl" of a single value */
+uint32_t aw_fel_readl(feldev_handle *dev, uint32_t addr)
+{
+	uint32_t val;
+	aw_fel_readl_n(dev, addr, &val, 1);
+	return val;
+}
+
+/* multiple "writel" from a source buffer to sequential addresses */
+void aw_fel_writel_n(feldev_handle *dev, uint32_t addr,
+		     uint32_t *src, size_t count)
+{
+	fel_batch_t batch;
+	fel_batch_init(&batch);
+	fel_batch_writel_n(dev, &batch, addr, src, count);
+	fel_batch_run(dev, &batch);
+}
+
+/* "writel" of a single value */
+void aw_fel_writel(feldev_handle *dev, uint32_t addr, uint32_t val)
+{
+	aw_fel_writel_n(dev, addr, &val, 1);
+}
+
+/*
+ * "pio" command: apply sunxi-pio pin commands (see pio_command()) to the
+ * PIO registers of the device. All registers are read with one burst into a
+ * local copy, the commands operate on that, and only the changed registers
+ * get written back - in a single batch. Returns the number of arguments
+ * consumed, i.e. pin commands up to the first argument that isn't one.
+ */
+static int aw_fel_pio(feldev_handle *dev, int argc, char **argv)
+{
+	uint32_t orig[PIO_REG_SIZE / 4], regs[PIO_REG_SIZE / 4];
+	fel_batch_t batch;
+	size_t i, n;
+	int count;
+
+	aw_fel_readl_n(dev, PIO_BASE, orig, ARRAY_SIZE(orig));
+	for (i = 0; i < ARRAY_SIZE(regs); i++)
+		regs[i] = htole32(orig[i]);
+
+	for (count = 0; count < argc; count++) {
+		if (argv[count][0] == 'P' && strchr(argv[count], '*')) {
+			/* this would only toggle our local copy */
+			fprintf(stderr, "pio: '%s' needs to run on the device "
+				"(sunxi-pio -m)\n", argv[count]);
+			exit(1);
+		}
+		if (!pio_command((char *)regs, argv[count]))
+			break;
+	}
+	if (count == 0) {
+		fprintf(stderr, "pio: expected pin command, got '%s'\n",
+			argc > 0 ? argv[0] : "");
+		exit(1);
+	}
+
+	/* write back runs of changed registers */
+	for (i = 0; i < ARRAY_SIZE(regs); i++)
+		regs[i] = le32toh(regs[i]);
+	fel_batch_init(&batch);
+	for (i = 0; i < ARRAY_SIZE(regs); i += n) {
+		for (n = 0; i + n < ARRAY_SIZE(regs); n++)
+			if (regs[i + n] == orig[i + n])
+				break;
+		if (n == 0) {
+			n = 1; /* unchanged */
+			continue;
+		}
+		pr_info("pio: writing %zu register(s) at 0x%08zX\n",
+			n, PIO_BASE + i * 4);
+		fel_batch_writel_n(dev, &batch, PIO_BASE + i * 4, regs + i, n);
+	}
+	fel_batch_run(dev, &batch);
+
+	return count;
+}
+
+void aw_fel_print_sid(feldev_handle *dev)
+{
+	const soc_info_t *soc_info = aw_fel_get_soc_info(dev);
+	if (soc_info->sid_addr) {
+		pr_info("SID key (e-fuses) at 0x%08X\n", soc_info->sid_addr);
+
+		uint32_t key[4];
+		aw_fel_readl_n(dev, soc_info->sid_addr, key, 4);
+
+		unsigned int i;
+		/* output SID in "xxxxxxxx:xxxxxxxx:xxxxxxxx:xxxxxxxx" format */
+		for (i = 0; i <= 3; i++)
+			printf("%08x%c", key[i], i < 3 ? ':' : '\n');
+	} else {
+		printf("SID registers for your SoC (id=%04X) are unknown or inaccessible.\n",
+			soc_info->soc_id);
+	}
+}
+
+void aw_enable_l2_cache(feldev_handle *dev, const soc_info_t *soc_info)
+{
+	uint32_t arm_code[] = {
+		htole32(0xee112f30), /* mrc        15, 0, r2, cr1, cr0, {1}  */
+		htole32(0xe3822002), /* orr        r2, r2, #2                */
+		htole32(0xee012f30), /* mcr        15, 0, r2, cr1, cr0, {1}  */
+		htole32(0xe12fff1e), /* bx         lr                        */
+	};
+
+	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
+	aw_fel_execute(dev, soc_info->scratch_addr);
+}
+
+void aw_get_stackinfo(feldev_handle *dev, const soc_info_t *soc_info,
+                      uint32_t *sp_irq, uint32_t *sp)
+{
+	uint32_t results[2] = { 0 };
+#if 0
+	/* Does not work on Cortex-A8 (needs Virtualization Extensions) */
+	uint32_t arm_code[] = {
+		htole32(0xe1010300), /* mrs        r0, SP_irq                */
+		htole32(0xe58f0004), /* str        r0, [pc, #4]              */
+		htole32(0xe58fd004), /* str        sp, [pc, #4]              */
+		htole32(0xe12fff1e), /* bx         lr                        */
+	};
+
+	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
+	aw_fel_execute(dev, soc_info->scratch_addr);
+	aw_fel_read(dev, soc_info->scratch_addr + 0x10, results, 8);
+#else
+	/* Works everywhere */
+	uint32_t arm_code[] = {
 		htole32(0xe10f0000), /* mrs        r0, CPSR                  */
 		htole32(0xe3c0101f), /* bic        r1, r0, #31               */
 		htole32(0xe3811012), /* orr        r1, r1, #18               */
@@ -695,56 +1659,85 @@ void aw_get_stackinfo(libusb_device_handle *usb, soc_info_t *soc_info,
 		htole32(0xe12fff1e), /* bx         lr                        */
 	};
 
-	aw_fel_write(usb, arm_code, soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(usb, soc_info->scratch_addr);
-	aw_fel_read(usb, soc_info->scratch_addr + 0x24, results, 8);
+	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
+	aw_fel_execute(dev, soc_info->scratch_addr);
+	aw_fel_read(dev, soc_info->scratch_addr + 0x24, results, 8);
 #endif
 	*sp_irq = le32toh(results[0]);
 	*sp     = le32toh(results[1]);
 }
 
-uint32_t aw_get_ttbr0(libusb_device_handle *usb, soc_info_t *soc_info)
+uint32_t aw_get_ttbr0(feldev_handle *dev, const soc_info_t *soc_info)
 {
-	return aw_read_arm_cp_reg(usb, soc_info, 15, 0, 2, 0, 0);
+	return aw_read_arm_cp_reg(dev, soc_info, 15, 0, 2, 0, 0);
 }
 
-uint32_t aw_get_ttbcr(libusb_device_handle *usb, soc_info_t *soc_info)
+uint32_t aw_get_ttbcr(feldev_handle *dev, const soc_info_t *soc_info)
 {
-	return aw_read_arm_cp_reg(usb, soc_info, 15, 0, 2, 0, 2);
+	return aw_read_arm_cp_reg(dev, soc_info, 15, 0, 2, 0, 2);
 }
 
-uint32_t aw_get_dacr(libusb_device_handle *usb, soc_info_t *soc_info)
+uint32_t aw_get_dacr(feldev_handle *dev, const soc_info_t *soc_info)
 {
-	return aw_read_arm_cp_reg(usb, soc_info, 15, 0, 3, 0, 0);
+	return aw_read_arm_cp_reg(dev, soc_info, 15, 0, 3, 0, 0);
 }
 
-uint32_t aw_get_sctlr(libusb_device_handle *usb, soc_info_t *soc_info)
+uint32_t aw_get_sctlr(feldev_handle *dev, const soc_info_t *soc_info)
 {
-	return aw_read_arm_cp_reg(usb, soc_info, 15, 0, 1, 0, 0);
+	return aw_read_arm_cp_reg(dev, soc_info, 15, 0, 1, 0, 0);
 }
 
-void aw_set_ttbr0(libusb_device_handle *usb, soc_info_t *soc_info,
+void aw_set_ttbr0(feldev_handle *dev, const soc_info_t *soc_info,
 		  uint32_t ttbr0)
 {
-	return aw_write_arm_cp_reg(usb, soc_info, 15, 0, 2, 0, 0, ttbr0);
+	return aw_write_arm_cp_reg(dev, soc_info, 15, 0, 2, 0, 0, ttbr0);
 }
 
-void aw_set_ttbcr(libusb_device_handle *usb, soc_info_t *soc_info,
+void aw_set_ttbcr(feldev_handle *dev, const soc_info_t *soc_info,
 		  uint32_t ttbcr)
 {
-	return aw_write_arm_cp_reg(usb, soc_info, 15, 0, 2, 0, 2, ttbcr);
+	return aw_write_arm_cp_reg(dev, soc_info, 15, 0, 2, 0, 2, ttbcr);
 }
 
-void aw_set_dacr(libusb_device_handle *usb, soc_info_t *soc_info,
+void aw_set_dacr(feldev_handle *dev, const soc_info_t *soc_info,
 		 uint32_t dacr)
 {
-	aw_write_arm_cp_reg(usb, soc_info, 15, 0, 3, 0, 0, dacr);
+	aw_write_arm_cp_reg(dev, soc_info, 15, 0, 3, 0, 0, dacr);
 }
 
-void aw_set_sctlr(libusb_device_handle *usb, soc_info_t *soc_info,
+void aw_set_sctlr(feldev_handle *dev, const soc_info_t *soc_info,
 		  uint32_t sctlr)
 {
-	aw_write_arm_cp_reg(usb, soc_info, 15, 0, 1, 0, 0, sctlr);
+	aw_write_arm_cp_reg(dev, soc_info, 15, 0, 1, 0, 0, sctlr);
+}
+
+/*
+ * Retrieve all MMU-related CP15 registers (SCTLR, DACR, TTBCR, TTBR0) at once,
+ * which saves the FEL round-trips of individual aw_read_arm_cp_reg() calls.
+ */
+void aw_get_mmu_regs(feldev_handle *dev, const soc_info_t *soc_info,
+		     uint32_t *sctlr, uint32_t *dacr, uint32_t *ttbcr,
+		     uint32_t *ttbr0)
+{
+	uint32_t results[4] = { 0 };
+	uint32_t arm_code[] = {
+		htole32(0xee110f10), /* mrc        15, 0, r0, cr1, cr0, {0}  */
+		htole32(0xee131f10), /* mrc        15, 0, r1, cr3, cr0, {0}  */
+		htole32(0xee122f50), /* mrc        15, 0, r2, cr2, cr0, {2}  */
+		htole32(0xee123f10), /* mrc        15, 0, r3, cr2, cr0, {0}  */
+		htole32(0xe28fc004), /* add        ip, pc, #4                */
+		htole32(0xe88c000f), /* stm        ip, {r0, r1, r2, r3}      */
+		htole32(0xe12fff1e), /* bx         lr                        */
+	};
+
+	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
+	aw_fel_execute(dev, soc_info->scratch_addr);
+	aw_fel_read(dev, soc_info->scratch_addr + sizeof(arm_code),
+		    results, sizeof(results));
+	*sctlr = le32toh(results[0]);
+	*dacr  = le32toh(results[1]);
+	*ttbcr = le32toh(results[2]);
+	*ttbr0 = le32toh(results[3]);
 }
 
 /*
@@ -774,13 +1767,9 @@ uint32_t *aw_generate_mmu_translation_table(void)
 	return tt;
 }
 
-uint32_t *aw_backup_and_disable_mmu(libusb_device_handle *usb,
-                                    soc_info_t *soc_info)
+/* Disable I-cache, MMU and branch prediction */
+static void aw_disable_mmu(feldev_handle *dev, const soc_info_t *soc_info)
 {
-	uint32_t *tt = NULL;
-	uint32_t sctlr, ttbr0, ttbcr, dacr;
-	uint32_t i;
-
 	uint32_t arm_code[] = {
 		/* Disable I-cache, MMU and branch prediction */
 		htole32(0xee110f10), /* mrc        15, 0, r0, cr1, cr0, {0}  */
@@ -792,6 +1781,112 @@ uint32_t *aw_backup_and_disable_mmu(libusb_device_handle *usb,
 		htole32(0xe12fff1e), /* bx         lr                        */
 	};
 
+	pr_info("Disabling I-cache, MMU and branch prediction...");
+	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
+	aw_fel_execute(dev, soc_info->scratch_addr);
+	pr_info(" done.\n");
+}
+
+/*
+ * Invalidate I-cache, TLB and BTB, then enable I-cache, MMU and branch
+ * prediction. This is also fine for an already enabled MMU, to make
+ * changes to the translation table take effect.
+ */
+static void aw_enable_mmu(feldev_handle *dev, const soc_info_t *soc_info)
+{
+	uint32_t arm_code[] = {
+		/* Invalidate I-cache, TLB and BTB */
+		htole32(0xe3a00000), /* mov        r0, #0                    */
+		htole32(0xee080f17), /* mcr        15, 0, r0, cr8, cr7, {0}  */
+		htole32(0xee070f15), /* mcr        15, 0, r0, cr7, cr5, {0}  */
+		htole32(0xee070fd5), /* mcr        15, 0, r0, cr7, cr5, {6}  */
+		htole32(0xf57ff04f), /* dsb        sy                        */
+		htole32(0xf57ff06f), /* isb        sy                        */
+		/* Enable I-cache, MMU and branch prediction */
+		htole32(0xee110f10), /* mrc        15, 0, r0, cr1, cr0, {0}  */
+		htole32(0xe3800001), /* orr        r0, r0, #1                */
+		htole32(0xe3800a01), /* orr        r0, r0, #4096             */
+		htole32(0xe3800b02), /* orr        r0, r0, #2048             */
+		htole32(0xee010f10), /* mcr        15, 0, r0, cr1, cr0, {0}  */
+		/* Return back to FEL */
+		htole32(0xe12fff1e), /* bx         lr                        */
+	};
+
+	pr_info("Enabling I-cache, MMU and branch prediction...");
+	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
+	aw_fel_execute(dev, soc_info->scratch_addr);
+	pr_info(" done.\n");
+}
+
+/* Read the MMU translation table at 'ttbr0', and check it for sanity */
+static uint32_t *aw_read_mmu_translation_table(feldev_handle *dev,
+					       uint32_t ttbr0)
+{
+	uint32_t *tt = malloc(16 * 1024);
+	uint32_t i;
+
+	pr_info("Reading the MMU translation table from 0x%08X\n", ttbr0);
+	aw_fel_read(dev, ttbr0, tt, 16 * 1024);
+	for (i = 0; i < 4096; i++)
+		tt[i] = le32toh(tt[i]);
+
+	/* Basic sanity checks to be sure that this is a valid table */
+	for (i = 0; i < 4096; i++) {
+		if (((tt[i] >> 1) & 1) != 1 || ((tt[i] >> 18) & 1) != 0) {
+			fprintf(stderr, "MMU: not a section descriptor\n");
+			exit(1);
+		}
+		if ((tt[i] >> 20) != i) {
+			fprintf(stderr, "MMU: not a direct mapping\n");
+			exit(1);
+		}
+	}
+	return tt;
+}
+
+/* Write back a translation table (converts 'tt' to little endian) */
+static void aw_write_mmu_translation_table(feldev_handle *dev,
+					   uint32_t ttbr0, uint32_t *tt)
+{
+	uint32_t i;
+
+	pr_info("Writing back the MMU translation table.\n");
+	for (i = 0; i < 4096; i++)
+		tt[i] = htole32(tt[i]);
+	aw_fel_write(dev, tt, ttbr0, 16 * 1024);
+}
+
+/*
+ * Change the section attributes for faster transfers: write-combine for
+ * DRAM, and a cached mapping for the BROM (which runs the FEL protocol).
+ */
+static void mmu_table_set_fast(uint32_t *tt)
+{
+	uint32_t i;
+
+	pr_info("Setting write-combine mapping for DRAM.\n");
+	for (i = (DRAM_BASE >> 20); i < ((DRAM_BASE + DRAM_SIZE) >> 20); i++) {
+		/* Clear TEXCB bits */
+		tt[i] &= ~((7 << 12) | (1 << 3) | (1 << 2));
+		/* Set TEXCB to 00100 (Normal uncached mapping) */
+		tt[i] |= (1 << 12);
+	}
+
+	pr_info("Setting cached mapping for BROM.\n");
+	/* Clear TEXCB bits first */
+	tt[0xFFF] &= ~((7 << 12) | (1 << 3) | (1 << 2));
+	/* Set TEXCB to 00111 (Normal write-back cached mapping) */
+	tt[0xFFF] |= (1 << 12) | /* TEX */
+		     (1 << 3)  | /* C */
+		     (1 << 2);   /* B */
+}
+
+uint32_t *aw_backup_and_disable_mmu(feldev_handle *dev,
+                                    const soc_info_t *soc_info)
+{
+	uint32_t *tt = NULL;
+	uint32_t sctlr, ttbr0, ttbcr, dacr;
+
 	/*
 	 * Below are some checks for the register values, which are known
 	 * to be initialized in this particular way by the existing BROM
@@ -803,8 +1898,9 @@ uint32_t *aw_backup_and_disable_mmu(libusb_device_handle *usb,
 	 * checks needs to be relaxed).
 	 */
 
+	aw_get_mmu_regs(dev, soc_info, &sctlr, &dacr, &ttbcr, &ttbr0);
+
 	/* Basically, ignore M/Z/I/V/UNK bits and expect no TEX remap */
-	sctlr = aw_get_sctlr(usb, soc_info);
 	if ((sctlr & ~((0x7 << 11) | (1 << 6) | 1)) != 0x00C50038) {
 		fprintf(stderr, "Unexpected SCTLR (%08X)\n", sctlr);
 		exit(1);
@@ -815,102 +1911,117 @@ uint32_t *aw_backup_and_disable_mmu(libusb_device_handle *usb,
 		return NULL;
 	}
 
-	dacr = aw_get_dacr(usb, soc_info);
 	if (dacr != 0x55555555) {
 		fprintf(stderr, "Unexpected DACR (%08X)\n", dacr);
 		exit(1);
 	}
 
-	ttbcr = aw_get_ttbcr(usb, soc_info);
 	if (ttbcr != 0x00000000) {
 		fprintf(stderr, "Unexpected TTBCR (%08X)\n", ttbcr);
 		exit(1);
 	}
 
-	ttbr0 = aw_get_ttbr0(usb, soc_info);
 	if (ttbr0 & 0x3FFF) {
 		fprintf(stderr, "Unexpected TTBR0 (%08X)\n", ttbr0);
 		exit(1);
 	}
 
-	tt = malloc(16 * 1024);
-	pr_info("Reading the MMU translation table from 0x%08X\n", ttbr0);
-	aw_fel_read(usb, ttbr0, tt, 16 * 1024);
-	for (i = 0; i < 4096; i++)
-		tt[i] = le32toh(tt[i]);
-
-	/* Basic sanity checks to be sure that this is a valid table */
-	for (i = 0; i < 4096; i++) {
-		if (((tt[i] >> 1) & 1) != 1 || ((tt[i] >> 18) & 1) != 0) {
-			fprintf(stderr, "MMU: not a section descriptor\n");
-			exit(1);
-		}
-		if ((tt[i] >> 20) != i) {
-			fprintf(stderr, "MMU: not a direct mapping\n");
-			exit(1);
-		}
-	}
-
-	pr_info("Disabling I-cache, MMU and branch prediction...");
-	aw_fel_write(usb, arm_code, soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(usb, soc_info->scratch_addr);
-	pr_info(" done.\n");
+	tt = aw_read_mmu_translation_table(dev, ttbr0);
+	aw_disable_mmu(dev, soc_info);
 
 	return tt;
 }
 
-void aw_restore_and_enable_mmu(libusb_device_handle *usb,
-                               soc_info_t *soc_info,
+void aw_restore_and_enable_mmu(feldev_handle *dev,
+                               const soc_info_t *soc_info,
                                uint32_t *tt)
 {
-	uint32_t i;
-	uint32_t ttbr0 = aw_get_ttbr0(usb, soc_info);
+	uint32_t ttbr0 = aw_get_ttbr0(dev, soc_info);
 
-	uint32_t arm_code[] = {
-		/* Invalidate I-cache, TLB and BTB */
-		htole32(0xe3a00000), /* mov        r0, #0                    */
-		htole32(0xee080f17), /* mcr        15, 0, r0, cr8, cr7, {0}  */
-		htole32(0xee070f15), /* mcr        15, 0, r0, cr7, cr5, {0}  */
-		htole32(0xee070fd5), /* mcr        15, 0, r0, cr7, cr5, {6}  */
-		htole32(0xf57ff04f), /* dsb        sy                        */
-		htole32(0xf57ff06f), /* isb        sy                        */
-		/* Enable I-cache, MMU and branch prediction */
-		htole32(0xee110f10), /* mrc        15, 0, r0, cr1, cr0, {0}  */
-		htole32(0xe3800001), /* orr        r0, r0, #1                */
-		htole32(0xe3800a01), /* orr        r0, r0, #4096             */
-		htole32(0xe3800b02), /* orr        r0, r0, #2048             */
-		htole32(0xee010f10), /* mcr        15, 0, r0, cr1, cr0, {0}  */
-		/* Return back to FEL */
-		htole32(0xe12fff1e), /* bx         lr                        */
-	};
+	mmu_table_set_fast(tt);
+	aw_write_mmu_translation_table(dev, ttbr0, tt);
+	aw_enable_mmu(dev, soc_info);
 
-	pr_info("Setting write-combine mapping for DRAM.\n");
-	for (i = (DRAM_BASE >> 20); i < ((DRAM_BASE + DRAM_SIZE) >> 20); i++) {
-		/* Clear TEXCB bits */
-		tt[i] &= ~((7 << 12) | (1 << 3) | (1 << 2));
-		/* Set TEXCB to 00100 (Normal uncached mapping) */
-		tt[i] |= (1 << 12);
+	free(tt);
+}
+
+/*
+ * "Fast mode" (--fast): install the optimized section attributes that the
+ * SPL path uses once per session, so that all following transfers benefit
+ * from them. The original state is kept in dev->fast, and gets restored by
+ * aw_fel_restore_fast_mode(). If the BROM didn't enable the MMU, we set up
+ * our own table at soc_info->mmu_tt_addr, saving the SRAM contents there.
+ */
+void aw_fel_enable_fast_mode(feldev_handle *dev)
+{
+	const soc_info_t *soc_info = aw_fel_get_soc_info(dev);
+	uint32_t sctlr, dacr, ttbcr, ttbr0;
+	uint32_t *tt;
+
+	if (dev->fast.backup)
+		return; /* already active */
+
+	aw_get_mmu_regs(dev, soc_info, &sctlr, &dacr, &ttbcr, &ttbr0);
+	dev->fast.mmu_enabled = sctlr & 1;
+	dev->fast.dacr = dacr;
+	dev->fast.ttbcr = ttbcr;
+	dev->fast.ttbr0 = ttbr0;
+
+	if (!dev->fast.mmu_enabled) {
+		if (!soc_info->mmu_tt_addr) {
+			pr_info("Fast mode: no MMU translation table available\n");
+			return;
+		}
+		ttbr0 = soc_info->mmu_tt_addr;
+	} else if (ttbcr != 0 || (ttbr0 & 0x3FFF)) {
+		pr_info("Fast mode: unexpected MMU setup, not enabled\n");
+		return;
 	}
 
-	pr_info("Setting cached mapping for BROM.\n");
-	/* Clear TEXCB bits first */
-	tt[0xFFF] &= ~((7 << 12) | (1 << 3) | (1 << 2));
-	/* Set TEXCB to 00111 (Normal write-back cached mapping) */
-	tt[0xFFF] |= (1 << 12) | /* TEX */
-		     (1 << 3)  | /* C */
-		     (1 << 2);   /* B */
+	/* save the original table (or SRAM contents), as raw data */
+	dev->fast.backup = malloc(16 * 1024);
+	aw_fel_read(dev, ttbr0, dev->fast.backup, 16 * 1024);
 
-	pr_info("Writing back the MMU translation table.\n");
-	for (i = 0; i < 4096; i++)
-		tt[i] = htole32(tt[i]);
-	aw_fel_write(usb, tt, ttbr0, 16 * 1024);
+	if (dev->fast.mmu_enabled) {
+		tt = aw_read_mmu_translation_table(dev, ttbr0);
+	} else {
+		/* same settings as in aw_fel_write_and_execute_spl() */
+		pr_info("Generating the new MMU translation table at 0x%08X\n",
+			ttbr0);
+		aw_set_dacr(dev, soc_info, 0x55555555);
+		aw_set_ttbcr(dev, soc_info, 0x00000000);
+		aw_set_ttbr0(dev, soc_info, ttbr0);
+		tt = aw_generate_mmu_translation_table();
+	}
+	mmu_table_set_fast(tt);
+	aw_write_mmu_translation_table(dev, ttbr0, tt);
+	aw_enable_mmu(dev, soc_info);
+	free(tt);
+}
 
-	pr_info("Enabling I-cache, MMU and branch prediction...");
-	aw_fel_write(usb, arm_code, soc_info->scratch_addr, sizeof(arm_code));
-	aw_fel_execute(usb, soc_info->scratch_addr);
-	pr_info(" done.\n");
+/* Revert the changes of aw_fel_enable_fast_mode(), if any */
+void aw_fel_restore_fast_mode(feldev_handle *dev)
+{
+	const soc_info_t *soc_info = dev->soc_info;
 
-	free(tt);
+	if (!dev->fast.backup)
+		return;
+
+	if (dev->fast.mmu_enabled) {
+		pr_info("Restoring the MMU translation table at 0x%08X\n",
+			dev->fast.ttbr0);
+		aw_fel_write(dev, dev->fast.backup, dev->fast.ttbr0, 16 * 1024);
+		aw_enable_mmu(dev, soc_info); /* invalidates the TLB */
+	} else {
+		aw_disable_mmu(dev, soc_info);
+		aw_set_dacr(dev, soc_info, dev->fast.dacr);
+		aw_set_ttbcr(dev, soc_info, dev->fast.ttbcr);
+		aw_set_ttbr0(dev, soc_info, dev->fast.ttbr0);
+		aw_fel_write(dev, dev->fast.backup, soc_info->mmu_tt_addr,
+			     16 * 1024);
+	}
+	free(dev->fast.backup);
+	dev->fast.backup = NULL;
 }
 
 /*
@@ -919,11 +2030,19 @@ void aw_restore_and_enable_mmu(libusb_device_handle *usb,
  */
 #define SPL_LEN_LIMIT 0x8000
 
-void aw_fel_write_and_execute_spl(libusb_device_handle *usb,
-				  uint8_t *buf, size_t len)
+/*
+ * Time to wait after executing the SPL (in seconds). A 'prepare' callback
+ * passed to aw_fel_write_and_execute_spl() runs within this window, so it
+ * costs nothing as long as it completes in time.
+ */
+#define SPL_EXEC_DELAY 0.25
+
+void aw_fel_write_and_execute_spl(feldev_handle *dev,
+				  uint8_t *buf, size_t len,
+				  void (*prepare)(void *arg), void *arg)
 {
-	soc_info_t *soc_info = aw_fel_get_soc_info(usb);
-	sram_swap_buffers *swap_buffers;
+	const soc_info_t *soc_info = aw_fel_get_soc_info(dev);
+	const sram_swap_buffers *swap_buffers;
 	char header_signature[9] = { 0 };
 	size_t i, thunk_size;
 	uint32_t *thunk_buf;
@@ -933,11 +2052,6 @@ void aw_fel_write_and_execute_spl(libusb_device_handle *usb,
 	uint32_t cur_addr = soc_info->spl_addr;
 	uint32_t *tt = NULL;
 
-	if (!soc_info || !soc_info->swap_buffers) {
-		fprintf(stderr, "SPL: Unsupported SoC type\n");
-		exit(1);
-	}
-
 	if (len < 32 || memcmp(buf + 4, "eGON.BT0", 8) != 0) {
 		fprintf(stderr, "SPL: eGON header is not found\n");
 		exit(1);
@@ -962,18 +2076,14 @@ void aw_fel_write_and_execute_spl(libusb_device_handle *usb,
 
 	if (soc_info->needs_l2en) {
 		pr_info("Enabling the L2 cache\n");
-		aw_enable_l2_cache(usb, soc_info);
+		aw_enable_l2_cache(dev, soc_info);
 	}
 
-	aw_get_stackinfo(usb, soc_info, &sp_irq, &sp);
+	aw_get_stackinfo(dev, soc_info, &sp_irq, &sp);
 	pr_info("Stack pointers: sp_irq=0x%08X, sp=0x%08X\n", sp_irq, sp);
 
-	tt = aw_backup_and_disable_mmu(usb, soc_info);
+	tt = aw_backup_and_disable_mmu(dev, soc_info);
 	if (!tt && soc_info->mmu_tt_addr) {
-		if (soc_info->mmu_tt_addr & 0x3FFF) {
-			fprintf(stderr, "SPL: 'mmu_tt_addr' must be 16K aligned\n");
-			exit(1);
-		}
 		pr_info("Generating the new MMU translation table at 0x%08X\n",
 		        soc_info->mmu_tt_addr);
 		/*
@@ -986,9 +2096,9 @@ void aw_fel_write_and_execute_spl(libusb_device_handle *usb,
 		 * for all the possible virtual addresses (N=0) and that the
 		 * translation table must be aligned at a 16K boundary.
 		 */
-		aw_set_dacr(usb, soc_info, 0x55555555);
-		aw_set_ttbcr(usb, soc_info, 0x00000000);
-		aw_set_ttbr0(usb, soc_info, soc_info->mmu_tt_addr);
+		aw_set_dacr(dev, soc_info, 0x55555555);
+		aw_set_ttbcr(dev, soc_info, 0x00000000);
+		aw_set_ttbr0(dev, soc_info, soc_info->mmu_tt_addr);
 		tt = aw_generate_mmu_translation_table();
 	}
 
@@ -1001,7 +2111,7 @@ void aw_fel_write_and_execute_spl(libusb_device_handle *usb,
 			uint32_t tmp = swap_buffers[i].buf1 - cur_addr;
 			if (tmp > len)
 				tmp = len;
-			aw_fel_write(usb, buf, cur_addr, tmp);
+			aw_fel_write(dev, buf, cur_addr, tmp);
 			cur_addr += tmp;
 			buf += tmp;
 			len -= tmp;
@@ -1010,7 +2120,7 @@ void aw_fel_write_and_execute_spl(libusb_device_handle *usb,
 			uint32_t tmp = swap_buffers[i].size;
 			if (tmp > len)
 				tmp = len;
-			aw_fel_write(usb, buf, swap_buffers[i].buf2, tmp);
+			aw_fel_write(dev, buf, swap_buffers[i].buf2, tmp);
 			cur_addr += tmp;
 			buf += tmp;
 			len -= tmp;
@@ -1029,17 +2139,12 @@ void aw_fel_write_and_execute_spl(libusb_device_handle *usb,
 
 	/* Write the remaining part of the SPL */
 	if (len > 0)
-		aw_fel_write(usb, buf, cur_addr, len);
+		aw_fel_write(dev, buf, cur_addr, len);
 
+	/* fits into soc_info->thunk_size, as checked when building soc_info.c */
 	thunk_size = sizeof(fel_to_spl_thunk) + sizeof(soc_info->spl_addr) +
 		     (i + 1) * sizeof(*swap_buffers);
 
-	if (thunk_size > soc_info->thunk_size) {
-		fprintf(stderr, "SPL: bad thunk size (need %d, have %d)\n",
-			(int)sizeof(fel_to_spl_thunk), soc_info->thunk_size);
-		exit(1);
-	}
-
 	thunk_buf = malloc(thunk_size);
 	memcpy(thunk_buf, fel_to_spl_thunk, sizeof(fel_to_spl_thunk));
 	memcpy(thunk_buf + sizeof(fel_to_spl_thunk) / sizeof(uint32_t),
@@ -1050,40 +2155,56 @@ void aw_fel_write_and_execute_spl(libusb_device_handle *usb,
 	for (i = 0; i < thunk_size / sizeof(uint32_t); i++)
 		thunk_buf[i] = htole32(thunk_buf[i]);
 
+	/* the SPL will use SRAM freely, so forget about resident helpers */
+	dev->resident_helper = NULL;
+
 	pr_info("=> Executing the SPL...");
-	aw_fel_write(usb, thunk_buf, soc_info->thunk_addr, thunk_size);
-	aw_fel_execute(usb, soc_info->thunk_addr);
+	aw_fel_write(dev, thunk_buf, soc_info->thunk_addr, thunk_size);
+	aw_fel_execute(dev, soc_info->thunk_addr);
 	pr_info(" done.\n");
 
+	double start = gettime();
 	free(thunk_buf);
 
+	/* do host-side work for the next step while the device is busy */
+	if (prepare)
+		prepare(arg);
+
 	/* TODO: Try to find and fix the bug, which needs this workaround */
-	usleep(250000);
+	double remaining = SPL_EXEC_DELAY - (gettime() - start);
+	if (remaining > 0)
+		usleep(remaining * 1000000);
 
 	/* Read back the result and check if everything was fine */
-	aw_fel_read(usb, soc_info->spl_addr + 4, header_signature, 8);
+	aw_fel_read(dev, soc_info->spl_addr + 4, header_signature, 8);
 	if (strcmp(header_signature, "eGON.FEL") != 0) {
 		fprintf(stderr, "SPL: failure code '%s'\n",
 			header_signature);
 		exit(1);
 	}
 
+	dram_initialized = true;
+
 	/* re-enable the MMU if it was enabled by BROM */
 	if (tt != NULL)
-		aw_restore_and_enable_mmu(usb, soc_info, tt);
+		aw_restore_and_enable_mmu(dev, soc_info, tt);
+
+	/*
+	 * The MMU now has the same setup as in fast mode. We keep the fast mode
+	 * backup however, so that aw_fel_restore_fast_mode() still reverts to
+	 * the original (default) attributes - "bench" relies on that.
+	 */
 }
 
 /*
  * This function tests a given buffer address and length for a valid U-Boot
- * image. Upon success, the image data gets transferred to the default memory
- * address stored within the image header; and the function preserves the
- * U-Boot entry point (offset) and size values.
+ * image header. It returns false if there is no actual image data, and
+ * bails out on errors.
  */
-void aw_fel_write_uboot_image(libusb_device_handle *usb,
-		uint8_t *buf, size_t len)
+static bool uboot_check_header(uint8_t *buf, size_t len)
 {
 	if (len <= HEADER_SIZE)
-		return; /* Insufficient size (no actual data), just bail out */
+		return false; /* Insufficient size (no actual data) */
 
 	uint32_t *buf32 = (uint32_t *)buf;
 
@@ -1109,29 +2230,48 @@ void aw_fel_write_uboot_image(libusb_device_handle *usb,
 		exit(1);
 	}
 	uint32_t data_size = be32toh(buf32[3]); /* Image Data Size */
-	uint32_t load_addr = be32toh(buf32[4]); /* Data Load Address */
 	if (data_size != len - HEADER_SIZE) {
 		fprintf(stderr, "U-Boot image data size mismatch: "
 			"expected %zu, got %u\n", len - HEADER_SIZE, data_size);
 		exit(1);
 	}
-	/* TODO: Verify image data integrity using the checksum field ih_dcrc,
-	 * available from be32toh(buf32[6])
-	 *
-	 * However, this requires CRC routines that mimic their U-Boot
-	 * counterparts, namely image_check_dcrc() in ${U-BOOT}/common/image.c
-	 * and crc_wd() in ${U-BOOT}/lib/crc32.c
-	 *
-	 * It should be investigated if existing CRC routines in sunxi-tools
-	 * could be factored out and reused for this purpose - e.g. calc_crc32()
-	 * from nand-part-main.c
-	 */
+	return true;
+}
+
+/*
+ * Verify the image data integrity using the checksum field ih_dcrc, like
+ * image_check_dcrc() in U-Boot does. Expects a header that already passed
+ * uboot_check_header(). The signature allows use as a 'prepare' callback.
+ */
+static void uboot_check_dcrc(void *image)
+{
+	uint8_t *buf = image;
+	uint32_t *buf32 = image;
+	uint32_t data_size = be32toh(buf32[3]); /* Image Data Size */
+	uint32_t dcrc = be32toh(buf32[6]); /* Image Data CRC Checksum */
+
+	if (crc32_update(0, buf + HEADER_SIZE, data_size) != dcrc) {
+		fprintf(stderr, "U-Boot image data CRC mismatch\n");
+		exit(1);
+	}
+}
+
+/*
+ * Transfer a checked U-Boot image to the load address stored within the
+ * image header, and preserve the U-Boot entry point (offset) and size values.
+ */
+static void uboot_write_image(feldev_handle *dev, uint8_t *buf)
+{
+	uint32_t *buf32 = (uint32_t *)buf;
+	uint32_t data_size = be32toh(buf32[3]); /* Image Data Size */
+	uint32_t load_addr = be32toh(buf32[4]); /* Data Load Address */
 
-	/* If we get here, we're "good to go" (i.e. actually write the data) */
 	pr_info("Writing image \"%.*s\", %u bytes @ 0x%08X.\n",
 		IH_NMLEN, buf + HEADER_NAME_OFFSET, data_size, load_addr);
 
-	aw_write_buffer(usb, buf + HEADER_SIZE, load_addr, data_size, false);
+	aw_write_buffer(dev, buf + HEADER_SIZE, load_addr, data_size, false);
+	if (verify_uploads)
+		aw_fel_verify(dev, buf + HEADER_SIZE, load_addr, data_size);
 
 	/* keep track of U-Boot memory region in global vars */
 	uboot_entry = load_addr;
@@ -1140,19 +2280,32 @@ void aw_fel_write_uboot_image(libusb_device_handle *usb,
 
 /*
  * This function handles the common part of both "spl" and "uboot" commands.
+ *
+ * The U-Boot header is validated before anything is sent, and the data CRC
+ * gets calculated while the device executes the SPL. That way the upload
+ * starts right after the SPL has returned.
  */
-void aw_fel_process_spl_and_uboot(libusb_device_handle *usb,
+void aw_fel_process_spl_and_uboot(feldev_handle *dev,
 		const char *filename)
 {
-	/* load file into memory buffer */
+	/* map (or load) file into memory buffer */
 	size_t size;
-	uint8_t *buf = load_file(filename, &size);
+	bool mapped;
+	uint8_t *buf = map_file(filename, &size, &mapped);
+	uint8_t *uboot = buf + SPL_LEN_LIMIT;
+	/* check for optional main U-Boot binary */
+	bool have_uboot = size > SPL_LEN_LIMIT &&
+			  uboot_check_header(uboot, size - SPL_LEN_LIMIT);
 	/* write and execute the SPL from the buffer */
-	aw_fel_write_and_execute_spl(usb, buf, size);
-	/* check for optional main U-Boot binary (and transfer it, if applicable) */
-	if (size > SPL_LEN_LIMIT)
-		aw_fel_write_uboot_image(usb, buf + SPL_LEN_LIMIT, size - SPL_LEN_LIMIT);
-	free(buf);
+	trace_phase("spl");
+	aw_fel_write_and_execute_spl(dev, buf, size,
+				     have_uboot ? uboot_check_dcrc : NULL, uboot);
+	/* transfer the U-Boot image, if applicable */
+	if (have_uboot) {
+		trace_phase("uboot-upload");
+		uboot_write_image(dev, uboot);
+	}
+	unmap_file(buf, size, mapped);
 }
 
 /*
@@ -1165,11 +2318,11 @@ void aw_fel_process_spl_and_uboot(libusb_device_handle *usb,
 #define SPL_SIGNATURE			"SPL" /* marks "sunxi" header */
 #define SPL_MIN_VERSION			1 /* minimum required version */
 #define SPL_MAX_VERSION			1 /* maximum supported version */
-bool have_sunxi_spl(libusb_device_handle *usb, uint32_t spl_addr)
+bool have_sunxi_spl(feldev_handle *dev, uint32_t spl_addr)
 {
 	uint8_t spl_signature[4];
 
-	aw_fel_read(usb, spl_addr + 0x14,
+	aw_fel_read(dev, spl_addr + 0x14,
 		&spl_signature, sizeof(spl_signature));
 
 	if (memcmp(spl_signature, SPL_SIGNATURE, 3) != 0)
@@ -1197,13 +2350,13 @@ bool have_sunxi_spl(libusb_device_handle *usb, uint32_t spl_addr)
  * (see "boot_file_head" in ${U-BOOT}/arch/arm/include/asm/arch-sunxi/spl.h),
  * providing the boot script address (DRAM location of boot.scr).
  */
-void pass_fel_information(libusb_device_handle *usb,
+void pass_fel_information(feldev_handle *dev,
 			  uint32_t script_address, uint32_t uEnv_length)
 {
-	soc_info_t *soc_info = aw_fel_get_soc_info(usb);
+	const soc_info_t *soc_info = aw_fel_get_soc_info(dev);
 
 	/* write something _only_ if we have a suitable SPL header */
-	if (have_sunxi_spl(usb, soc_info->spl_addr)) {
+	if (have_sunxi_spl(dev, soc_info->spl_addr)) {
 		pr_info("Passing boot info via sunxi SPL: "
 			"script address = 0x%08X, uEnv length = %u\n",
 			script_address, uEnv_length);
@@ -1211,7 +2364,7 @@ void pass_fel_information(libusb_device_handle *usb,
 			htole32(script_address),
 			htole32(uEnv_length)
 		};
-		aw_fel_write(usb, transfer,
+		aw_fel_write(dev, transfer,
 			soc_info->spl_addr + 0x18, sizeof(transfer));
 	}
 }
@@ -1265,9 +2418,9 @@ static int aw_fel_get_endpoint(libusb_device_handle *usb)
  * The code was inspired by
  * https://github.com/apritzel/u-boot/commit/fda6bd1bf285c44f30ea15c7e6231bf53c31d4a8
  */
-void aw_rmr_request(libusb_device_handle *usb, uint32_t entry_point, bool aarch64)
+void aw_rmr_request(feldev_handle *dev, uint32_t entry_point, bool aarch64)
 {
-	soc_info_t *soc_info = aw_fel_get_soc_info(usb);
+	const soc_info_t *soc_info = aw_fel_get_soc_info(dev);
 	if (!soc_info->rvbar_reg) {
 		fprintf(stderr, "ERROR: Can't issue RMR request!\n"
 			"RVBAR is not supported or unknown for your SoC (id=%04X).\n",
@@ -1297,12 +2450,12 @@ void aw_rmr_request(libusb_device_handle *usb, uint32_t entry_point, bool aarch6
 		htole32(rmr_mode)
 	};
 	/* scratch buffer setup: transfers ARM code and parameter values */
-	aw_fel_write(usb, arm_code, soc_info->scratch_addr, sizeof(arm_code));
+	aw_fel_write(dev, arm_code, soc_info->scratch_addr, sizeof(arm_code));
 	/* execute the thunk code (triggering a warm reset on the SoC) */
 	pr_info("Store entry point 0x%08X to RVBAR 0x%08X, "
 		"and request warm reset with RMR mode %u...",
 		entry_point, soc_info->rvbar_reg, rmr_mode);
-	aw_fel_execute(usb, soc_info->scratch_addr);
+	aw_fel_execute(dev, soc_info->scratch_addr);
 	pr_info(" done.\n");
 }
 
@@ -1315,8 +2468,9 @@ static bool is_uEnv(void *buffer, size_t size)
 }
 
 /* private helper function, gets used for "write*" and "multi*" transfers */
-static unsigned int file_upload(libusb_device_handle *handle, size_t count,
-				size_t argc, char **argv, progress_cb_t callback)
+static unsigned int file_upload(feldev_handle *handle, size_t count,
+				size_t argc, char **argv, progress_cb_t callback,
+				bool delta)
 {
 	if (argc < count * 2) {
 		fprintf(stderr, "error: too few arguments for uploading %zu files\n",
@@ -1324,6 +2478,13 @@ static unsigned int file_upload(libusb_device_handle *handle, size_t count,
 		exit(1);
 	}
 
+	/*
+	 * Concurrent workers would garble each other's terminal progress
+	 * output. JSON progress is line-based and tagged with the device.
+	 */
+	if (fel_worker && callback != progress_json)
+		callback = NULL;
+
 	/* get all file sizes, keeping track of total bytes */
 	size_t size = 0;
 	unsigned int i;
@@ -1331,13 +2492,29 @@ static unsigned int file_upload(libusb_device_handle *handle, size_t count,
 		size += file_size(argv[i * 2 + 1]);
 
 	progress_start(callback, size); /* set total size and progress callback */
+	size_t total = 0;
+	double elapsed = 0;
+	lz4_bytes_sent = 0;
 
 	/* now transfer each file in turn */
 	for (i = 0; i < count; i++) {
-		void *buf = load_file(argv[i * 2 + 1], &size);
+		bool mapped;
+		void *buf = map_file(argv[i * 2 + 1], &size, &mapped);
 		if (size > 0) {
 			uint32_t offset = strtoul(argv[i * 2], NULL, 0);
-			aw_write_buffer(handle, buf, offset, size, callback != NULL);
+			if (delta) {
+				aw_write_delta(handle, buf, offset, size,
+					       callback != NULL);
+			} else if (compress_uploads) {
+				elapsed += aw_write_compressed(handle, buf,
+						offset, size, callback != NULL);
+				total += size;
+			} else {
+				aw_write_buffer(handle, buf, offset, size,
+						callback != NULL);
+			}
+			if (verify_uploads)
+				aw_fel_verify(handle, buf, offset, size);
 
 			/* If we transferred a script, try to inform U-Boot about its address. */
 			if (get_image_type(buf, size) == IH_TYPE_SCRIPT)
@@ -1345,10 +2522,209 @@ static unsigned int file_upload(libusb_device_handle *handle, size_t count,
 			if (is_uEnv(buf, size)) /* uEnv-style data */
 				pass_fel_information(handle, offset, size);
 		}
-		free(buf);
+		unmap_file(buf, size, mapped);
+	}
+
+	/*
+	 * Summary of the compressed upload(s), with the effective throughput
+	 * - unless the output is meant for other programs (gauge, JSON).
+	 */
+	if (total > 0 && (callback == NULL || callback == progress_bar))
+		printf("LZ4: %zu bytes sent as %zu (%.1f%%), %.1f kB/s effective\n",
+		       total, lz4_bytes_sent, 100. * lz4_bytes_sent / total,
+		       kilo(rate(total, elapsed)));
+
+	return i; /* return number of files that were processed */
+}
+
+/*
+ * "bench" command: transfer performance measurements
+ *
+ * Write and read throughput get measured for a range of FEL request sizes,
+ * both to SRAM and to DRAM. The DRAM tests require that DRAM has been set up
+ * before, i.e. they only take place after a preceding "spl" (or "uboot").
+ * We also measure the latency (round-trip time) of a bare FEL request, using
+ * the AW_FEL_VERSION query. Results are output in CSV or JSON format.
+ *
+ * Note that this overwrites the memory areas used for testing!
+ */
+#define BENCH_LATENCY_COUNT	64 /* number of requests for latency test */
+#define BENCH_SRAM_TOTAL	(256 * 1024) /* bytes to transfer per SRAM test */
+#define BENCH_DRAM_TOTAL	(16 * 1024 * 1024) /* ... and per DRAM test */
+
+typedef enum { BENCH_CSV, BENCH_JSON } bench_format_t;
+
+static void bench_report(bench_format_t format, const soc_info_t *soc_info,
+			 const char *test, const char *target, size_t chunk,
+			 size_t bytes, double elapsed, bool first)
+{
+	if (format == BENCH_CSV) {
+		if (first)
+			printf("soc_id,test,target,chunk_size,bytes,seconds,rate_kBps\n");
+		printf("%04x,%s,%s,%zu,%zu,%.6f,%.1f\n", soc_info->soc_id,
+		       test, target, chunk, bytes, elapsed,
+		       kilo(rate(bytes, elapsed)));
+	} else {
+		printf("%s\n    {\"soc_id\": \"%04x\", \"test\": \"%s\", "
+		       "\"target\": \"%s\", \"chunk_size\": %zu, "
+		       "\"bytes\": %zu, \"seconds\": %.6f, \"rate_kBps\": %.1f}",
+		       first ? "[" : ",", soc_info->soc_id, test, target,
+		       chunk, bytes, elapsed, kilo(rate(bytes, elapsed)));
+	}
+}
+
+/*
+ * Find an SRAM area that's safe to use for the benchmark: We start above the
+ * scratch and helper areas (and the IRQ stack following them), and stop at
+ * the next BROM buffer, the thunk, or the SPL size limit - whichever comes
+ * first. This matches the space that an SPL would use freely.
+ */
+static void bench_sram_area(const soc_info_t *soc_info, uint32_t *addr, size_t *size)
+{
+	uint32_t start = soc_info->scratch_addr + 0x1000;
+	uint32_t end = soc_info->spl_addr + SPL_LEN_LIMIT;
+	const sram_swap_buffers *swap_buffers = soc_info->swap_buffers;
+	size_t i;
+
+	if (soc_info->thunk_addr > start && soc_info->thunk_addr < end)
+		end = soc_info->thunk_addr;
+	for (i = 0; swap_buffers && swap_buffers[i].size; i++)
+		if (swap_buffers[i].buf1 >= start && swap_buffers[i].buf1 < end)
+			end = swap_buffers[i].buf1;
+
+	*addr = start;
+	*size = end > start ? end - start : 0;
+}
+
+/* test area overlapping U-Boot or the fast mode translation table? */
+static bool bench_area_conflict(feldev_handle *dev, uint32_t addr, size_t size)
+{
+	uint32_t tt = fast_mode_overlap(dev, addr, size);
+
+	if (uboot_size > 0 && addr <= uboot_entry + uboot_size
+			   && addr + size >= uboot_entry) {
+		fprintf(stderr, "bench: test area 0x%08X-0x%08X overlaps U-Boot\n",
+			addr, (uint32_t)(addr + size));
+		return true;
+	}
+	if (tt) {
+		fprintf(stderr, "bench: test area 0x%08X-0x%08X overlaps the MMU "
+			"translation table at 0x%08X\n", addr,
+			(uint32_t)(addr + size), tt);
+		return true;
+	}
+	return false;
+}
+
+/* run transfers of 'chunk' bytes each, until 'total' bytes are done */
+static void bench_transfer(feldev_handle *dev, bench_format_t format,
+			   const soc_info_t *soc_info, const char *target,
+			   uint32_t addr, size_t chunk, size_t total,
+			   void *buf, bool *first)
+{
+	size_t done;
+	double start;
+
+	start = gettime();
+	for (done = 0; done < total; done += chunk)
+		aw_write_buffer(dev, buf, addr, chunk, false);
+	bench_report(format, soc_info, "write", target, chunk, done,
+		     gettime() - start, *first);
+	*first = false;
+
+	start = gettime();
+	for (done = 0; done < total; done += chunk)
+		aw_fel_read(dev, addr, buf, chunk);
+	bench_report(format, soc_info, "read", target, chunk, done,
+		     gettime() - start, false);
+}
+
+void aw_fel_bench(feldev_handle *dev, const char *format_name)
+{
+	static const size_t sram_chunks[] = { 512, 1024, 4096, 8192 };
+	static const size_t dram_chunks[] = {
+		4096, 16384, 65536, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024
+	};
+	const soc_info_t *soc_info = aw_fel_get_soc_info(dev);
+	bench_format_t format = BENCH_CSV;
+	struct aw_fel_version version;
+	bool first = true;
+	uint32_t sram_addr;
+	size_t sram_size, i;
+	int pass;
+	double start;
+
+	if (strcmp(format_name, "json") == 0)
+		format = BENCH_JSON;
+	else if (strcmp(format_name, "csv") != 0) {
+		fprintf(stderr, "bench: unknown output format '%s'\n", format_name);
+		aw_fel_restore_fast_mode(dev);
+		exit(1);
+	}
+
+	/* latency of a bare FEL request */
+	start = gettime();
+	for (i = 0; i < BENCH_LATENCY_COUNT; i++)
+		aw_fel_get_version(dev, &version);
+	bench_report(format, soc_info, "latency", "none", 0, 0,
+		     (gettime() - start) / BENCH_LATENCY_COUNT, first);
+	first = false;
+
+	uint8_t *buf = malloc(dram_chunks[ARRAY_SIZE(dram_chunks) - 1]);
+	if (!buf) {
+		fprintf(stderr, "bench: out of memory\n");
+		aw_fel_restore_fast_mode(dev);
+		exit(1);
+	}
+	for (i = 0; i < dram_chunks[ARRAY_SIZE(dram_chunks) - 1]; i++)
+		buf[i] = i * 0x9D; /* some arbitrary test pattern */
+
+	bench_sram_area(soc_info, &sram_addr, &sram_size);
+	pr_info("bench: using SRAM at 0x%08X (%zu bytes)\n", sram_addr, sram_size);
+	if (!dram_initialized)
+		pr_info("bench: DRAM not initialized, skipping DRAM tests\n");
+
+	/*
+	 * Check the test areas up front, so that aw_write_buffer() won't bail
+	 * out in the middle of the benchmark (with fast mode off, or on).
+	 */
+	if (bench_area_conflict(dev, sram_addr, sram_size) ||
+	    (dram_initialized &&
+	     bench_area_conflict(dev, DRAM_BASE,
+				 dram_chunks[ARRAY_SIZE(dram_chunks) - 1]))) {
+		aw_fel_restore_fast_mode(dev);
+		exit(1);
+	}
+
+	/*
+	 * In fast mode, measure the default setup first and then the fast one,
+	 * reported as "sram-fast" and "dram-fast" targets for comparison.
+	 */
+	for (pass = 0; pass < (fast_mode ? 2 : 1); pass++) {
+		if (fast_mode && pass == 0)
+			aw_fel_restore_fast_mode(dev);
+		if (pass == 1)
+			aw_fel_enable_fast_mode(dev);
+
+		for (i = 0; i < ARRAY_SIZE(sram_chunks); i++)
+			if (sram_chunks[i] <= sram_size)
+				bench_transfer(dev, format, soc_info,
+					       pass ? "sram-fast" : "sram",
+					       sram_addr, sram_chunks[i],
+					       BENCH_SRAM_TOTAL, buf, &first);
+
+		if (!dram_initialized)
+			continue;
+		for (i = 0; i < ARRAY_SIZE(dram_chunks); i++)
+			bench_transfer(dev, format, soc_info,
+				       pass ? "dram-fast" : "dram",
+				       DRAM_BASE, dram_chunks[i],
+				       BENCH_DRAM_TOTAL, buf, &first);
 	}
 
-	return i; /* return number of files that were processed */
+	if (format == BENCH_JSON)
+		printf("\n]\n");
+	free(buf);
 }
 
 /* open libusb handle to desired FEL device */
@@ -1416,12 +2792,328 @@ static libusb_device_handle *open_fel_device(int busnum, int devnum,
 	return result;
 }
 
+/* USB bus and device number, identifying a specific FEL device */
+typedef struct {
+	int busnum;
+	int devnum;
+} fel_device_id;
+
+#define MAX_FEL_DEVICES	64 /* upper limit for multi-device operation */
+
+/* enumerate all matching FEL devices, returns the number of devices found */
+static size_t enumerate_fel_devices(fel_device_id *ids, size_t max,
+		uint16_t vendor_id, uint16_t product_id)
+{
+	size_t count = 0;
+	ssize_t rc, i;
+	libusb_device **list;
+
+	rc = libusb_get_device_list(NULL, &list);
+	if (rc < 0)
+		usb_error(rc, "libusb_get_device_list()", 1);
+	for (i = 0; i < rc && count < max; i++) {
+		struct libusb_device_descriptor desc;
+		libusb_get_device_descriptor(list[i], &desc);
+		if (desc.idVendor != vendor_id || desc.idProduct != product_id)
+			continue;
+		ids[count].busnum = libusb_get_bus_number(list[i]);
+		ids[count].devnum = libusb_get_device_address(list[i]);
+		count++;
+	}
+	libusb_free_device_list(list, true);
+	return count;
+}
+
+/* parse a comma-separated list of "bus:devnum" pairs */
+static size_t parse_device_list(const char *arg, fel_device_id *ids, size_t max)
+{
+	size_t count = 0;
+	while (*arg) {
+		int n = 0;
+		if (count >= max) {
+			fprintf(stderr, "ERROR: Too many devices (max. %d)\n",
+				MAX_FEL_DEVICES);
+			exit(1);
+		}
+		if (sscanf(arg, "%d:%d%n", &ids[count].busnum,
+			   &ids[count].devnum, &n) != 2
+		    || ids[count].busnum <= 0 || ids[count].devnum <= 0
+		    || (arg[n] != ',' && arg[n] != 0)) {
+			fprintf(stderr, "ERROR: Expected 'bus:devnum[,bus:devnum...]', got '%s'.\n",
+				arg);
+			exit(1);
+		}
+		count++;
+		arg += n;
+		if (*arg == ',')
+			arg++;
+	}
+	return count;
+}
+
+/*
+ * Multi-device operation: fork one worker process for each of the given
+ * devices. The function only returns within the workers, with busnum and
+ * devnum set to the device that the process is supposed to handle. The
+ * parent process waits for all workers, reports their status, and exits.
+ *
+ * Separate processes (instead of threads) keep the FEL state of each device
+ * isolated, and a failing device only terminates its own worker. Note that
+ * every worker needs its own libusb context, as these don't survive fork().
+ */
+static void run_device_workers(const fel_device_id *ids, size_t count,
+			       int *busnum, int *devnum)
+{
+#if defined(_WIN32)
+	(void)ids; (void)count; (void)busnum; (void)devnum;
+	fprintf(stderr, "ERROR: Multi-device mode is not supported on this platform\n");
+	exit(1);
+#else
+	pid_t pid[MAX_FEL_DEVICES];
+	size_t i, failed = 0;
+
+	if (count == 0) {
+		fprintf(stderr, "ERROR: Allwinner USB FEL device not found!\n");
+		exit(1);
+	}
+	pr_info("Starting %zu workers\n", count);
+	fflush(stdout);
+	fflush(stderr);
+
+	for (i = 0; i < count; i++) {
+		pid[i] = fork();
+		if (pid[i] < 0) {
+			perror("fork() failed");
+			exit(1);
+		}
+		if (pid[i] == 0) {
+			/* worker process, continue with this specific device */
+			*busnum = ids[i].busnum;
+			*devnum = ids[i].devnum;
+			fel_worker = true;
+			return;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		int status;
+		if (waitpid(pid[i], &status, 0) < 0) {
+			perror("waitpid() failed");
+			exit(1);
+		}
+		printf("Bus %03d Device %03d: ", ids[i].busnum, ids[i].devnum);
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+			printf("OK\n");
+			continue;
+		}
+		failed++;
+		if (WIFEXITED(status))
+			printf("FAILED (exit code %d)\n", WEXITSTATUS(status));
+		else
+			printf("FAILED (signal %d)\n", WTERMSIG(status));
+	}
+	printf("%zu of %zu devices succeeded\n", count - failed, count);
+	exit(failed > 0 ? 1 : 0);
+#endif
+}
+
+#define SCRIPT_MAX_ARGS	64 /* max. number of arguments per script line */
+
+/*
+ * "script" command: read further commands from a file, line by line. Each
+ * line may contain one or more commands using the normal command-line syntax.
+ * Arguments are separated by whitespace and may be enclosed in double quotes,
+ * '#' starts a comment. A filename of "-" reads from stdin, which allows
+ * using sunxi-fel as a persistent command server (not in multi-device mode,
+ * where the workers would compete for stdin). In any case, all commands
+ * share the same FEL session, i.e. the USB handle, SoC information and any
+ * resident helper code are kept alive across them.
+ */
+static bool process_commands(feldev_handle *handle, int argc, char **argv);
+
+static bool run_script(feldev_handle *handle, const char *filename)
+{
+	FILE *in = stdin;
+	char line[4096];
+	bool result = true;
+	unsigned int lineno = 0;
+
+	if (strcmp(filename, "-") != 0) {
+		in = fopen(filename, "r");
+		if (!in) {
+			perror("Failed to open script file");
+			exit(1);
+		}
+	} else if (fel_worker) {
+		/* (also catches scripts that run "script -" themselves) */
+		fprintf(stderr, "ERROR: \"script -\" (stdin) is not supported "
+			"with multiple devices\n");
+		exit(1);
+	}
+
+	while (result && fgets(line, sizeof(line), in)) {
+		char *argv[SCRIPT_MAX_ARGS + 1] = { "script" };
+		int argc = 1;
+		char *p = line;
+
+		lineno++;
+		while (*p) {
+			while (isspace((unsigned char)*p))
+				p++;
+			if (*p == 0 || *p == '#')
+				break;
+			if (argc > SCRIPT_MAX_ARGS) {
+				fprintf(stderr, "%s:%u: too many arguments\n",
+					filename, lineno);
+				exit(1);
+			}
+			if (*p == '"') {
+				argv[argc++] = ++p;
+				while (*p && *p != '"')
+					p++;
+			} else {
+				argv[argc++] = p;
+				while (*p && !isspace((unsigned char)*p))
+					p++;
+			}
+			if (*p)
+				*p++ = 0;
+		}
+		pr_info("%s:%u: %d argument(s)\n", filename, lineno, argc - 1);
+		result = process_commands(handle, argc, argv);
+		fflush(stdout); /* keep command server replies in sync */
+	}
+
+	if (in != stdin)
+		fclose(in);
+	return result;
+}
+
+/*
+ * Process FEL commands from an argument vector. Like in main(), argv[0] is
+ * ignored and the first command is expected at argv[1]. Returns false if a
+ * command requested to stop any further processing (e.g. "reset64").
+ */
+static bool process_commands(feldev_handle *handle, int argc, char **argv)
+{
+	while (argc > 1 ) {
+		int skip = 1;
+
+		trace_phase(argv[1]);
+		if (strncmp(argv[1], "hex", 3) == 0 && argc > 3) {
+			aw_fel_hexdump(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0));
+			skip = 3;
+		} else if (strncmp(argv[1], "dump", 4) == 0 && argc > 3) {
+			aw_fel_dump(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0));
+			skip = 3;
+		} else if (strcmp(argv[1], "readl") == 0 && argc > 2) {
+			printf("0x%08x\n", aw_fel_readl(handle, strtoul(argv[2], NULL, 0)));
+			skip = 2;
+		} else if (strcmp(argv[1], "writel") == 0 && argc > 3) {
+			aw_fel_writel(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0));
+			skip = 3;
+		} else if (strncmp(argv[1], "exe", 3) == 0 && argc > 2) {
+			handle->resident_helper = NULL; /* user code might clobber it */
+			aw_fel_execute(handle, strtoul(argv[2], NULL, 0));
+			skip=3;
+		} else if (strcmp(argv[1], "reset64") == 0 && argc > 2) {
+			aw_fel_restore_fast_mode(handle);
+			aw_rmr_request(handle, strtoul(argv[2], NULL, 0), true);
+			return false; /* stop processing args */
+		} else if (strncmp(argv[1], "ver", 3) == 0) {
+			aw_fel_print_version(handle);
+		} else if (strcmp(argv[1], "sid") == 0) {
+			aw_fel_print_sid(handle);
+		} else if (strcmp(argv[1], "pio") == 0 && argc > 2) {
+			skip += aw_fel_pio(handle, argc - 2, argv + 2);
+		} else if (strcmp(argv[1], "write") == 0 && argc > 4 &&
+			   strcmp(argv[2], "--delta") == 0) {
+			skip += 1 + 2 * file_upload(handle, 1, argc - 3, argv + 3,
+					pflag_active ? pflag_style : NULL, true);
+		} else if (strcmp(argv[1], "write") == 0 && argc > 3) {
+			skip += 2 * file_upload(handle, 1, argc - 2, argv + 2,
+					pflag_active ? pflag_style : NULL, false);
+		} else if (strcmp(argv[1], "write-with-progress") == 0 && argc > 3) {
+			skip += 2 * file_upload(handle, 1, argc - 2, argv + 2,
+						progress_bar, false);
+		} else if (strcmp(argv[1], "write-with-gauge") == 0 && argc > 3) {
+			skip += 2 * file_upload(handle, 1, argc - 2, argv + 2,
+						progress_gauge, false);
+		} else if (strcmp(argv[1], "write-with-xgauge") == 0 && argc > 3) {
+			skip += 2 * file_upload(handle, 1, argc - 2, argv + 2,
+						progress_gauge_xxx, false);
+		} else if ((strcmp(argv[1], "multiwrite") == 0 ||
+			    strcmp(argv[1], "multi") == 0) && argc > 4) {
+			size_t count = strtoul(argv[2], NULL, 0); /* file count */
+			skip = 2 + 2 * file_upload(handle, count, argc - 3,
+						   argv + 3, progress_bar, false);
+		} else if ((strcmp(argv[1], "multiwrite-with-gauge") == 0 ||
+			    strcmp(argv[1], "multi-with-gauge") == 0) && argc > 4) {
+			size_t count = strtoul(argv[2], NULL, 0); /* file count */
+			skip = 2 + 2 * file_upload(handle, count, argc - 3,
+						   argv + 3, progress_gauge, false);
+		} else if ((strcmp(argv[1], "multiwrite-with-xgauge") == 0 ||
+			    strcmp(argv[1], "multi-with-xgauge") == 0) && argc > 4) {
+			size_t count = strtoul(argv[2], NULL, 0); /* file count */
+			skip = 2 + 2 * file_upload(handle, count, argc - 3,
+						   argv + 3, progress_gauge_xxx,
+						   false);
+		} else if ((strcmp(argv[1], "echo-gauge") == 0) && argc > 2) {
+			skip = 2;
+			printf("XXX\n0\n%s\nXXX\n", argv[2]);
+			fflush(stdout);
+		} else if (strcmp(argv[1], "read") == 0 && argc > 4) {
+			size_t size = strtoul(argv[3], NULL, 0);
+			void *buf = malloc(size);
+			aw_fel_read(handle, strtoul(argv[2], NULL, 0), buf, size);
+			save_file(argv[4], buf, size);
+			free(buf);
+			skip=4;
+		} else if (strcmp(argv[1], "clear") == 0 && argc > 2) {
+			aw_fel_fill(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0), 0);
+			skip=3;
+		} else if (strcmp(argv[1], "fill") == 0 && argc > 3) {
+			aw_fel_fill(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0), (unsigned char)strtoul(argv[4], NULL, 0));
+			skip=4;
+		} else if (strcmp(argv[1], "copy") == 0 && argc > 4) {
+			aw_fel_copy(handle, strtoul(argv[2], NULL, 0),
+				    strtoul(argv[3], NULL, 0),
+				    strtoul(argv[4], NULL, 0));
+			skip = 4;
+		} else if (strcmp(argv[1], "bench") == 0 && argc > 2) {
+			aw_fel_bench(handle, argv[2]);
+			skip = 2;
+		} else if (strcmp(argv[1], "script") == 0 && argc > 2) {
+			if (!run_script(handle, argv[2]))
+				return false;
+			skip = 2;
+		} else if (strcmp(argv[1], "spl") == 0 && argc > 2) {
+			aw_fel_process_spl_and_uboot(handle, argv[2]);
+			skip=2;
+		} else if (strcmp(argv[1], "uboot") == 0 && argc > 2) {
+			aw_fel_process_spl_and_uboot(handle, argv[2]);
+			uboot_autostart = (uboot_entry > 0 && uboot_size > 0);
+			if (!uboot_autostart)
+				printf("Warning: \"uboot\" command failed to detect image! Can't execute U-Boot.\n");
+			skip=2;
+		} else {
+			fprintf(stderr,"Invalid command %s\n", argv[1]);
+			exit(1);
+		}
+		argc-=skip;
+		argv+=skip;
+	}
+	return true;
+}
+
 int main(int argc, char **argv)
 {
-	bool uboot_autostart = false; /* flag for "uboot" command = U-Boot autostart */
-	bool pflag_active = false; /* -p switch, causing "write" to output progress */
 	libusb_device_handle *handle;
 	int busnum = -1, devnum = -1;
+	bool all_devices = false; /* --all switch, process every FEL device */
+	fel_device_id device_ids[MAX_FEL_DEVICES];
+	size_t device_count = 0;
+	const char *trace_filename = NULL; /* --trace option */
 #if defined(__linux__)
 	int iface_detached = -1;
 #endif
@@ -1431,7 +3123,17 @@ int main(int argc, char **argv)
 		printf("Usage: %s [options] command arguments... [command...]\n"
 			"	-v, --verbose			Verbose logging\n"
 			"	-p, --progress			\"write\" transfers show a progress bar\n"
+			"	--progress=json			... or output progress as JSON lines\n"
+			"	-z, --compress			\"write\" transfers use LZ4 compression\n"
+			"	--verify			Check CRC32 of uploaded data on the device\n"
+			"	--trace file			Record timing of all FEL requests and USB\n"
+			"					transfers (Chrome trace format), and print\n"
+			"					a per-phase summary at exit\n"
+			"	--fast				Keep I-cache and write-combine DRAM mapping\n"
+			"					enabled for this session (restored on exit)\n"
 			"	-d, --dev bus:devnum		Use specific USB bus and device number\n"
+			"	-a, --all			Run commands on all FEL devices in parallel\n"
+			"	--devices bus:devnum[,...]	Run commands on the listed devices in parallel\n"
 			"\n"
 			"	spl file			Load and execute U-Boot SPL\n"
 			"		If file additionally contains a main U-Boot binary\n"
@@ -1451,6 +3153,7 @@ int main(int argc, char **argv)
 			"	writel address value		Write 32-bit value to device memory\n"
 			"	read address length file	Write memory contents into file\n"
 			"	write address file		Store file contents into memory\n"
+			"	write --delta address file	\"write\", skipping unchanged blocks\n"
 			"	write-with-progress addr file	\"write\" with progress bar\n"
 			"	write-with-gauge addr file	Output progress for \"dialog --gauge\"\n"
 			"	write-with-xgauge addr file	Extended gauge output (updates prompt)\n"
@@ -1462,8 +3165,19 @@ int main(int argc, char **argv)
 			"	echo-gauge \"some text\"		Update prompt/caption for gauge output\n"
 			"	ver[sion]			Show BROM version\n"
 			"	sid				Retrieve and output 128-bit SID key\n"
+			"	pio command [command...]	Show or configure pins, using the\n"
+			"		sunxi-pio syntax (print, clean, Pxx...) on the device\n"
 			"	clear address length		Clear memory\n"
 			"	fill address length value	Fill memory\n"
+			"	copy dest source length		Copy memory (on the device)\n"
+			"	script file			Read further commands from file\n"
+			"		(one or more per line, \"-\" for stdin), all running on\n"
+			"		the same FEL session\n"
+			"	bench csv|json			Measure transfer performance\n"
+			"		Tests SRAM and - after \"spl\" - DRAM throughput for a range\n"
+			"		of request sizes, plus FEL request latency. This overwrites\n"
+			"		memory contents (DRAM at 0x40000000, SRAM above scratch area).\n"
+			"		With --fast, the tests are repeated in fast mode.\n"
 			, argv[0]
 		);
 		exit(0);
@@ -1475,7 +3189,40 @@ int main(int argc, char **argv)
 			verbose = true;
 		else if (strcmp(argv[1], "--progress") == 0 || strcmp(argv[1], "-p") == 0)
 			pflag_active = true;
-		else if (strncmp(argv[1], "--dev", 5) == 0 || strncmp(argv[1], "-d", 2) == 0) {
+		else if (strcmp(argv[1], "--progress=json") == 0) {
+			pflag_active = true;
+			pflag_style = progress_json;
+		}
+		else if (strcmp(argv[1], "--compress") == 0 || strcmp(argv[1], "-z") == 0)
+			compress_uploads = true;
+		else if (strcmp(argv[1], "--verify") == 0)
+			verify_uploads = true;
+		else if (strcmp(argv[1], "--fast") == 0)
+			fast_mode = true;
+		else if (strncmp(argv[1], "--trace", 7) == 0) {
+			trace_filename = argv[1] + 7;
+			if (*trace_filename == '=')
+				trace_filename++;
+			else if (*trace_filename == 0 && argc > 2) { /* use the next argument */
+				trace_filename = argv[2];
+				argc -= 1;
+				argv += 1;
+			}
+		}
+		else if (strcmp(argv[1], "--all") == 0 || strcmp(argv[1], "-a") == 0)
+			all_devices = true;
+		else if (strncmp(argv[1], "--devices", 9) == 0) {
+			char *dev_arg = argv[1] + 9;
+			if (*dev_arg == '=')
+				dev_arg++;
+			else if (*dev_arg == 0 && argc > 2) { /* use the next argument */
+				dev_arg = argv[2];
+				argc -= 1;
+				argv += 1;
+			}
+			device_count = parse_device_list(dev_arg, device_ids,
+							 MAX_FEL_DEVICES);
+		} else if (strncmp(argv[1], "--dev", 5) == 0 || strncmp(argv[1], "-d", 2) == 0) {
 			char *dev_arg = argv[1];
 			dev_arg += strspn(dev_arg, "-dev="); /* skip option chars, ignore '=' */
 			if (*dev_arg == 0 && argc > 2) { /* at end of argument, use the next one instead */
@@ -1494,7 +3241,48 @@ int main(int argc, char **argv)
 		argv += 1;
 	}
 
-	int rc = libusb_init(NULL);
+	int rc;
+	if (all_devices) {
+		/* enumerate once, each worker then opens its own device */
+		rc = libusb_init(NULL);
+		assert(rc == 0);
+		device_count = enumerate_fel_devices(device_ids, MAX_FEL_DEVICES,
+				AW_USB_VENDOR_ID, AW_USB_PRODUCT_ID);
+		libusb_exit(NULL);
+	}
+	if (all_devices || device_count > 0) {
+		/* workers share stdin, each would only get parts of a script */
+		for (int i = 1; i < argc - 1; i++)
+			if (strcmp(argv[i], "script") == 0 &&
+			    strcmp(argv[i + 1], "-") == 0) {
+				fprintf(stderr, "ERROR: \"script -\" (stdin) is "
+					"not supported with multiple devices\n");
+				exit(1);
+			}
+		run_device_workers(device_ids, device_count, &busnum, &devnum);
+	}
+
+	char device_tag[16];
+	if (fel_worker) {
+		/* tell apart the progress output of multiple devices */
+		snprintf(device_tag, sizeof(device_tag), "%d:%d", busnum, devnum);
+		progress_set_tag(device_tag);
+	}
+
+	if (trace_filename) {
+		char name[strlen(trace_filename) + 16];
+		/* each worker of a multi-device run gets a file of its own */
+		if (fel_worker)
+			snprintf(name, sizeof(name), "%s.%d-%d",
+				 trace_filename, busnum, devnum);
+		else
+			snprintf(name, sizeof(name), "%s", trace_filename);
+		if (!trace_open(name))
+			exit(1);
+	}
+
+	trace_phase("open");
+	rc = libusb_init(NULL);
 	assert(rc == 0);
 	handle = open_fel_device(busnum, devnum, AW_USB_VENDOR_ID, AW_USB_PRODUCT_ID);
 	assert(handle != NULL);
@@ -1513,98 +3301,22 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	while (argc > 1 ) {
-		int skip = 1;
+	/* FEL session for this device, shared by all commands */
+	feldev_handle dev = { .usb = handle };
 
-		if (strncmp(argv[1], "hex", 3) == 0 && argc > 3) {
-			aw_fel_hexdump(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0));
-			skip = 3;
-		} else if (strncmp(argv[1], "dump", 4) == 0 && argc > 3) {
-			aw_fel_dump(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0));
-			skip = 3;
-		} else if (strcmp(argv[1], "readl") == 0 && argc > 2) {
-			printf("0x%08x\n", aw_fel_readl(handle, strtoul(argv[2], NULL, 0)));
-			skip = 2;
-		} else if (strcmp(argv[1], "writel") == 0 && argc > 3) {
-			aw_fel_writel(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0));
-			skip = 3;
-		} else if (strncmp(argv[1], "exe", 3) == 0 && argc > 2) {
-			aw_fel_execute(handle, strtoul(argv[2], NULL, 0));
-			skip=3;
-		} else if (strcmp(argv[1], "reset64") == 0 && argc > 2) {
-			aw_rmr_request(handle, strtoul(argv[2], NULL, 0), true);
-			/* Cancel U-Boot autostart, and stop processing args */
-			uboot_autostart = false;
-			break;
-		} else if (strncmp(argv[1], "ver", 3) == 0) {
-			aw_fel_print_version(handle);
-		} else if (strcmp(argv[1], "sid") == 0) {
-			aw_fel_print_sid(handle);
-		} else if (strcmp(argv[1], "write") == 0 && argc > 3) {
-			skip += 2 * file_upload(handle, 1, argc - 2, argv + 2,
-					pflag_active ? progress_bar : NULL);
-		} else if (strcmp(argv[1], "write-with-progress") == 0 && argc > 3) {
-			skip += 2 * file_upload(handle, 1, argc - 2, argv + 2,
-						progress_bar);
-		} else if (strcmp(argv[1], "write-with-gauge") == 0 && argc > 3) {
-			skip += 2 * file_upload(handle, 1, argc - 2, argv + 2,
-						progress_gauge);
-		} else if (strcmp(argv[1], "write-with-xgauge") == 0 && argc > 3) {
-			skip += 2 * file_upload(handle, 1, argc - 2, argv + 2,
-						progress_gauge_xxx);
-		} else if ((strcmp(argv[1], "multiwrite") == 0 ||
-			    strcmp(argv[1], "multi") == 0) && argc > 4) {
-			size_t count = strtoul(argv[2], NULL, 0); /* file count */
-			skip = 2 + 2 * file_upload(handle, count, argc - 3,
-						   argv + 3, progress_bar);
-		} else if ((strcmp(argv[1], "multiwrite-with-gauge") == 0 ||
-			    strcmp(argv[1], "multi-with-gauge") == 0) && argc > 4) {
-			size_t count = strtoul(argv[2], NULL, 0); /* file count */
-			skip = 2 + 2 * file_upload(handle, count, argc - 3,
-						   argv + 3, progress_gauge);
-		} else if ((strcmp(argv[1], "multiwrite-with-xgauge") == 0 ||
-			    strcmp(argv[1], "multi-with-xgauge") == 0) && argc > 4) {
-			size_t count = strtoul(argv[2], NULL, 0); /* file count */
-			skip = 2 + 2 * file_upload(handle, count, argc - 3,
-						   argv + 3, progress_gauge_xxx);
-		} else if ((strcmp(argv[1], "echo-gauge") == 0) && argc > 2) {
-			skip = 2;
-			printf("XXX\n0\n%s\nXXX\n", argv[2]);
-			fflush(stdout);
-		} else if (strcmp(argv[1], "read") == 0 && argc > 4) {
-			size_t size = strtoul(argv[3], NULL, 0);
-			void *buf = malloc(size);
-			aw_fel_read(handle, strtoul(argv[2], NULL, 0), buf, size);
-			save_file(argv[4], buf, size);
-			free(buf);
-			skip=4;
-		} else if (strcmp(argv[1], "clear") == 0 && argc > 2) {
-			aw_fel_fill(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0), 0);
-			skip=3;
-		} else if (strcmp(argv[1], "fill") == 0 && argc > 3) {
-			aw_fel_fill(handle, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0), (unsigned char)strtoul(argv[4], NULL, 0));
-			skip=4;
-		} else if (strcmp(argv[1], "spl") == 0 && argc > 2) {
-			aw_fel_process_spl_and_uboot(handle, argv[2]);
-			skip=2;
-		} else if (strcmp(argv[1], "uboot") == 0 && argc > 2) {
-			aw_fel_process_spl_and_uboot(handle, argv[2]);
-			uboot_autostart = (uboot_entry > 0 && uboot_size > 0);
-			if (!uboot_autostart)
-				printf("Warning: \"uboot\" command failed to detect image! Can't execute U-Boot.\n");
-			skip=2;
-		} else {
-			fprintf(stderr,"Invalid command %s\n", argv[1]);
-			exit(1);
-		}
-		argc-=skip;
-		argv+=skip;
-	}
+	if (fast_mode)
+		aw_fel_enable_fast_mode(&dev);
+
+	if (!process_commands(&dev, argc, argv))
+		uboot_autostart = false; /* "reset64" cancels U-Boot autostart */
+
+	trace_phase("exit");
+	aw_fel_restore_fast_mode(&dev);
 
 	/* auto-start U-Boot if requested (by the "uboot" command) */
 	if (uboot_autostart) {
 		pr_info("Starting U-Boot (0x%08X).\n", uboot_entry);
-		aw_fel_execute(handle, uboot_entry);
+		aw_fel_execute(&dev, uboot_entry);
 	}
 
 	libusb_release_interface(handle, 0);
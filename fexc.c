@@ -18,7 +18,9 @@
 #include "fexc.h"
 
 #include <errno.h>
+#include <getopt.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #ifndef NO_MMAP
@@ -83,79 +85,92 @@ static inline char *read_all(int fd, const char *filename, size_t *size)
 }
 
 /*
+ * Get the whole content of an input file (or stdin, if filename is NULL).
+ * Regular files get mmap'ed, anything else is read into a buffer. The
+ * result has to be released with unmap_input().
  */
-static inline int script_parse(enum script_format format,
-			       const char *filename,
-			       struct script *script)
+static void *map_input(const char **filename, size_t *size, int *allocated)
 {
-	int ret = 0;
-	switch (format) {
-	case FEX_SCRIPT_FORMAT: {
-		FILE *in = stdin;
-		if (!filename)
-			filename = "<stdin>";
-		else if ((in = fopen(filename, "r")) == NULL) {
-			pr_err("%s: %s\n", filename, strerror(errno));
-			break;
-		}
-		ret = script_parse_fex(in, filename, script);
-		fclose(in);
-		}; break;
-	case BIN_SCRIPT_FORMAT: {
-		int in = 0; /* stdin */
-		struct stat sb;
-		void *bin = NULL;
-		size_t bin_size;
-		int allocated = 1;
+	int in = 0; /* stdin */
+	struct stat sb;
+	void *buf = NULL;
 
-		if (!filename)
-			filename = "<stdin>";
-		else if ((in = open(filename, O_RDONLY)) < 0) {
-			pr_err("%s: %s\n", filename, strerror(errno));
-			break;
-		}
+	if (!*filename)
+		*filename = "<stdin>";
+	else if ((in = open(*filename, O_RDONLY)) < 0) {
+		pr_err("%s: %s\n", *filename, strerror(errno));
+		return NULL;
+	}
 
-		if (fstat(in, &sb) == -1) {
-			pr_err("%s: %s: %s\n", filename,
-			       "fstat", strerror(errno));
-			goto bin_close;
+	if (fstat(in, &sb) == -1) {
+		pr_err("%s: %s: %s\n", *filename,
+		       "fstat", strerror(errno));
 #ifndef NO_MMAP
-		} else if (S_ISREG(sb.st_mode)) {
-			/* regular file, mmap it */
-			bin = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, in, 0);
-			if (bin == MAP_FAILED) {
-				pr_err("%s: %s: %s\n", filename,
-				       "mmap", strerror(errno));
-				goto bin_close;
-			}
-			bin_size = sb.st_size;
-			allocated = 0;
-#endif
+	} else if (S_ISREG(sb.st_mode) && sb.st_size > 0) {
+		/* regular file, mmap it */
+		buf = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, in, 0);
+		if (buf == MAP_FAILED) {
+			pr_err("%s: %s: %s\n", *filename,
+			       "mmap", strerror(errno));
+			buf = NULL;
 		} else {
-			/* something else... just read it all! */
-			bin = read_all(in, filename, &bin_size);
-			if (bin == NULL)
-				goto bin_close;
-			allocated = 1;
+			*size = sb.st_size;
+			*allocated = 0;
 		}
+#endif
+	} else {
+		/* something else... just read it all! */
+		buf = read_all(in, *filename, size);
+		*allocated = 1;
+	}
 
-		ret = script_decompile_bin(bin, bin_size, filename, script);
-		if (allocated)
-			free(bin);
+	close(in);
+	return buf;
+}
+
+static void unmap_input(const char *filename, void *buf, size_t size,
+			int allocated)
+{
+	if (allocated)
+		free(buf);
 #ifndef NO_MMAP
-		else if (munmap(bin, bin_size) == -1) {
-			pr_err("%s: %s: %s\n", filename,
-			       "munmap", strerror(errno));
-		}
-#endif
-bin_close:
-		close(in);
-		}; break;
-	case UBOOT_HEADER_FORMAT: /* not valid input */
-		;
+	else if (munmap(buf, size) == -1) {
+		pr_err("%s: %s: %s\n", filename,
+		       "munmap", strerror(errno));
 	}
+#else
+	(void) filename;
+	(void) size;
+#endif
+}
+
+/*
+ */
+static inline int script_parse(enum script_format format,
+			       const char *filename,
+			       struct script *script)
+{
+	int ret = 0;
+	size_t size;
+	int allocated;
+	void *buf;
+
+	if (format == UBOOT_HEADER_FORMAT) /* not valid input */
+		return 0;
+
+	buf = map_input(&filename, &size, &allocated);
+	if (buf == NULL)
+		return 0;
+
+	if (format == FEX_SCRIPT_FORMAT)
+		ret = script_parse_fex(buf, size, filename, script);
+	else
+		ret = script_decompile_bin(buf, size, filename, script);
+
+	unmap_input(filename, buf, size, allocated);
 	return ret;
 }
+
 static inline int script_generate(enum script_format format,
 				  const char *filename,
 				  struct script *script)
@@ -180,7 +195,7 @@ static inline int script_generate(enum script_format format,
 		fclose(out);
 	} else {
 		int out = 1; /* stdout */
-		size_t sections, entries, bin_size;
+		size_t bin_size;
 		void *bin;
 
 		if (!filename)
@@ -190,11 +205,10 @@ static inline int script_generate(enum script_format format,
 			goto done;
 		}
 
-		bin_size = script_bin_size(script, &sections, &entries);
-		bin = calloc(1, bin_size);
+		bin = script_generate_bin(script, &bin_size);
 		if (!bin)
 			pr_err("%s: %s\n", "malloc", strerror(errno));
-		else if (script_generate_bin(bin, bin_size, script, sections, entries)) {
+		else {
 			char *p = bin;
 			while(bin_size) {
 				ssize_t wc = write(out, p, bin_size);
@@ -217,18 +231,319 @@ done:
 	return ret;
 }
 
+/*
+ * Drop all sections not listed in 'sections' (NULL terminated), failing
+ * if one of those isn't there.
+ */
+static int script_filter_sections(struct script *script,
+				  const char *filename,
+				  const char *const *sections)
+{
+	struct list_entry *ls, *next;
+	int i;
+
+	for (i = 0; sections[i]; i++)
+		if (!script_find_section(script, sections[i])) {
+			pr_err("%s: section [%s] not found\n",
+			       filename, sections[i]);
+			return 0;
+		}
+
+	for (ls = list_first(&script->sections); ls; ls = next) {
+		struct script_section *section;
+
+		next = list_next(&script->sections, ls);
+		section = container_of(ls, struct script_section, sections);
+		for (i = 0; sections[i]; i++)
+			if (strcmp(sections[i], section->name) == 0)
+				break;
+		if (!sections[i])
+			script_section_delete(section);
+	}
+	return 1;
+}
+
+/* the output file only gets created once there is something valid to write */
+struct fex_writer {
+	FILE *out;
+	const char *filename;
+};
+
+static int fex_writer_open(struct fex_writer *writer)
+{
+	if (writer->out)
+		return 1;
+	if (!writer->filename) {
+		writer->filename = "<stdout>";
+		writer->out = stdout;
+	} else if ((writer->out = fopen(writer->filename, "w")) == NULL) {
+		pr_err("%s: %s\n", writer->filename, strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+static int fex_writer_emit(struct script *script, void *arg)
+{
+	struct fex_writer *writer = arg;
+
+	return fex_writer_open(writer) &&
+	       script_generate_fex(writer->out, writer->filename, script);
+}
+
+/*
+ * .bin to .fex, written section by section while decompiling, so neither
+ * memory use nor latency depend on the size of the whole script
+ */
+static int script_stream_bin_to_fex(const char *input, const char *output,
+				    const char *const *sections)
+{
+	struct fex_writer writer = { NULL, output };
+	struct script *script;
+	size_t size;
+	int allocated, ret = 0;
+	void *buf;
+
+	if ((script = script_new()) == NULL) {
+		perror("malloc");
+		return 0;
+	}
+
+	buf = map_input(&input, &size, &allocated);
+	if (buf == NULL)
+		goto done;
+
+	ret = script_decompile_bin_sections(buf, size, input, sections, script,
+					    fex_writer_emit, &writer) &&
+	      fex_writer_open(&writer);
+	if (writer.out && writer.out != stdout) {
+		if (fclose(writer.out) != 0) {
+			pr_err("%s: %s\n", writer.filename, strerror(errno));
+			ret = 0;
+		}
+		/* don't leave a partial .fex behind if a later section failed */
+		if (!ret)
+			remove(writer.filename);
+	}
+	unmap_input(input, buf, size, allocated);
+done:
+	script_delete(script);
+	return ret;
+}
+
+/*
+ */
+static int script_convert(enum script_format infmt, const char *input,
+			  enum script_format outfmt, const char *output,
+			  const char *const *sections)
+{
+	struct script *script;
+	int ret = 0;
+
+	if (infmt == BIN_SCRIPT_FORMAT && outfmt == FEX_SCRIPT_FORMAT)
+		return script_stream_bin_to_fex(input, output, sections);
+
+	if ((script = script_new()) == NULL) {
+		perror("malloc");
+		return 0;
+	}
+	if (script_parse(infmt, input, script) &&
+	    (!sections || script_filter_sections(script,
+						 input ? input : "<stdin>",
+						 sections)) &&
+	    script_generate(outfmt, output, script))
+		ret = 1;
+	script_delete(script);
+	return ret;
+}
+
+/*
+ * batch mode: convert many input/output pairs, using a pool of threads
+ */
+struct batch_job {
+	const char *input, *output;
+};
+
+struct batch {
+	enum script_format infmt, outfmt;
+	const char *const *sections;
+	struct batch_job *jobs;
+	size_t count, next, failed;
+	pthread_mutex_t lock;
+};
+
+static void *batch_worker(void *arg)
+{
+	struct batch *batch = arg;
+
+	while (1) {
+		struct batch_job *job;
+
+		pthread_mutex_lock(&batch->lock);
+		job = batch->next < batch->count ? &batch->jobs[batch->next++] : NULL;
+		pthread_mutex_unlock(&batch->lock);
+		if (!job)
+			break;
+
+		if (!script_convert(batch->infmt, job->input,
+				    batch->outfmt, job->output,
+				    batch->sections)) {
+			pr_err("%s: conversion to %s failed\n",
+			       job->input, job->output);
+			pthread_mutex_lock(&batch->lock);
+			batch->failed++;
+			pthread_mutex_unlock(&batch->lock);
+		}
+	}
+	return NULL;
+}
+
+static void free_manifest(struct batch_job *jobs, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		free((char *)jobs[i].input);
+		free((char *)jobs[i].output);
+	}
+	free(jobs);
+}
+
+/** read "input output" pairs from a manifest, one per line */
+static struct batch_job *read_manifest(const char *filename, size_t *count)
+{
+	FILE *in = stdin;
+	struct batch_job *jobs = NULL;
+	size_t size = 0;
+	char line[2 * 4096];
+
+	*count = 0;
+	if (strcmp(filename, "-") != 0 && (in = fopen(filename, "r")) == NULL) {
+		pr_err("%s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+
+	for (size_t n = 1; fgets(line, sizeof(line), in); n++) {
+		char *input = strtok(line, " \t\r\n");
+		char *output = strtok(NULL, " \t\r\n");
+
+		if (!input || *input == '#')
+			continue; /* empty or comment */
+		if (!output || strtok(NULL, " \t\r\n")) {
+			pr_err("%s:%zu: expected \"input output\"\n",
+			       filename, n);
+			goto failed;
+		}
+		if (*count == size) {
+			struct batch_job *p;
+			size = size ? size * 2 : 64;
+			if ((p = realloc(jobs, size * sizeof(*jobs))) == NULL)
+				goto malloc_error;
+			jobs = p;
+		}
+		jobs[*count].input = strdup(input);
+		jobs[*count].output = strdup(output);
+		if (!jobs[(*count)++].input || !jobs[*count - 1].output)
+			goto malloc_error;
+	}
+	if (in != stdin)
+		fclose(in);
+	return jobs;
+
+malloc_error:
+	pr_err("%s: %s\n", "malloc", strerror(errno));
+failed:
+	if (in != stdin)
+		fclose(in);
+	free_manifest(jobs, *count);
+	*count = 0;
+	return NULL;
+}
+
+static int run_batch(enum script_format infmt, enum script_format outfmt,
+		     const char *const *sections,
+		     int threads, int argc, char **argv)
+{
+	struct batch batch = {
+		.infmt = infmt,
+		.outfmt = outfmt,
+		.sections = sections,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_t *tid;
+	int i, manifest = (argc == 1);
+
+	if (manifest) {
+		batch.jobs = read_manifest(argv[0], &batch.count);
+		if (!batch.jobs)
+			return 0;
+	} else {
+		/* use the input/output pairs from the command line */
+		batch.count = argc / 2;
+		batch.jobs = calloc(batch.count, sizeof(*batch.jobs));
+		if (!batch.jobs) {
+			perror("malloc");
+			return 0;
+		}
+		for (i = 0; i < (int)batch.count; i++) {
+			batch.jobs[i].input = argv[2 * i];
+			batch.jobs[i].output = argv[2 * i + 1];
+		}
+	}
+
+	if (threads > (int)batch.count)
+		threads = batch.count;
+	if (threads < 1)
+		threads = 1;
+	tid = calloc(threads, sizeof(*tid));
+	if (!tid) {
+		perror("malloc");
+		batch.failed = batch.count;
+		goto done;
+	}
+
+	for (i = 1; i < threads; i++) {
+		if (pthread_create(&tid[i], NULL, batch_worker, &batch) != 0) {
+			pr_err("%s\n", "pthread_create failed");
+			threads = i;
+			break;
+		}
+	}
+	batch_worker(&batch);
+	for (i = 1; i < threads; i++)
+		pthread_join(tid[i], NULL);
+	free(tid);
+
+	if (batch.failed)
+		pr_err("%zu of %zu conversions failed\n",
+		       batch.failed, batch.count);
+done:
+	/* manifest entries are copies, command line ones point into argv */
+	if (manifest)
+		free_manifest(batch.jobs, batch.count);
+	else
+		free(batch.jobs);
+	return batch.failed == 0;
+}
+
 /*
  */
 static inline void app_usage(const char *arg0, int mode)
 {
 	fputs("sunxi-fexc " VERSION "\n\n", stderr);
-	errf("Usage: %s [-vq]%s[<input> [<output>]]\n", arg0,
+	errf("Usage: %s [-vq] [-s <section>]%s[<input> [<output>]]\n", arg0,
+	     mode ? " " : " [-I <infmt>] [-O <outfmt>] ");
+	errf("       %s [-vq] [-s <section>]%s-b|--batch [-j <jobs>] "
+	     "{<manifest> | <input> <output> ...}\n", arg0,
 	     mode ? " " : " [-I <infmt>] [-O <outfmt>] ");
 
 	if (mode == 0)
 		fputs("\ninfmt:  fex, bin  (default:fex)"
 		      "\noutfmt: fex, bin, uboot  (default:bin)\n",
 		      stderr);
+	fputs("\n--batch converts many files, using -j threads (default: one"
+	      "\nper CPU). The manifest (- for stdin) lists one \"input output\""
+	      "\npair per line.\n", stderr);
+	fputs("\n-s|--section <name> (may be repeated) restricts the output to"
+	      "\nthe given sections.\n", stderr);
 }
 
 static inline int app_choose_mode(char *arg0)
@@ -250,21 +565,30 @@ int main(int argc, char *argv[])
 	enum script_format infmt=FEX_SCRIPT_FORMAT;
 	enum script_format outfmt=BIN_SCRIPT_FORMAT;
 	const char *filename[] = { NULL /*stdin*/, NULL /*stdout*/};
-	struct script *script;
+	static const struct option long_options[] = {
+		{ "batch", no_argument, NULL, 'b' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "section", required_argument, NULL, 's' },
+		{ NULL, 0, NULL, 0 }
+	};
 
 	int app_mode = app_choose_mode(argv[0]);
 
-	const char *opt_string = "I:O:vq?";
+	const char *opt_string = "I:O:vqbj:s:?";
 	if (app_mode != 0) opt_string += 4; /* disallow -I and -O */
 	int opt, ret = 1;
 	int verbose = 0;
+	int batch = 0, threads = 0;
+	const char **sections = NULL;
+	int nsections = 0;
 
 	if (app_mode == 2) { /* bin2fex */
 		infmt = BIN_SCRIPT_FORMAT;
 		outfmt = FEX_SCRIPT_FORMAT;
 	}
 
-	while ((opt = getopt(argc, argv, opt_string)) != -1) {
+	while ((opt = getopt_long(argc, argv, opt_string,
+				  long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'I':
 			infmt=0;
@@ -300,6 +624,20 @@ int main(int argc, char *argv[])
 		case 'q':
 			verbose--;
 			break;
+		case 'b':
+			batch = 1;
+			break;
+		case 'j':
+			threads = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			if (!sections &&
+			    !(sections = calloc(argc, sizeof(*sections)))) {
+				perror("malloc");
+				goto done;
+			}
+			sections[nsections++] = optarg;
+			break;
 		default:
 show_usage:
 			app_usage(argv[0], app_mode);
@@ -307,6 +645,21 @@ show_usage:
 		}
 	}
 
+	if (batch) {
+		if (argc - optind < 1 || (argc - optind > 1 && (argc - optind) % 2))
+			goto show_usage;
+#ifdef _SC_NPROCESSORS_ONLN
+		if (threads <= 0)
+			threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (verbose>0)
+			errf("%s: batch from %s to %s\n", argv[0],
+			     formats[infmt], formats[outfmt]);
+		ret = !run_batch(infmt, outfmt, sections, threads,
+				 argc - optind, argv + optind);
+		goto done;
+	}
+
 	switch (argc - optind) {
 	case 2:
 		filename[1] = argv[optind+1]; /* out */
@@ -324,14 +677,8 @@ show_usage:
 		     formats[infmt], filename[0]?filename[0]:"<stdin>",
 		     formats[outfmt], filename[1]?filename[1]:"<stdout>");
 
-	if ((script = script_new()) == NULL) {
-		perror("malloc");
-		goto done;
-	} else if (script_parse(infmt, filename[0], script) &&
-		   script_generate(outfmt, filename[1], script)) {
+	if (script_convert(infmt, filename[0], outfmt, filename[1], sections))
 		ret = 0;
-	}
-	script_delete(script);
 done:
 	return ret;
 }
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2016  The sunxi-tools contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**********************************************************************
+ * Minimal LZ4 block format compressor (greedy, single hash table)
+ *
+ * The output is a standard LZ4 block, which gets decompressed on the
+ * device by a small ARM helper (see lz4_helper[] in fel.c).
+ **********************************************************************/
+#include "lz4.h"
+
+#include <string.h>
+
+#define HASH_BITS	12
+#define MIN_MATCH	4
+#define LAST_LITERALS	5  /* the last bytes are always literals */
+#define MFLIMIT		12 /* the last match must start before this */
+#define MAX_OFFSET	65535
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	uint32_t result;
+	memcpy(&result, p, sizeof(result));
+	return result;
+}
+
+static inline uint32_t hash(uint32_t value)
+{
+	return (value * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/* emit additional length bytes for lengths of 15 and more */
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+static uint8_t *put_literals(uint8_t *op, const uint8_t *src, size_t len)
+{
+	uint8_t *token = op++;
+
+	*token = (len >= 15 ? 15 : len) << 4;
+	if (len >= 15)
+		op = put_length(op, len - 15);
+	memcpy(op, src, len);
+	return op + len;
+}
+
+/*
+ * Compress 'size' bytes from 'src' into 'dst', which must provide room for at
+ * least LZ4_COMPRESS_BOUND(size) bytes. Returns the compressed size.
+ *
+ * If 'overhang' is not NULL, it receives the maximum amount that the output
+ * position runs ahead of the input position during decompression. This is
+ * needed for in-place decompression: with the compressed data placed at the
+ * end of the destination buffer, shifted up by a margin of (overhang - size +
+ * compressed size) bytes if that's positive, the output never overwrites
+ * compressed data that hasn't been read yet.
+ */
+size_t lz4_compress(const uint8_t *src, size_t size, uint8_t *dst,
+		    size_t *overhang)
+{
+	uint32_t table[1 << HASH_BITS]; /* input position + 1, 0 = unused */
+	const uint8_t *ip = src, *anchor = src, *end = src + size;
+	const uint8_t *mflimit = size > MFLIMIT ? end - MFLIMIT : src;
+	uint8_t *op = dst;
+	size_t max_ahead = 0;
+
+	memset(table, 0, sizeof(table));
+
+	while (ip < mflimit) {
+		uint32_t h = hash(read32(ip));
+		uint32_t ref = table[h];
+
+		table[h] = ip - src + 1;
+		if (ref == 0 || (size_t)(ip - src) - (ref - 1) > MAX_OFFSET
+		    || read32(src + ref - 1) != read32(ip)) {
+			ip++;
+			continue;
+		}
+		const uint8_t *match = src + ref - 1;
+
+		/* extend the match forward, leaving room for the last literals */
+		size_t len = MIN_MATCH;
+		while (ip + len < end - LAST_LITERALS && ip[len] == match[len])
+			len++;
+
+		/* sequence: token, literals, offset, match length */
+		uint8_t *token = op;
+		op = put_literals(op, anchor, ip - anchor);
+		*op++ = (ip - match) & 0xFF;
+		*op++ = (ip - match) >> 8;
+		if (len - MIN_MATCH >= 15) {
+			*token |= 15;
+			op = put_length(op, len - MIN_MATCH - 15);
+		} else {
+			*token |= len - MIN_MATCH;
+		}
+
+		ip += len;
+		anchor = ip;
+		if ((size_t)(ip - src) > (size_t)(op - dst)
+		    && (size_t)(ip - src) - (op - dst) > max_ahead)
+			max_ahead = (ip - src) - (op - dst);
+	}
+
+	/* the last sequence consists of literals only */
+	op = put_literals(op, anchor, end - anchor);
+
+	if (overhang)
+		*overhang = max_ahead;
+	return op - dst;
+}
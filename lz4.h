@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2016  The sunxi-tools contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SUNXI_TOOLS_LZ4_H
+#define _SUNXI_TOOLS_LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* worst case output size when compressing 'size' bytes */
+#define LZ4_COMPRESS_BOUND(size)	((size) + (size) / 255 + 16)
+
+size_t lz4_compress(const uint8_t *src, size_t size, uint8_t *dst,
+		    size_t *overhang);
+
+#endif /* _SUNXI_TOOLS_LZ4_H */
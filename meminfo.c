@@ -17,7 +17,9 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <stdint.h>
@@ -138,12 +140,32 @@ soc_version_read(void)
 
 #define SUNXI_IO_CCM_PLL5_CFG	0x20
 
+static unsigned int
+sunxi_dram_clock_decode(unsigned int pll5_cfg)
+{
+	int n, k, m;
+
+	n = (pll5_cfg >> 8) & 0x1F;
+	k = ((pll5_cfg >> 4) & 0x03) + 1;
+	m = (pll5_cfg & 0x03) + 1;
+
+	switch (soc_version) {
+	case SUNXI_SOC_SUN6I:
+	case SUNXI_SOC_SUN8I:
+		n++;
+		break;
+	default:
+		break;
+	}
+
+	return (24 * n * k) / m;
+}
+
 static int
 sunxi_dram_clock_read(unsigned int *clock)
 {
 	void *base;
 	unsigned int tmp;
-	int n, k, m;
 
 	base = mmap(NULL, SUNXI_IO_CCM_SIZE, PROT_READ,
 		    MAP_SHARED, devmem_fd, SUNXI_IO_CCM_BASE);
@@ -157,20 +179,7 @@ sunxi_dram_clock_read(unsigned int *clock)
 
 	munmap(base, SUNXI_IO_CCM_SIZE);
 
-	n = (tmp >> 8) & 0x1F;
-	k = ((tmp >> 4) & 0x03) + 1;
-	m = (tmp & 0x03) + 1;
-
-	switch (soc_version) {
-	case SUNXI_SOC_SUN6I:
-	case SUNXI_SOC_SUN8I:
-		n++;
-		break;
-	default:
-		break;
-	}
-
-	*clock = (24 * n * k) / m;
+	*clock = sunxi_dram_clock_decode(tmp);
 
 	return 0;
 }
@@ -180,12 +189,16 @@ struct regs {
 	char *name;
 };
 
+/*
+ * Copy a range of registers to 'buf' (in one pass), so that formatting the
+ * output doesn't interleave with the register reads.
+ */
 static int
-dram_registers_print(unsigned int address, int size, const struct regs *regs,
-		     const char *description, const char *prefix)
+dram_registers_read(unsigned int address, int size, unsigned int *buf,
+		    const char *description)
 {
 	void *base;
-	int i, j;
+	int i;
 
 	base = mmap(NULL, size, PROT_READ, MAP_SHARED, devmem_fd, address);
 	if (base == MAP_FAILED) {
@@ -194,12 +207,31 @@ dram_registers_print(unsigned int address, int size, const struct regs *regs,
 		return errno;
 	}
 
+	for (i = 0; i < size; i += 4)
+		buf[i / 4] = sunxi_io_read(base, i);
+
+	munmap(base, size);
+
+	return 0;
+}
+
+static int
+dram_registers_print(unsigned int address, int size, const struct regs *regs,
+		     const char *description, const char *prefix)
+{
+	unsigned int buf[size / 4];
+	int i, j, ret;
+
+	ret = dram_registers_read(address, size, buf, description);
+	if (ret)
+		return ret;
+
 	printf("/*\n");
 	printf(" * %s Registers\n", description);
 	printf(" */\n");
 
 	for (i = 0; i < size; i += 4) {
-		unsigned int reg = sunxi_io_read(base, i);
+		unsigned int reg = buf[i / 4];
 
 		for (j = 0; regs[j].name; j++)
 			if (i == regs[j].offset) {
@@ -212,8 +244,6 @@ dram_registers_print(unsigned int address, int size, const struct regs *regs,
 
 	printf("\n");
 
-	munmap(base, size);
-
 	return 0;
 }
 
@@ -221,22 +251,19 @@ static int
 dram_register_range_print(unsigned int address, int size,
 			  const char *description, const char *prefix)
 {
-	void *base;
-	int i;
+	unsigned int buf[size / 4];
+	int i, ret;
 
-	base = mmap(NULL, size, PROT_READ, MAP_SHARED, devmem_fd, address);
-	if (base == MAP_FAILED) {
-		fprintf(stderr, "Failed to map %s registers: %s\n",
-			description, strerror(errno));
-		return errno;
-	}
+	ret = dram_registers_read(address, size, buf, description);
+	if (ret)
+		return ret;
 
 	printf("/*\n");
 	printf(" * %s Registers\n", description);
 	printf(" */\n");
 
 	for (i = 0; i < size; i += 4) {
-		unsigned int reg = sunxi_io_read(base, i);
+		unsigned int reg = buf[i / 4];
 
 		if (reg)
 			printf("%s_%03X = 0x%08x;\n", prefix, i, reg);
@@ -244,8 +271,6 @@ dram_register_range_print(unsigned int address, int size,
 
 	printf("\n");
 
-	munmap(base, size);
-
 	return 0;
 }
 
@@ -709,6 +734,221 @@ sun8i_dram_regs_print(void)
 	return 0;
 }
 
+/*
+ * Dump mode: all register ranges of the DRAM controller, in a format that
+ * is easy to collect and compare against a reference configuration.
+ *
+ * JSON: one object with the SoC id, DRAM clock and an array of blocks,
+ * each listing its values for all offsets (from 0, in steps of 4).
+ *
+ * Binary: a header of "DRAM", SoC id, clock (MHz) and block count, then for
+ * every block its base address, size (in bytes) and the register values.
+ * All of these are 32-bit little endian words.
+ */
+struct dump_block {
+	unsigned int base;
+	int size;
+	const char *description;
+};
+
+static const struct dump_block
+sun4i_dump_blocks[] = {
+	{SUN4I_IO_DRAM_BASE, SUN4I_IO_DRAM_DLLCR4 + 4, "DRAM"},
+	{0, 0, NULL}
+};
+
+static const struct dump_block
+sun6i_dump_blocks[] = {
+	{SUN6I_IO_DRAMCOM_BASE, SUN6I_IO_DRAMCOM_SIZE, "DRAM COM"},
+	{SUN6I_IO_DRAMCTL_BASE, SUN6I_IO_DRAMCTL_SIZE, "DRAM CTL"},
+	{SUN6I_IO_DRAMPHY_BASE, SUN6I_IO_DRAMPHY_SIZE, "DRAM PHY"},
+	{0, 0, NULL}
+};
+
+static void
+dump_word(unsigned int value)
+{
+	unsigned char le[4] = {
+		value, value >> 8, value >> 16, value >> 24
+	};
+
+	fwrite(le, sizeof(le), 1, stdout);
+}
+
+static int
+dram_dump(const struct dump_block *blocks, bool json)
+{
+	unsigned int clock;
+	int nblocks, i, j, ret;
+
+	ret = sunxi_dram_clock_read(&clock);
+	if (ret)
+		return ret;
+
+	for (nblocks = 0; blocks[nblocks].description; nblocks++)
+		;
+
+	if (json)
+		printf("{\"soc\": \"0x%04X\", \"dram_clock_mhz\": %u, "
+		       "\"blocks\": [", soc_version, clock);
+	else {
+		fwrite("DRAM", 4, 1, stdout);
+		dump_word(soc_version);
+		dump_word(clock);
+		dump_word(nblocks);
+	}
+
+	for (i = 0; i < nblocks; i++) {
+		int count = blocks[i].size / 4;
+		unsigned int buf[count];
+
+		ret = dram_registers_read(blocks[i].base, blocks[i].size, buf,
+					  blocks[i].description);
+		if (ret)
+			return ret;
+
+		if (!json) {
+			dump_word(blocks[i].base);
+			dump_word(blocks[i].size);
+			for (j = 0; j < count; j++)
+				dump_word(buf[j]);
+			continue;
+		}
+
+		printf("%s\n  {\"name\": \"%s\", \"base\": \"0x%08X\", "
+		       "\"regs\": [", i ? "," : "", blocks[i].description,
+		       blocks[i].base);
+		for (j = 0; j < count; j++)
+			printf("%s\"0x%08x\"", j ? ", " : "", buf[j]);
+		printf("]}");
+	}
+
+	if (json)
+		printf("\n]}\n");
+
+	return 0;
+}
+
+/*
+ * Watch mode: sample the DRAM clock and a selection of controller registers
+ * at a fixed interval, output as CSV. All register blocks stay mapped, and
+ * each sample reads the registers in one pass before formatting anything.
+ */
+#define WATCH_BLOCK_SIZE	0x1000
+#define WATCH_MAX_BLOCKS	4
+#define WATCH_MAX_REGS		32
+
+struct watch_reg {
+	unsigned int base; /* register block */
+	int offset;
+	const char *name;
+};
+
+static const struct watch_reg
+sun4i_watch_regs[] = {
+	{SUN4I_IO_DRAM_BASE, SUN4I_IO_DRAM_CCR, "CCR"},
+	{SUN4I_IO_DRAM_BASE, SUN4I_IO_DRAM_DCR, "DCR"},
+	{SUN4I_IO_DRAM_BASE, SUN4I_IO_DRAM_IOCR, "IOCR"},
+	{SUN4I_IO_DRAM_BASE, SUN4I_IO_DRAM_TPR0, "TPR0"},
+	{SUN4I_IO_DRAM_BASE, SUN4I_IO_DRAM_TPR1, "TPR1"},
+	{SUN4I_IO_DRAM_BASE, SUN4I_IO_DRAM_TPR2, "TPR2"},
+	{SUN4I_IO_DRAM_BASE, SUN4I_IO_DRAM_ZQCR0, "ZQCR0"},
+	{SUN4I_IO_DRAM_BASE, SUN4I_IO_DRAM_DLLCR0, "DLLCR0"},
+	{0, 0, NULL}
+};
+
+static const struct watch_reg
+sun6i_watch_regs[] = {
+	{SUN6I_IO_DRAMCOM_BASE, 0x00, "SDR_COM_CR"},
+	{SUN6I_IO_DRAMCOM_BASE, 0x04, "SDR_COM_CCR"},
+	{SUN6I_IO_DRAMCOM_BASE, 0x10, "SDR_COM_MFACR"},
+	{SUN6I_IO_DRAMCOM_BASE, 0x30, "SDR_COM_MSACR"},
+	{SUN6I_IO_DRAMCOM_BASE, 0x50, "SDR_COM_MBACR"},
+	{SUN6I_IO_DRAMCTL_BASE, 0x004, "SDR_SCTL"},
+	{SUN6I_IO_DRAMCTL_BASE, 0x008, "SDR_SSTAT"},
+	{SUN6I_IO_DRAMCTL_BASE, 0x088, "SDR_MSTAT"},
+	{SUN6I_IO_DRAMCTL_BASE, 0x094, "SDR_DTUSTAT"},
+	{SUN6I_IO_DRAMPHY_BASE, 0x00c, "SDR_PGSR"},
+	{SUN6I_IO_DRAMPHY_BASE, 0x010, "SDR_DLLGCR"},
+	{0, 0, NULL}
+};
+
+static int
+dram_watch(const struct watch_reg *regs, double interval, unsigned long count)
+{
+	unsigned int block_base[WATCH_MAX_BLOCKS];
+	void *block[WATCH_MAX_BLOCKS];
+	void *reg_base[WATCH_MAX_REGS];
+	unsigned int val[WATCH_MAX_REGS], pll5;
+	struct timespec start, next, now;
+	int nblocks = 0, nregs, i, j;
+	unsigned long n;
+	void *ccm;
+
+	ccm = mmap(NULL, SUNXI_IO_CCM_SIZE, PROT_READ,
+		   MAP_SHARED, devmem_fd, SUNXI_IO_CCM_BASE);
+	if (ccm == MAP_FAILED) {
+		fprintf(stderr, "Failed to map ccm registers: %s\n",
+			strerror(errno));
+		return errno;
+	}
+
+	for (nregs = 0; regs[nregs].name && nregs < WATCH_MAX_REGS; nregs++) {
+		for (j = 0; j < nblocks; j++)
+			if (block_base[j] == regs[nregs].base)
+				break;
+		if (j == nblocks) {
+			block[j] = mmap(NULL, WATCH_BLOCK_SIZE, PROT_READ,
+					MAP_SHARED, devmem_fd, regs[nregs].base);
+			if (block[j] == MAP_FAILED) {
+				fprintf(stderr, "Failed to map dram registers: %s\n",
+					strerror(errno));
+				return errno;
+			}
+			block_base[nblocks++] = regs[nregs].base;
+		}
+		reg_base[nregs] = block[j] + regs[nregs].offset;
+	}
+
+	printf("time,dram_clock_mhz");
+	for (i = 0; i < nregs; i++)
+		printf(",%s", regs[i].name);
+	printf("\n");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	next = start;
+	for (n = 0; count == 0 || n < count; n++) {
+		/* sample everything first, formatting comes afterwards */
+		pll5 = sunxi_io_read(ccm, SUNXI_IO_CCM_PLL5_CFG);
+		for (i = 0; i < nregs; i++)
+			val[i] = sunxi_io_read(reg_base[i], 0);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		printf("%.3f,%u", (now.tv_sec - start.tv_sec) +
+		       (now.tv_nsec - start.tv_nsec) / 1e9,
+		       sunxi_dram_clock_decode(pll5));
+		for (i = 0; i < nregs; i++)
+			printf(",0x%08x", val[i]);
+		printf("\n");
+		fflush(stdout);
+
+		/* absolute deadlines, so that the interval doesn't drift */
+		next.tv_sec += (time_t)interval;
+		next.tv_nsec += (interval - (time_t)interval) * 1e9;
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	for (j = 0; j < nblocks; j++)
+		munmap(block[j], WATCH_BLOCK_SIZE);
+	munmap(ccm, SUNXI_IO_CCM_SIZE);
+
+	return 0;
+}
+
 static void
 print_usage(const char *name)
 {
@@ -722,25 +962,50 @@ print_usage(const char *name)
 	       "http://linux-sunxi.org/Sunxi-tools.\n");
 	printf("\n");
 	printf("Usage: %s [OPTION]\n", name);
+	printf("       %s -w [INTERVAL [COUNT]]\n", name);
 	printf("\n");
 	printf("Options:\n");
 	printf("  -f: print in FEX format (default).\n");
 	printf("  -u: print in sunxi U-Boot dram.c file format.\n");
+	printf("  -j: dump all DRAM controller registers as JSON.\n");
+	printf("  -b: dump all DRAM controller registers in binary format.\n");
+	printf("  -w, --watch: sample DRAM clock and registers every INTERVAL\n"
+	       "      seconds (default 1), COUNT times (default: forever), "
+	       "as CSV.\n");
 	printf("  -h: print this usage information.\n");
 }
 
 int
 main(int argc, char *argv[])
 {
-	bool uboot;
+	bool uboot, watch = false;
+	enum { DUMP_NONE, DUMP_JSON, DUMP_BINARY } dump = DUMP_NONE;
+	double interval = 1;
+	unsigned long count = 0;
 	int ret;
 
-	if (argc == 2) {
+	if (argc >= 2 && (strcmp(argv[1], "-w") == 0 ||
+			  strcmp(argv[1], "--watch") == 0)) {
+		if (argc > 4)
+			goto usage;
+		if (argc > 2)
+			interval = strtod(argv[2], NULL);
+		if (argc > 3)
+			count = strtoul(argv[3], NULL, 0);
+		if (interval <= 0)
+			goto usage;
+		watch = true;
+		uboot = false;
+	} else if (argc == 2) {
 		if (argv[1][0] == '-') {
 			if (argv[1][1] == 'f')
 				uboot = false;
 			else if (argv[1][1] == 'u')
 				uboot = true;
+			else if (argv[1][1] == 'j')
+				dump = DUMP_JSON;
+			else if (argv[1][1] == 'b')
+				dump = DUMP_BINARY;
 			else if (argv[1][1] == 'h')
 				 goto help;
 			else if ((argv[1][1] == '-') && (argv[1][2] == 'h'))
@@ -767,6 +1032,35 @@ main(int argc, char *argv[])
 	ret = soc_version_read();
 	if (ret)
 		return ret;
+
+	if (dump != DUMP_NONE) {
+		switch (soc_version) {
+		case SUNXI_SOC_SUN4I:
+		case SUNXI_SOC_SUN5I:
+		case SUNXI_SOC_SUN7I:
+			return dram_dump(sun4i_dump_blocks, dump == DUMP_JSON);
+		case SUNXI_SOC_SUN6I:
+		case SUNXI_SOC_SUN8I:
+			return dram_dump(sun6i_dump_blocks, dump == DUMP_JSON);
+		default:
+			break; /* error below */
+		}
+	}
+
+	if (watch) {
+		switch (soc_version) {
+		case SUNXI_SOC_SUN4I:
+		case SUNXI_SOC_SUN5I:
+		case SUNXI_SOC_SUN7I:
+			return dram_watch(sun4i_watch_regs, interval, count);
+		case SUNXI_SOC_SUN6I:
+		case SUNXI_SOC_SUN8I:
+			return dram_watch(sun6i_watch_regs, interval, count);
+		default:
+			break; /* error below */
+		}
+	}
+
 	switch (soc_version) {
 	case SUNXI_SOC_SUN4I:
 	case SUNXI_SOC_SUN5I:
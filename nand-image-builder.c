@@ -38,6 +38,9 @@
 #include <stdio.h>
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "portable_endian.h"
@@ -56,6 +59,7 @@
 
 #define BCH_ECC_WORDS(_p)      DIV_ROUND_UP(GF_M(_p)*GF_T(_p), 32)
 #define BCH_ECC_BYTES(_p)      DIV_ROUND_UP(GF_M(_p)*GF_T(_p), 8)
+#define BCH_ECC_BYTES_MAX      DIV_ROUND_UP(14*64, 8)
 
 #ifndef dbg
 #define dbg(_fmt, args...)     do {} while (0)
@@ -75,6 +79,7 @@ struct image_info {
 	int eraseblock_size;
 	int scramble;
 	int boot0;
+	int threads;
 	off_t offset;
 	const char *source;
 	const char *dest;
@@ -89,7 +94,7 @@ struct image_info {
  * @ecc_bytes:  ecc max size (m*t bits) in bytes
  * @a_pow_tab:  Galois field GF(2^m) exponentiation lookup table
  * @a_log_tab:  Galois field GF(2^m) log lookup table
- * @mod8_tab:   remainder generator polynomial lookup tables
+ * @mod8_tab:   remainder generator polynomial lookup tables (8 per byte)
  * @ecc_buf:    ecc parity words buffer
  * @ecc_buf2:   ecc parity words buffer
  * @xi_tab:     GF(2^m) base for solving degree 2 polynomial roots
@@ -235,6 +240,9 @@ static void store_ecc8(struct bch_control *bch, uint8_t *dst,
  *
  * The exact number of computed ecc parity bits is given by member @ecc_bits of
  * @bch; it may be less than m*t for large values of t.
+ *
+ * Parity words are kept on the stack, so concurrent calls sharing the same
+ * @bch are fine.
  */
 static void encode_bch(struct bch_control *bch, const uint8_t *data,
 		unsigned int len, uint8_t *ecc)
@@ -242,25 +250,29 @@ static void encode_bch(struct bch_control *bch, const uint8_t *data,
 	const unsigned int l = BCH_ECC_WORDS(bch)-1;
 	unsigned int i, mlen;
 	unsigned long m;
-	uint32_t w, r[l+1];
+	uint32_t w, w1, r[l+1];
 	const uint32_t * const tab0 = bch->mod8_tab;
 	const uint32_t * const tab1 = tab0 + 256*(l+1);
 	const uint32_t * const tab2 = tab1 + 256*(l+1);
 	const uint32_t * const tab3 = tab2 + 256*(l+1);
-	const uint32_t *pdata, *p0, *p1, *p2, *p3;
+	const uint32_t * const tab4 = tab3 + 256*(l+1);
+	const uint32_t * const tab5 = tab4 + 256*(l+1);
+	const uint32_t * const tab6 = tab5 + 256*(l+1);
+	const uint32_t * const tab7 = tab6 + 256*(l+1);
+	const uint32_t *pdata, *p0, *p1, *p2, *p3, *p4, *p5, *p6, *p7;
 
 	if (ecc) {
 		/* load ecc parity bytes into internal 32-bit buffer */
-		load_ecc8(bch, bch->ecc_buf, ecc);
+		load_ecc8(bch, r, ecc);
 	} else {
-		memset(bch->ecc_buf, 0, sizeof(r));
+		memset(r, 0, sizeof(r));
 	}
 
 	/* process first unaligned data bytes */
 	m = ((uintptr_t)data) & 3;
 	if (m) {
 		mlen = (len < (4-m)) ? len : 4-m;
-		encode_bch_unaligned(bch, data, mlen, bch->ecc_buf);
+		encode_bch_unaligned(bch, data, mlen, r);
 		data += mlen;
 		len  -= mlen;
 	}
@@ -270,7 +282,36 @@ static void encode_bch(struct bch_control *bch, const uint8_t *data,
 	mlen  = len/4;
 	data += 4*mlen;
 	len  -= 4*mlen;
-	memcpy(r, bch->ecc_buf, sizeof(r));
+
+	/*
+	 * with at least two ecc words, process 64 bits at once: the first
+	 * word's bytes get reduced with tables 4-7, which hold the remainders
+	 * for another 32 bits of shift (X^(8*b+32+deg(g)) mod g)
+	 */
+	if (l > 0) {
+		while (mlen >= 2) {
+			w  = r[0]^cpu_to_be32(pdata[0]);
+			w1 = r[1]^cpu_to_be32(pdata[1]);
+			pdata += 2;
+			mlen  -= 2;
+			p0 = tab0 + (l+1)*((w1 >>  0) & 0xff);
+			p1 = tab1 + (l+1)*((w1 >>  8) & 0xff);
+			p2 = tab2 + (l+1)*((w1 >> 16) & 0xff);
+			p3 = tab3 + (l+1)*((w1 >> 24) & 0xff);
+			p4 = tab4 + (l+1)*((w  >>  0) & 0xff);
+			p5 = tab5 + (l+1)*((w  >>  8) & 0xff);
+			p6 = tab6 + (l+1)*((w  >> 16) & 0xff);
+			p7 = tab7 + (l+1)*((w  >> 24) & 0xff);
+
+			for (i = 0; i < l-1; i++)
+				r[i] = r[i+2]^p0[i]^p1[i]^p2[i]^p3[i]^
+					p4[i]^p5[i]^p6[i]^p7[i];
+
+			for (; i <= l; i++)
+				r[i] = p0[i]^p1[i]^p2[i]^p3[i]^
+					p4[i]^p5[i]^p6[i]^p7[i];
+		}
+	}
 
 	/*
 	 * split each 32-bit word into 4 polynomials of weight 8 as follows:
@@ -296,15 +337,14 @@ static void encode_bch(struct bch_control *bch, const uint8_t *data,
 
 		r[l] = p0[l]^p1[l]^p2[l]^p3[l];
 	}
-	memcpy(bch->ecc_buf, r, sizeof(r));
 
 	/* process last unaligned bytes */
 	if (len)
-		encode_bch_unaligned(bch, data, len, bch->ecc_buf);
+		encode_bch_unaligned(bch, data, len, r);
 
 	/* store ecc parity bytes into original parity buffer */
 	if (ecc)
-		store_ecc8(bch, ecc, bch->ecc_buf);
+		store_ecc8(bch, ecc, r);
 }
 
 static inline int modulo(struct bch_control *bch, unsigned int v)
@@ -395,7 +435,7 @@ static void build_mod8_tables(struct bch_control *bch, const uint32_t *g)
 	const int plen = DIV_ROUND_UP(bch->ecc_bits+1, 32);
 	const int ecclen = DIV_ROUND_UP(bch->ecc_bits, 32);
 
-	memset(bch->mod8_tab, 0, 4*256*l*sizeof(*bch->mod8_tab));
+	memset(bch->mod8_tab, 0, 8*256*l*sizeof(*bch->mod8_tab));
 
 	for (i = 0; i < 256; i++) {
 		/* p(X)=i is a small polynomial of weight <= 8 */
@@ -416,6 +456,29 @@ static void build_mod8_tables(struct bch_control *bch, const uint32_t *g)
 			}
 		}
 	}
+
+	/*
+	 * tables 4-7 (for 64-bit encoding steps) are tables 0-3 shifted by
+	 * another 32 bits, i.e. reduced like a data word of zeroes
+	 */
+	for (b = 4; b < 8; b++) {
+		for (i = 0; i < 256; i++) {
+			const uint32_t *p0, *p1, *p2, *p3;
+			const uint32_t *src = bch->mod8_tab + ((b-4)*256+i)*l;
+
+			tab = bch->mod8_tab + (b*256+i)*l;
+			data = src[0];
+			p0 = bch->mod8_tab + (0*256+((data >>  0) & 0xff))*l;
+			p1 = bch->mod8_tab + (1*256+((data >>  8) & 0xff))*l;
+			p2 = bch->mod8_tab + (2*256+((data >> 16) & 0xff))*l;
+			p3 = bch->mod8_tab + (3*256+((data >> 24) & 0xff))*l;
+
+			for (j = 0; j < l-1; j++)
+				tab[j] = src[j+1]^p0[j]^p1[j]^p2[j]^p3[j];
+
+			tab[l-1] = p0[l-1]^p1[l-1]^p2[l-1]^p3[l-1];
+		}
+	}
 }
 
 /*
@@ -637,7 +700,7 @@ static struct bch_control *init_bch(int m, int t, unsigned int prim_poly)
 	bch->ecc_bytes = DIV_ROUND_UP(m*t, 8);
 	bch->a_pow_tab = bch_alloc((1+bch->n)*sizeof(*bch->a_pow_tab), &err);
 	bch->a_log_tab = bch_alloc((1+bch->n)*sizeof(*bch->a_log_tab), &err);
-	bch->mod8_tab  = bch_alloc(words*1024*sizeof(*bch->mod8_tab), &err);
+	bch->mod8_tab  = bch_alloc(words*2048*sizeof(*bch->mod8_tab), &err);
 	bch->ecc_buf   = bch_alloc(words*sizeof(*bch->ecc_buf), &err);
 	bch->ecc_buf2  = bch_alloc(words*sizeof(*bch->ecc_buf2), &err);
 	bch->xi_tab    = bch_alloc(m*sizeof(*bch->xi_tab), &err);
@@ -674,19 +737,23 @@ fail:
 	return NULL;
 }
 
+/* bit-reversed values of all bytes, built recursively from 2-bit steps */
+#define BITREV2(n)	(n), (n) + 2*64, (n) + 1*64, (n) + 3*64
+#define BITREV4(n)	BITREV2(n), BITREV2((n) + 2*16), \
+			BITREV2((n) + 1*16), BITREV2((n) + 3*16)
+#define BITREV6(n)	BITREV4(n), BITREV4((n) + 2*4), \
+			BITREV4((n) + 1*4), BITREV4((n) + 3*4)
+
+static const uint8_t bitrev_tab[256] = {
+	BITREV6(0), BITREV6(2), BITREV6(1), BITREV6(3)
+};
+
 static void swap_bits(uint8_t *buf, int len)
 {
-	int i, j;
-
-	for (j = 0; j < len; j++) {
-		uint8_t byte = buf[j];
+	int j;
 
-		buf[j] = 0;
-		for (i = 0; i < 8; i++) {
-			if (byte & (1 << i))
-				buf[j] |= (1 << (7 - i));
-		}
-	}
+	for (j = 0; j < len; j++)
+		buf[j] = bitrev_tab[buf[j]];
 }
 
 static uint16_t lfsr_step(uint16_t state, int count)
@@ -720,76 +787,136 @@ static uint16_t default_scrambler_seeds[] = {
 
 static uint16_t brom_scrambler_seeds[] = { 0x4a80 };
 
+/*
+ * The scrambler output only depends on the seed, so the keystream for each
+ * seed gets precomputed once (long enough for a full page with OOB).
+ */
+static uint8_t *default_keystreams[ARRAY_SIZE(default_scrambler_seeds)];
+static uint8_t *brom_keystream;
+
+static uint8_t *build_keystream(uint16_t seed, size_t len)
+{
+	uint8_t *keystream = malloc(len);
+	uint16_t state;
+	size_t i;
+
+	if (!keystream)
+		return NULL;
+
+	/* Prepare the initial state... */
+	state = lfsr_step(seed, 15);
+
+	/* and generate the byte sequence. */
+	for (i = 0; i < len; i++) {
+		keystream[i] = state;
+		state = lfsr_step(state, 8);
+	}
+
+	return keystream;
+}
+
+static unsigned scrambler_seedmod(const struct image_info *info)
+{
+	unsigned seedmod = info->eraseblock_size / info->page_size;
+
+	if (seedmod > ARRAY_SIZE(default_scrambler_seeds))
+		seedmod = ARRAY_SIZE(default_scrambler_seeds);
+
+	return seedmod;
+}
+
+/* Build the keystreams needed for the image, before any scramble() calls. */
+static int init_scrambler(const struct image_info *info)
+{
+	size_t len = info->page_size + info->oob_size;
+	unsigned i;
+
+	if (info->boot0) {
+		brom_keystream = build_keystream(brom_scrambler_seeds[0], len);
+		if (!brom_keystream)
+			return -1;
+	} else if (info->scramble) {
+		for (i = 0; i < scrambler_seedmod(info); i++) {
+			default_keystreams[i] =
+				build_keystream(default_scrambler_seeds[i], len);
+			if (!default_keystreams[i])
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void free_scrambler(void)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(default_keystreams); i++) {
+		free(default_keystreams[i]);
+		default_keystreams[i] = NULL;
+	}
+	free(brom_keystream);
+	brom_keystream = NULL;
+}
+
 static void scramble(const struct image_info *info,
 		     int page, uint8_t *data, int datalen)
 {
-	uint16_t state;
+	const uint8_t *key;
+	uint64_t d, k;
 	int i;
 
 	/* Boot0 is always scrambled no matter the command line option. */
 	if (info->boot0) {
-		state = brom_scrambler_seeds[0];
+		key = brom_keystream;
 	} else {
-		unsigned seedmod = info->eraseblock_size / info->page_size;
-
 		/* Bail out earlier if the user didn't ask for scrambling. */
 		if (!info->scramble)
 			return;
 
-		if (seedmod > ARRAY_SIZE(default_scrambler_seeds))
-			seedmod = ARRAY_SIZE(default_scrambler_seeds);
-
-		state = default_scrambler_seeds[page % seedmod];
+		key = default_keystreams[page % scrambler_seedmod(info)];
 	}
 
-	/* Prepare the initial state... */
-	state = lfsr_step(state, 15);
-
-	/* and start scrambling data. */
-	for (i = 0; i < datalen; i++) {
-		data[i] ^= state;
-		state = lfsr_step(state, 8);
+	/* XOR the keystream in 64-bit words (alignment-safe), then bytes */
+	for (i = 0; i + 8 <= datalen; i += 8) {
+		memcpy(&d, data + i, 8);
+		memcpy(&k, key + i, 8);
+		d ^= k;
+		memcpy(data + i, &d, 8);
 	}
+	for (; i < datalen; i++)
+		data[i] ^= key[i];
 }
 
-static int write_page(const struct image_info *info, uint8_t *buffer,
-		      FILE *src, FILE *rnd, FILE *dst,
-		      struct bch_control *bch, int page)
+/*
+ * Build a full NAND page (data + OOB) in memory, from the @cnt bytes of
+ * source data for the page. @rnd provides random data for padding (only
+ * used for scrambled boot0 images, at most one page worth of it), @buffer
+ * is scratch space of at least ecc_step_size + 4 + ECC bytes.
+ */
+static void encode_page(const struct image_info *info,
+			struct bch_control *bch, const uint8_t *rnd, int page,
+			const uint8_t *src, size_t cnt,
+			uint8_t *buffer, uint8_t *dst)
 {
 	int steps = info->usable_page_size / info->ecc_step_size;
 	int eccbytes = DIV_ROUND_UP(info->ecc_strength * 14, 8);
-	off_t pos = ftell(dst);
-	size_t pad, cnt;
-	int i;
+	size_t pad, len, i;
 
 	if (eccbytes % 2)
 		eccbytes++;
 
-	memset(buffer, 0xff, info->page_size + info->oob_size);
-	cnt = fread(buffer, 1, info->usable_page_size, src);
-	if (!cnt) {
-		if (!feof(src)) {
-			fprintf(stderr,
-				"Failed to read data from the source\n");
-			return -1;
-		} else {
-			return 0;
-		}
-	}
-
-	fwrite(buffer, info->page_size + info->oob_size, 1, dst);
+	memset(dst, 0xff, info->page_size + info->oob_size);
+	memcpy(dst, src, cnt);
 
-	for (i = 0; i < info->usable_page_size; i++) {
-		if (buffer[i] !=  0xff)
+	for (i = 0; i < cnt; i++) {
+		if (src[i] !=  0xff)
 			break;
 	}
 
 	/* We leave empty pages at 0xff. */
-	if (i == info->usable_page_size)
-		return 0;
-
-	/* Restore the source pointer to read it again. */
-	fseek(src, -cnt, SEEK_CUR);
+	if (i == cnt)
+		return;
 
 	/* Randomize unused space if scrambling is required. */
 	if (info->scramble) {
@@ -797,19 +924,18 @@ static int write_page(const struct image_info *info, uint8_t *buffer,
 
 		if (info->boot0) {
 			offs = steps * (info->ecc_step_size + eccbytes + 4);
-			cnt = info->page_size + info->oob_size - offs;
-			fread(buffer + offs, 1, cnt, rnd);
+			len = info->page_size + info->oob_size - offs;
+			memcpy(dst + offs, rnd, len);
+			rnd += len;
 		} else {
 			offs = info->page_size + (steps * (eccbytes + 4));
-			cnt = info->page_size + info->oob_size - offs;
-			memset(buffer + offs, 0xff, cnt);
-			scramble(info, page, buffer + offs, cnt);
+			len = info->page_size + info->oob_size - offs;
+			scramble(info, page, dst + offs, len);
 		}
-		fseek(dst, pos + offs, SEEK_SET);
-		fwrite(buffer + offs, cnt, 1, dst);
 	}
 
-	for (i = 0; i < steps; i++) {
+	for (i = 0; i < (size_t)steps; i++) {
+		size_t start = i * info->ecc_step_size;
 		int ecc_offs, data_offs;
 		uint8_t *ecc;
 
@@ -823,19 +949,15 @@ static int write_page(const struct image_info *info, uint8_t *buffer,
 			ecc_offs = info->page_size + 4 + (i * (eccbytes + 4));
 		}
 
-		cnt = fread(buffer, 1, info->ecc_step_size, src);
-		if (!cnt && !feof(src)) {
-			fprintf(stderr,
-				"Failed to read data from the source\n");
-			return -1;
-		}
+		len = cnt > start ? cnt - start : 0;
+		if (len > (size_t)info->ecc_step_size)
+			len = info->ecc_step_size;
+		memcpy(buffer, src + start, len);
 
-		pad = info->ecc_step_size - cnt;
-		if (pad) {
-			if (info->scramble && info->boot0)
-				fread(buffer + cnt, 1, pad, rnd);
-			else
-				memset(buffer + cnt, 0xff, pad);
+		pad = info->ecc_step_size - len;
+		if (pad && info->scramble && info->boot0) {
+			memcpy(buffer + len, rnd, pad);
+			rnd += pad;
 		}
 
 		memset(ecc, 0, eccbytes);
@@ -845,43 +967,130 @@ static int write_page(const struct image_info *info, uint8_t *buffer,
 		swap_bits(ecc, eccbytes);
 		scramble(info, page, buffer, info->ecc_step_size + 4 + eccbytes);
 
-		fseek(dst, pos + data_offs, SEEK_SET);
-		fwrite(buffer, info->ecc_step_size, 1, dst);
-		fseek(dst, pos + ecc_offs - 4, SEEK_SET);
-		fwrite(ecc - 4, eccbytes + 4, 1, dst);
+		memcpy(dst + data_offs, buffer, info->ecc_step_size);
+		memcpy(dst + ecc_offs - 4, ecc - 4, eccbytes + 4);
 	}
 
 	/* Fix BBM. */
-	fseek(dst, pos + info->page_size, SEEK_SET);
-	memset(buffer, 0xff, 2);
-	fwrite(buffer, 2, 1, dst);
+	memset(dst + info->page_size, 0xff, 2);
+}
 
-	/* Make dst pointer point to the next page. */
-	fseek(dst, pos + info->page_size + info->oob_size, SEEK_SET);
+/*
+ * Get the amount of source data a page consumes. ECC steps of non-empty
+ * pages only cover steps * ecc_step_size bytes, so if the usable page size
+ * isn't a multiple of the ECC step size the next page starts within this
+ * one's data.
+ */
+static size_t page_data_used(const struct image_info *info,
+			     const uint8_t *src, size_t cnt)
+{
+	int steps = info->usable_page_size / info->ecc_step_size;
+	size_t used = steps * info->ecc_step_size;
+	size_t i;
 
-	return 0;
+	if (cnt <= used)
+		return cnt;
+
+	for (i = 0; i < cnt; i++) {
+		if (src[i] != 0xff)
+			return used;
+	}
+
+	return cnt;
 }
 
-static int create_image(const struct image_info *info)
-{
-	off_t page = info->offset / info->page_size;
+/* Pages handed to each encoder thread in one go */
+#define PAGES_PER_THREAD	16
+
+struct page_batch {
+	const struct image_info *info;
 	struct bch_control *bch;
-	FILE *src, *dst, *rnd;
+	int first_page;
+	int count;
+	int nthreads;
+	const uint8_t **src;
+	size_t *cnt;
+	uint8_t *rnd;
+	uint8_t *dst;
+};
+
+struct page_worker {
+	struct page_batch *batch;
+	int id;
 	uint8_t *buffer;
+	pthread_t thread;
+};
 
-	bch = init_bch(14, info->ecc_strength, BCH_PRIMITIVE_POLY);
-	if (!bch) {
+static void *page_worker(void *arg)
+{
+	struct page_worker *worker = arg;
+	struct page_batch *batch = worker->batch;
+	const struct image_info *info = batch->info;
+	size_t page_len = info->page_size + info->oob_size;
+	int i;
+
+	/* pages are independent of each other, so just interleave them */
+	for (i = worker->id; i < batch->count; i += batch->nthreads)
+		encode_page(info, batch->bch, batch->rnd + i * page_len,
+			    batch->first_page + i, batch->src[i],
+			    batch->cnt[i], worker->buffer,
+			    batch->dst + i * page_len);
+
+	return NULL;
+}
+
+/*
+ * The source gets read in large blocks, holding (at least) the data for a
+ * full batch of pages. Each batch gets written in one go, too.
+ */
+static int create_image(const struct image_info *info)
+{
+	size_t page_len = info->page_size + info->oob_size;
+	size_t in_size, in_len = 0, in_pos = 0;
+	struct page_worker *workers;
+	struct page_batch batch;
+	FILE *src, *dst, *rnd = NULL;
+	uint8_t *in;
+	int i, max_pages, eof = 0;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.info = info;
+	batch.first_page = info->offset / info->page_size;
+	batch.nthreads = info->threads;
+	max_pages = batch.nthreads * PAGES_PER_THREAD;
+
+	batch.bch = init_bch(14, info->ecc_strength, BCH_PRIMITIVE_POLY);
+	if (!batch.bch) {
 		fprintf(stderr, "Failed to init the BCH engine\n");
 		return -1;
 	}
 
-	buffer = malloc(info->page_size + info->oob_size);
-	if (!buffer) {
-		fprintf(stderr, "Failed to allocate the NAND page buffer\n");
+	if (init_scrambler(info)) {
+		fprintf(stderr, "Failed to init the scrambler\n");
+		return -1;
+	}
+
+	in_size = max_pages * info->usable_page_size;
+	in = malloc(in_size);
+	batch.src = malloc(max_pages * sizeof(*batch.src));
+	batch.cnt = malloc(max_pages * sizeof(*batch.cnt));
+	batch.dst = malloc(max_pages * page_len);
+	workers = calloc(batch.nthreads, sizeof(*workers));
+	if (!in || !batch.src || !batch.cnt || !batch.dst || !workers) {
+		fprintf(stderr, "Failed to allocate the NAND page buffers\n");
 		return -1;
 	}
 
-	memset(buffer, 0xff, info->page_size + info->oob_size);
+	for (i = 0; i < batch.nthreads; i++) {
+		workers[i].batch = &batch;
+		workers[i].id = i;
+		workers[i].buffer = malloc(page_len);
+		if (!workers[i].buffer) {
+			fprintf(stderr,
+				"Failed to allocate the NAND page buffer\n");
+			return -1;
+		}
+	}
 
 	src = fopen(info->source, "r");
 	if (!src) {
@@ -896,23 +1105,448 @@ static int create_image(const struct image_info *info)
 		return -1;
 	}
 
-	rnd = fopen("/dev/urandom", "r");
-	if (!rnd) {
-		fprintf(stderr, "Failed to open /dev/urandom\n");
-		return -1;
+	/* Random padding is only needed for scrambled boot0 images. */
+	if (info->scramble && info->boot0) {
+		rnd = fopen("/dev/urandom", "r");
+		if (!rnd) {
+			fprintf(stderr, "Failed to open /dev/urandom\n");
+			return -1;
+		}
+		batch.rnd = malloc(max_pages * page_len);
+		if (!batch.rnd) {
+			fprintf(stderr, "Failed to allocate the random buffer\n");
+			return -1;
+		}
 	}
 
-	while (!feof(src)) {
-		int ret;
+	for (;;) {
+		/* move leftover data to the front, and refill the buffer */
+		in_len -= in_pos;
+		memmove(in, in + in_pos, in_len);
+		in_pos = 0;
+		if (!eof) {
+			in_len += fread(in + in_len, 1, in_size - in_len, src);
+			if (ferror(src)) {
+				fprintf(stderr,
+					"Failed to read data from the source\n");
+				return -1;
+			}
+			eof = in_len < in_size;
+		}
+
+		/* split it into pages */
+		for (batch.count = 0; batch.count < max_pages; batch.count++) {
+			size_t cnt = in_len - in_pos;
+
+			if (!cnt)
+				break;
+			if (cnt > (size_t)info->usable_page_size)
+				cnt = info->usable_page_size;
+			batch.src[batch.count] = in + in_pos;
+			batch.cnt[batch.count] = cnt;
+			in_pos += page_data_used(info, in + in_pos, cnt);
+		}
+		if (!batch.count)
+			break;
+
+		if (batch.rnd)
+			fread(batch.rnd, page_len, batch.count, rnd);
 
-		ret = write_page(info, buffer, src, rnd, dst, bch, page++);
-		if (ret)
-			return ret;
+		/* encode it, the calling thread acting as worker 0 */
+		for (i = 1; i < batch.nthreads; i++) {
+			if (pthread_create(&workers[i].thread, NULL,
+					   page_worker, &workers[i])) {
+				fprintf(stderr, "Failed to create thread\n");
+				return -1;
+			}
+		}
+		page_worker(&workers[0]);
+		for (i = 1; i < batch.nthreads; i++)
+			pthread_join(workers[i].thread, NULL);
+
+		if (fwrite(batch.dst, page_len, batch.count, dst) !=
+		    (size_t)batch.count) {
+			fprintf(stderr, "Failed to write to the dest file\n");
+			return -1;
+		}
+		batch.first_page += batch.count;
+	}
+
+	if (fclose(dst)) {
+		fprintf(stderr, "Failed to write to the dest file\n");
+		return -1;
 	}
 
 	return 0;
 }
 
+/*
+ * Benchmark mode: time the encoding kernels and the page encoding pipeline
+ * on in-memory data. Before that, the kernels get checked against simple
+ * reference implementations, and the pipeline output against a digest of
+ * what this code produced when the benchmark was written, so optimized
+ * versions can be validated for bit-exactness.
+ */
+#define BENCH_MIN_TIME		0.1	/* seconds per measurement */
+#define BENCH_PAGES		32	/* pages per pipeline run */
+#define BENCH_DIGEST		0x68b61795
+
+static const int bench_ecc_strengths[] = { 16, 24, 28, 32, 40, 48, 56, 60, 64 };
+
+static const struct {
+	int page_size, oob_size, eraseblock_size;
+} bench_layouts[] = {
+	{ 2048, 64, 0x20000 },
+	{ 4096, 224, 0x40000 },
+	{ 8192, 640, 0x200000 },
+	{ 16384, 1280, 0x400000 },
+};
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* reproducible pseudo-random data (xorshift32) */
+static void bench_fill(uint8_t *buf, size_t len, uint32_t seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		buf[i] = seed;
+	}
+}
+
+/* FNV-1a */
+static uint32_t bench_digest(uint32_t hash, const uint8_t *buf, size_t len)
+{
+	while (len--)
+		hash = (hash ^ *buf++) * 16777619;
+	return hash;
+}
+
+static void swap_bits_ref(uint8_t *buf, int len)
+{
+	int i, j;
+
+	for (i = 0; i < len; i++) {
+		uint8_t v = 0;
+
+		for (j = 0; j < 8; j++)
+			if (buf[i] & (1 << j))
+				v |= 0x80 >> j;
+		buf[i] = v;
+	}
+}
+
+/* stepping the LFSR for every byte, without the precomputed keystreams */
+static void scramble_ref(uint16_t seed, uint8_t *data, int len)
+{
+	uint16_t state = lfsr_step(seed, 15);
+	int i;
+
+	for (i = 0; i < len; i++) {
+		data[i] ^= state;
+		state = lfsr_step(state, 8);
+	}
+}
+
+/* byte at a time, using the first remainder table only */
+static void encode_bch_ref(struct bch_control *bch, const uint8_t *data,
+			   unsigned int len, uint8_t *ecc)
+{
+	uint32_t r[BCH_ECC_WORDS(bch)];
+
+	load_ecc8(bch, r, ecc);
+	encode_bch_unaligned(bch, data, len, r);
+	store_ecc8(bch, ecc, r);
+}
+
+static int ecc_fits(const struct image_info *info)
+{
+	int eccbytes, eccsteps;
+
+	eccbytes = DIV_ROUND_UP(info->ecc_strength * 14, 8);
+	if (eccbytes % 2)
+		eccbytes++;
+	eccbytes += 4;
+
+	eccsteps = info->usable_page_size / info->ecc_step_size;
+
+	return info->page_size + info->oob_size >=
+	       info->usable_page_size + (eccsteps * eccbytes);
+}
+
+static int bench_failed(const char *what, const char *config)
+{
+	printf("FAIL: %s doesn't match the reference (%s)\n", what, config);
+	return 1;
+}
+
+static double bench_rate(size_t bytes, double elapsed)
+{
+	return bytes / elapsed / 1e6;
+}
+
+/* encode_bch() for all ECC configs, the result being the throughput table */
+static int bench_encode_bch(double rates[][2])
+{
+	uint8_t data[1024 + 4 + 3], ecc[BCH_ECC_BYTES_MAX], ref[BCH_ECC_BYTES_MAX];
+	unsigned i, j, k;
+	char config[32];
+	int failed = 0;
+
+	for (i = 0; i < ARRAY_SIZE(bench_ecc_strengths); i++) {
+		struct bch_control *bch = init_bch(14, bench_ecc_strengths[i],
+						   BCH_PRIMITIVE_POLY);
+
+		if (!bch) {
+			fprintf(stderr, "Failed to init the BCH engine\n");
+			return 1;
+		}
+
+		for (j = 0; j < 2; j++) {
+			int len = (j ? 1024 : 512) + 4;
+			size_t bytes = 0;
+			double start;
+
+			snprintf(config, sizeof(config), "%d/%d",
+				 bench_ecc_strengths[i], len - 4);
+
+			/* all possible alignments, and chained calls */
+			for (k = 0; k < 4; k++) {
+				bench_fill(data, sizeof(data), k + 1);
+				memset(ecc, 0, sizeof(ecc));
+				memset(ref, 0, sizeof(ref));
+				encode_bch(bch, data + k, len, ecc);
+				encode_bch(bch, data + k, len - 7, ecc);
+				encode_bch_ref(bch, data + k, len, ref);
+				encode_bch_ref(bch, data + k, len - 7, ref);
+				if (memcmp(ecc, ref, bch->ecc_bytes))
+					failed |= bench_failed("encode_bch",
+							       config);
+			}
+
+			start = bench_now();
+			do {
+				memset(ecc, 0, bch->ecc_bytes);
+				encode_bch(bch, data, len, ecc);
+				bytes += len;
+			} while (bench_now() - start < BENCH_MIN_TIME);
+			rates[i][j] = bench_rate(bytes, bench_now() - start);
+		}
+		free_bch(bch);
+	}
+
+	return failed;
+}
+
+/* swap_bits() and scramble(), on a full page of the largest layout */
+static int bench_page_kernels(double *swap_rate, double *scramble_rate)
+{
+	struct image_info info;
+	int len, page, failed = 0;
+	uint8_t *buf, *ref;
+	size_t bytes = 0;
+	double start;
+
+	memset(&info, 0, sizeof(info));
+	info.page_size = bench_layouts[ARRAY_SIZE(bench_layouts) - 1].page_size;
+	info.oob_size = bench_layouts[ARRAY_SIZE(bench_layouts) - 1].oob_size;
+	info.eraseblock_size =
+		bench_layouts[ARRAY_SIZE(bench_layouts) - 1].eraseblock_size;
+	len = info.page_size + info.oob_size;
+
+	buf = malloc(len);
+	ref = malloc(len);
+	if (!buf || !ref) {
+		fprintf(stderr, "Failed to allocate the benchmark buffers\n");
+		return 1;
+	}
+
+	bench_fill(buf, len, 1);
+	memcpy(ref, buf, len);
+	swap_bits(buf, len);
+	swap_bits_ref(ref, len);
+	if (memcmp(buf, ref, len))
+		failed |= bench_failed("swap_bits", "page");
+
+	start = bench_now();
+	do {
+		swap_bits(buf, len);
+		bytes += len;
+	} while (bench_now() - start < BENCH_MIN_TIME);
+	*swap_rate = bench_rate(bytes, bench_now() - start);
+
+	/* every default seed, then the boot0 one */
+	for (info.boot0 = 0; info.boot0 < 2; info.boot0++) {
+		info.scramble = 1;
+		if (init_scrambler(&info)) {
+			fprintf(stderr, "Failed to init the scrambler\n");
+			return 1;
+		}
+		for (page = 0; page < (info.boot0 ? 1 :
+				       (int)scrambler_seedmod(&info)); page++) {
+			bench_fill(buf, len, page + 1);
+			memcpy(ref, buf, len);
+			scramble(&info, page, buf + 1, len - 1);
+			scramble_ref(info.boot0 ? brom_scrambler_seeds[0] :
+				     default_scrambler_seeds[page],
+				     ref + 1, len - 1);
+			if (memcmp(buf, ref, len))
+				failed |= bench_failed("scramble",
+						       info.boot0 ? "boot0" :
+						       "default seeds");
+		}
+		free_scrambler();
+	}
+
+	info.boot0 = 0;
+	init_scrambler(&info);
+	bytes = 0;
+	start = bench_now();
+	do {
+		scramble(&info, 0, buf, len);
+		bytes += len;
+	} while (bench_now() - start < BENCH_MIN_TIME);
+	*scramble_rate = bench_rate(bytes, bench_now() - start);
+	free_scrambler();
+
+	free(buf);
+	free(ref);
+	return failed;
+}
+
+/*
+ * encode_page() for a layout, with the strongest ECC (1024 byte steps) that
+ * fits. Returns the throughput (of source data), or 0 if nothing fits.
+ */
+static double bench_pipeline(struct image_info *info, uint32_t *digest)
+{
+	size_t page_len = info->page_size + info->oob_size;
+	uint8_t *src, *dst, *rnd, *buffer;
+	struct bch_control *bch;
+	size_t bytes;
+	double start, result;
+	int i, pass;
+
+	info->ecc_step_size = 1024;
+	if (!info->boot0) {
+		info->usable_page_size = info->page_size;
+	} else {
+		if (info->page_size > 8192)
+			info->usable_page_size = 8192;
+		else if (info->page_size > 4096)
+			info->usable_page_size = 4096;
+		else
+			info->usable_page_size = 1024;
+	}
+	for (i = ARRAY_SIZE(bench_ecc_strengths) - 1; i >= 0; i--) {
+		info->ecc_strength = bench_ecc_strengths[i];
+		if (ecc_fits(info))
+			break;
+	}
+	if (i < 0)
+		return 0;
+
+	bch = init_bch(14, info->ecc_strength, BCH_PRIMITIVE_POLY);
+	src = malloc(BENCH_PAGES * info->usable_page_size);
+	dst = malloc(page_len);
+	rnd = malloc(BENCH_PAGES * page_len);
+	buffer = malloc(page_len);
+	if (!bch || !src || !dst || !rnd || !buffer || init_scrambler(info)) {
+		fprintf(stderr, "Failed to set up the benchmark\n");
+		exit(EXIT_FAILURE);
+	}
+	bench_fill(src, BENCH_PAGES * info->usable_page_size, page_len);
+	bench_fill(rnd, BENCH_PAGES * page_len, ~page_len);
+
+	/* the first pass also feeds the digest; a single pass still counts */
+	start = bench_now();
+	pass = 0;
+	do {
+		for (i = 0; i < BENCH_PAGES; i++) {
+			encode_page(info, bch, rnd + i * page_len, i,
+				    src + i * info->usable_page_size,
+				    info->usable_page_size, buffer, dst);
+			if (pass == 0)
+				*digest = bench_digest(*digest, dst, page_len);
+		}
+		pass++;
+	} while (bench_now() - start < BENCH_MIN_TIME);
+	bytes = (size_t)pass * BENCH_PAGES * info->usable_page_size;
+	result = bench_rate(bytes, bench_now() - start);
+
+	free_scrambler();
+	free_bch(bch);
+	free(src);
+	free(dst);
+	free(rnd);
+	free(buffer);
+	return result;
+}
+
+static int run_benchmark(void)
+{
+	double bch_rates[ARRAY_SIZE(bench_ecc_strengths)][2];
+	double swap_rate, scramble_rate, rate;
+	uint32_t digest = 2166136261u;
+	struct image_info info;
+	int failed;
+	unsigned i;
+
+	failed = bench_encode_bch(bch_rates);
+	failed |= bench_page_kernels(&swap_rate, &scramble_rate);
+
+	printf("encode_bch (MB/s)  step 512  step 1024\n");
+	for (i = 0; i < ARRAY_SIZE(bench_ecc_strengths); i++)
+		printf("  strength %2d     %9.1f  %9.1f\n",
+		       bench_ecc_strengths[i], bch_rates[i][0], bch_rates[i][1]);
+	printf("swap_bits          %9.1f MB/s\n", swap_rate);
+	printf("scramble           %9.1f MB/s\n", scramble_rate);
+
+	printf("\nencode_page    ecc      mode            MB/s\n");
+	for (i = 0; i < ARRAY_SIZE(bench_layouts); i++) {
+		static const char *modes[] = {
+			"plain", "scramble", "boot0", "boot0+scr"
+		};
+		char ecc[16];
+		int mode;
+
+		for (mode = 0; mode < 4; mode++) {
+			memset(&info, 0, sizeof(info));
+			info.page_size = bench_layouts[i].page_size;
+			info.oob_size = bench_layouts[i].oob_size;
+			info.eraseblock_size = bench_layouts[i].eraseblock_size;
+			info.scramble = mode & 1;
+			info.boot0 = mode >> 1;
+			rate = bench_pipeline(&info, &digest);
+
+			snprintf(ecc, sizeof(ecc), "%d/%d", info.ecc_strength,
+				 info.ecc_step_size);
+			printf("  %5d+%-4d  %7s  %-9s  %9.1f\n",
+			       info.page_size, info.oob_size,
+			       rate ? ecc : "-", modes[mode], rate);
+		}
+	}
+
+	printf("\npipeline digest 0x%08x", digest);
+	if (digest != BENCH_DIGEST) {
+		printf(", expected 0x%08x: FAIL\n", BENCH_DIGEST);
+		failed = 1;
+	} else {
+		printf(": OK\n");
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 static void display_help(int status)
 {
 	fprintf(status == EXIT_SUCCESS ? stdout : stderr,
@@ -931,6 +1565,10 @@ static void display_help(int status)
 		"-b               --boot0              Build a boot0 image.\n"
 		"-s               --scramble           Scramble data\n"
 		"-a <offset>      --address=<offset>   Where the image will be programmed.\n"
+		"-j <count>       --jobs=<count>       Number of encoder threads\n"
+		"                                      (default: number of CPUs)\n"
+		"-B               --benchmark          Time (and check) the encoder on\n"
+		"                                      in-memory data, then exit\n"
 		"\n"
 		"Notes:\n"
 		"All the information you need to pass to this tool should be part of\n"
@@ -970,7 +1608,6 @@ static void display_help(int status)
 static int check_image_info(struct image_info *info)
 {
 	static int valid_ecc_strengths[] = { 16, 24, 28, 32, 40, 48, 56, 60, 64 };
-	int eccbytes, eccsteps;
 	unsigned i;
 
 	if (!info->page_size) {
@@ -1005,15 +1642,7 @@ static int check_image_info(struct image_info *info)
 		return -EINVAL;
 	}
 
-	eccbytes = DIV_ROUND_UP(info->ecc_strength * 14, 8);
-	if (eccbytes % 2)
-		eccbytes++;
-	eccbytes += 4;
-
-	eccsteps = info->usable_page_size / info->ecc_step_size;
-
-	if (info->page_size + info->oob_size <
-	    info->usable_page_size + (eccsteps * eccbytes)) {
+	if (!ecc_fits(info)) {
 		fprintf(stderr,
 			"ECC bytes do not fit in the NAND page, choose a weaker ECC\n");
 		return -EINVAL;
@@ -1043,10 +1672,12 @@ int main(int argc, char **argv)
 			{"boot0", no_argument, 0, 'b'},
 			{"scramble", no_argument, 0, 's'},
 			{"address", required_argument, 0, 'a'},
+			{"jobs", required_argument, 0, 'j'},
+			{"benchmark", no_argument, 0, 'B'},
 			{0, 0, 0, 0},
 		};
 
-		int c = getopt_long(argc, argv, "c:p:o:u:e:ba:sh",
+		int c = getopt_long(argc, argv, "c:p:o:u:e:ba:j:Bsh",
 				long_options, &option_index);
 		if (c == EOF)
 			break;
@@ -1081,6 +1712,11 @@ int main(int argc, char **argv)
 		case 'a':
 			info.offset = strtoull(optarg, NULL, 0);
 			break;
+		case 'j':
+			info.threads = strtol(optarg, NULL, 0);
+			break;
+		case 'B':
+			return run_benchmark();
 		case '?':
 			display_help(-1);
 			break;
@@ -1104,6 +1740,13 @@ int main(int argc, char **argv)
 			info.usable_page_size = 1024;
 	}
 
+#ifdef _SC_NPROCESSORS_ONLN
+	if (!info.threads)
+		info.threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (info.threads < 1)
+		info.threads = 1;
+
 	if (check_image_info(&info))
 		display_help(-1);
 
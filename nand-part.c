@@ -49,12 +49,13 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <string.h>
+#include <sys/uio.h>
 #ifdef __linux__
 # include <sys/ioctl.h>
 # include <sys/mount.h> /* BLKRRPART */
 #endif
 #include "nand-common.h"
+#include "crc32.h"
 
 // so far, only known formats are for A10 and A20
 #if defined(A10)
@@ -70,59 +71,76 @@ static void printmbrheader(MBR *mbr)
 	printf("mbr: version 0x%08x, magic %8.8s\n", mbr->version, mbr->magic);
 }
 
-static MBR *_get_mbr(int fd, int mbr_num, int force)
+#define MBR_COPY(mbrs, i) ((MBR *)((char *)(mbrs) + MBR_SIZE * (i)))
+
+/* read all MBR copies from nand device, with one positional read */
+static MBR *_read_mbrs(int fd)
 {
-	MBR *mbr;
+	MBR *mbrs;
 
 	/*request mbr space*/
-	mbr = malloc(sizeof(MBR));
-	if(mbr == NULL)
+	mbrs = malloc(MBR_SIZE * MBR_COPY_NUM);
+	if(mbrs == NULL)
 	{
 		printf("%s : request memory fail\n",__FUNCTION__);
 		return NULL;
 	}
 
-	/*get mbr from nand device*/
-	lseek(fd,MBR_START_ADDRESS + MBR_SIZE*mbr_num,SEEK_SET);
-	if(read(fd,mbr,MBR_SIZE) == MBR_SIZE)
+	if(pread(fd, mbrs, MBR_SIZE * MBR_COPY_NUM, MBR_START_ADDRESS) !=
+	   MBR_SIZE * MBR_COPY_NUM)
 	{
-		/*checksum*/
-		printf("check partition table copy %d: ", mbr_num);
-		printmbrheader(mbr);
-		if (force) {
-			strncpy((char *)mbr->magic, MBR_MAGIC, 8);
-			mbr->version = MBR_VERSION;
-			return mbr;
-		}
-		if(strncmp((char *)mbr->magic, MBR_MAGIC, 8))
-		{
-			printf("magic %8.8s is not %8s\n", mbr->magic, MBR_MAGIC);
-			return NULL;
-		}
-		if(mbr->version != MBR_VERSION)
-		{
-			printf("version 0x%08x is not 0x%08x\n", mbr->version, MBR_VERSION);
-			return NULL;
-		}
-		if(*(__u32 *)mbr == calc_crc32((__u32 *)mbr + 1,MBR_SIZE - 4))
-		{
-			printf("OK\n");
-			return mbr;
-		}
-		printf("BAD!\n");
+		printf("%s : can't read partition tables\n",__FUNCTION__);
+		free(mbrs);
+		return NULL;
 	}
-	return NULL;
+
+	return mbrs;
 }
 
-static __s32 _free_mbr(MBR *mbr)
+static MBR *_get_mbr(MBR *mbrs, int mbr_num, int force)
 {
-	if(mbr)
+	MBR *mbr = MBR_COPY(mbrs, mbr_num);
+
+	/*checksum*/
+	printf("check partition table copy %d: ", mbr_num);
+	printmbrheader(mbr);
+	if (force) {
+		strncpy((char *)mbr->magic, MBR_MAGIC, 8);
+		mbr->version = MBR_VERSION;
+		return mbr;
+	}
+	if(strncmp((char *)mbr->magic, MBR_MAGIC, 8))
 	{
-		free(mbr);
-		mbr = 0;
+		printf("magic %8.8s is not %8s\n", mbr->magic, MBR_MAGIC);
+		return NULL;
 	}
+	if(mbr->version != MBR_VERSION)
+	{
+		printf("version 0x%08x is not 0x%08x\n", mbr->version, MBR_VERSION);
+		return NULL;
+	}
+	if(*(__u32 *)mbr == crc32_update(0, (__u32 *)mbr + 1,MBR_SIZE - 4))
+	{
+		printf("OK\n");
+		return mbr;
+	}
+	printf("BAD!\n");
+	return NULL;
+}
 
-	return 0;
+/* validate all copies, returning the last good one (or NULL) */
+static MBR *_check_mbrs(MBR *mbrs, int force)
+{
+	MBR *mbr = NULL;
+	int i;
+
+	for (i = 0; i < MBR_COPY_NUM; i++) {
+		MBR *copy = _get_mbr(mbrs, i, force);
+		if (copy)
+			mbr = copy;
+	}
+
+	return mbr;
 }
 
 static void printmbr(MBR *mbr)
@@ -144,30 +162,22 @@ static void printmbr(MBR *mbr)
 }
 int checkmbrs(int fd)
 {
-	int i;
-	MBR *mbrs[MBR_COPY_NUM];
-	MBR *mbr = NULL;
+	MBR *mbrs;
+	MBR *mbr;
 
-	memset((void *) mbrs, 0, sizeof(mbrs));
-	for (i = 0; i < MBR_COPY_NUM; i++) {
-		mbrs[i] = _get_mbr(fd, i, 0);
-		if (mbrs[i])
-			mbr = mbrs[i];
-	}
+	mbrs = _read_mbrs(fd);
+	if (!mbrs)
+		return 0;
+
+	mbr = _check_mbrs(mbrs, 0);
 	if (!mbr) {
 		printf("all partition tables are bad!\n");
-		for (i = 0; i < MBR_COPY_NUM; i++) {
-			if (mbrs[i])
-				_free_mbr(mbrs[i]);
-		}
+		free(mbrs);
 		return 0;
 	}
 
 	printmbr(mbr);
-	for (i = 0; i < MBR_COPY_NUM; i++) {
-		if (mbrs[i])
-			_free_mbr(mbrs[i]);
-	}
+	free(mbrs);
 	return 1;
 }
 
@@ -176,32 +186,26 @@ static int writembrs(int fd, char names[][MAX_NAME], __u32 start, __u32 *lens, u
 	unsigned int part_cnt = 0;
 	int i;
 	char yn = 'n';
-	MBR *mbrs[MBR_COPY_NUM];
-	MBR *mbr = NULL;
+	struct iovec iov[MBR_COPY_NUM];
+	MBR *mbrs;
+	MBR *mbr;
 	FILE *backup;
 
-	memset((void *) mbrs, 0, sizeof(mbrs));
-	for (i = 0; i < MBR_COPY_NUM; i++) {
-		mbrs[i] = _get_mbr(fd, i, force);
-		if (mbrs[i])
-			mbr = mbrs[i];
-	}
+	mbrs = _read_mbrs(fd);
+	if (!mbrs)
+		return 0;
+
+	mbr = _check_mbrs(mbrs, force);
 	if (!mbr) {
 		printf("all partition tables are bad!\n");
-		for (i = 0; i < MBR_COPY_NUM; i++) {
-			if (mbrs[i])
-				_free_mbr(mbrs[i]);
-		}
+		free(mbrs);
 		return 0;
 	}
 	// back up mbr data
 	backup = fopen("nand_mbr.backup", "w");
 	if (!backup) {
 		printf("can't open nand_mbr.backup to back up mbr data\n");
-		for (i = 0; i < MBR_COPY_NUM; i++) {
-			if (mbrs[i])
-				_free_mbr(mbrs[i]);
-		}
+		free(mbrs);
 		return 0;
 	}
 
@@ -232,24 +236,34 @@ static int writembrs(int fd, char names[][MAX_NAME], __u32 start, __u32 *lens, u
 
 	printf("\nready to write new partition tables:\n");
 	printmbr(mbr);
-	for (i = 0; i < MBR_COPY_NUM; i++) {
-		if (mbrs[i])
-			_free_mbr(mbrs[i]);
-	}
 	printf("\nwrite new partition tables? (Y/N)\n");
 	read(0, &yn, 1);
 	if (yn != 'Y' && yn != 'y') {
 		printf("aborting\n");
+		free(mbrs);
 		return 0;
 	}
 
+	// build all copies in memory, then write them out in one go
 	for (i = 0; i < MBR_COPY_NUM; i++) {
-		mbr->index = i;
+		MBR *copy = MBR_COPY(mbrs, i);
+
+		if (copy != mbr)
+			memcpy(copy, mbr, MBR_SIZE);
+		copy->index = i;
 		// calculate new checksum
-		*(__u32 *)mbr = calc_crc32((__u32 *)mbr + 1,MBR_SIZE - 4);
-		lseek(fd,MBR_START_ADDRESS + MBR_SIZE*i,SEEK_SET);
-		write(fd,mbr,MBR_SIZE);
+		*(__u32 *)copy = crc32_update(0, (__u32 *)copy + 1,MBR_SIZE - 4);
+		iov[i].iov_base = copy;
+		iov[i].iov_len = MBR_SIZE;
+	}
+
+	if (pwritev(fd, iov, MBR_COPY_NUM, MBR_START_ADDRESS) !=
+	    MBR_SIZE * MBR_COPY_NUM || fsync(fd)) {
+		perror("Failed writing partition tables");
+		free(mbrs);
+		return 0;
 	}
+	free(mbrs);
 
 #ifdef __linux__
 	if (ioctl(fd, BLKRRPART, NULL))
@@ -15,6 +15,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,44 +39,133 @@ struct phoenix_ptable {
 	} part[62];
 } ptable;
 
-static int save_part(struct phoenix_ptable *ptable, int part, const char *dest, FILE *in)
+/* Partitions are copied through a bounded buffer of this size */
+#define COPY_CHUNK	(1 << 20)
+
+/*
+ * Copy a partition to its output. The input is only accessed with
+ * positional reads, so several parts may be saved concurrently from
+ * the same file descriptor.
+ */
+static int save_part(struct phoenix_ptable *ptable, int part, const char *dest, int in)
 {
 	int l = strlen(dest) + 16;
 	char outname[l];
 	FILE *out = stdout;
 	char *buf = NULL;
+	off_t offset;
+	size_t size, n;
+	ssize_t rd;
 	int ret = 0;
 	snprintf(outname, l, dest, part);
 	if (part > ptable->parts) {
 		fprintf(stderr, "ERROR: Part index out of range\n");
 		return -1;
 	}
-	buf = malloc(ptable->part[part].size);
+	offset = (off_t)le32toh(ptable->part[part].start) * 0x200;
+	size = le32toh(ptable->part[part].size);
+	buf = malloc(COPY_CHUNK);
 	if (!buf)
 		goto err;
 	if (strcmp(outname, "-") != 0)
 		out = fopen(outname, "wb");
 	if (!out)
 		goto err;
-	if (fseek(in, ptable->part[part].start * 0x200, SEEK_SET) == -1)
-		goto err;
-	if (fread(buf, ptable->part[part].size, 1, in) != 1)
-		goto err;
-	if (fwrite(buf, ptable->part[part].size, 1, out) != 1)
+	while (size > 0) {
+		n = size < COPY_CHUNK ? size : COPY_CHUNK;
+		rd = pread(in, buf, n, offset);
+		if (rd < 0 && errno == EINTR)
+			continue;
+		if (rd <= 0) {
+			if (rd == 0)
+				errno = EIO; /* truncated image */
+			goto err;
+		}
+		if (fwrite(buf, rd, 1, out) != 1)
+			goto err;
+		offset += rd;
+		size -= rd;
+	}
+	if (fflush(out) != 0)
 		goto err;
 	ret = 0;
 _exit:
 	if (buf)
 		free(buf);
-	if (out != stdout)
+	if (out && out != stdout)
 		fclose(out);
 	return ret;
 err:
-	perror(NULL);
+	perror(outname);
 	ret = -1;
 	goto _exit;
 }
 
+/* Work queue for saving all parts with a pool of threads */
+struct save_queue {
+	struct phoenix_ptable *ptable;
+	const char *dest;
+	int in;
+	int next, count;
+	int failed;
+	pthread_mutex_t lock;
+};
+
+static void *save_worker(void *arg)
+{
+	struct save_queue *q = arg;
+	int part, ret;
+
+	while (1) {
+		pthread_mutex_lock(&q->lock);
+		part = q->next < q->count ? q->next++ : -1;
+		pthread_mutex_unlock(&q->lock);
+		if (part < 0)
+			break;
+		ret = save_part(q->ptable, part, q->dest, q->in);
+		if (ret) {
+			pthread_mutex_lock(&q->lock);
+			q->failed++;
+			pthread_mutex_unlock(&q->lock);
+		}
+	}
+	return NULL;
+}
+
+static int save_all_parts(struct phoenix_ptable *ptable, const char *dest,
+			  int in, int jobs)
+{
+	struct save_queue q = {
+		.ptable = ptable,
+		.dest = dest,
+		.in = in,
+		.count = le16toh(ptable->parts),
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	int i;
+
+	/* with a single output all parts have to go there in order */
+	if (!strchr(dest, '%'))
+		jobs = 1;
+	if (jobs > q.count)
+		jobs = q.count;
+	if (jobs < 1)
+		jobs = 1;
+	pthread_t tid[jobs]; /* (sized after clamping to the part count) */
+
+	for (i = 1; i < jobs; i++) {
+		if (pthread_create(&tid[i], NULL, save_worker, &q) != 0) {
+			jobs = i;
+			break;
+		}
+	}
+	save_worker(&q);
+	for (i = 1; i < jobs; i++)
+		pthread_join(tid[i], NULL);
+
+	return q.failed ? -1 : 0;
+}
+
 static void usage(char **argv)
 {
 	puts("phoenix-info " VERSION "\n");
@@ -84,6 +175,7 @@ static void usage(char **argv)
 		"	-p N	part number\n"
 		"	-o X	destination directory, file or pattern (%%d for part number)\n"
 		"	-s	save all parts\n"
+		"	-j N	number of parts to save in parallel (default: one per CPU)\n"
 		, argv[0]
 	);
 }
@@ -95,10 +187,11 @@ int main(int argc, char **argv)
 	int verbose = 1;
 	int save_parts = 0;
 	int part = -1;
-	int opt;
+	int opt, ret = 0;
+	int jobs = 0;
 	const char *dest = "%d.img";
 	
-	while ((opt = getopt(argc, argv, "vqso:p:?")) != -1) {
+	while ((opt = getopt(argc, argv, "vqso:p:j:?")) != -1) {
 		switch(opt) {
 		case 'v':
 			verbose++;
@@ -118,6 +211,9 @@ int main(int argc, char **argv)
 		case 's':
 			save_parts = 1;
 			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
 		default:
 			usage(argv);
 			exit(1);
@@ -131,7 +227,7 @@ int main(int argc, char **argv)
 		if (t[strlen(t)-1] == '/' || !part) {
 			int l = strlen(t) + strlen("/%d.img") + 1;
 			char *tmp = malloc(l);
-			snprintf(tmp, l, "%s/%%d.img", optarg);
+			snprintf(tmp, l, "%s/%%d.img", t);
 			t = tmp;
 		}
 		dest = t;
@@ -166,8 +262,20 @@ int main(int argc, char **argv)
 				printf("\tsig??: %08x\n", le32toh(ptable.part[i].sig));
 			printf("\n");
 		}
-		if (save_parts && (part == -1 || part == i)) {
-			save_part(&ptable, i, dest, in);
+		if (save_parts && part == i) {
+			if (save_part(&ptable, i, dest, fileno(in)))
+				ret = 1;
 		}
 	}
+	if (save_parts && part == -1) {
+#ifdef _SC_NPROCESSORS_ONLN
+		if (jobs <= 0)
+			jobs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (jobs <= 0)
+			jobs = 1;
+		if (save_all_parts(&ptable, dest, fileno(in), jobs))
+			ret = 1;
+	}
+	return ret;
 }
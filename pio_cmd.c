@@ -0,0 +1,384 @@
+/*
+ * (C) Copyright 2011 Henrik Nordstrom <henrik@henriknordstrom.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "portable_endian.h"
+#include "pio_cmd.h"
+
+struct pio_status {
+	int mul_sel;
+	int pull;
+	int drv_level;
+	int data;
+};
+
+#define PIO_REG_CFG(B, N, I)	((B) + (N)*0x24 + ((I)<<2) + 0x00)
+#define PIO_REG_DLEVEL(B, N, I)	((B) + (N)*0x24 + ((I)<<2) + 0x14)
+#define PIO_REG_PULL(B, N, I)	((B) + (N)*0x24 + ((I)<<2) + 0x1C)
+#define PIO_REG_DATA(B, N)	((B) + (N)*0x24 + 0x10)
+#define PIO_NR_PORTS		9 /* A-I */
+
+#define LE32TOH(X)		le32toh(*((uint32_t*)(X)))
+
+static int pio_get(const char *buf, uint32_t port, uint32_t port_num, struct pio_status *pio)
+{
+	uint32_t val;
+	uint32_t port_num_func, port_num_pull;
+	uint32_t offset_func, offset_pull;
+
+	port_num_func = port_num >> 3;
+	offset_func = ((port_num & 0x07) << 2);
+
+	port_num_pull = port_num >> 4;
+	offset_pull = ((port_num & 0x0f) << 1);
+
+	/* func */
+	val = LE32TOH(PIO_REG_CFG(buf, port, port_num_func));
+	pio->mul_sel = (val>>offset_func) & 0x07;
+
+	/* pull */
+	val = LE32TOH(PIO_REG_PULL(buf, port, port_num_pull));
+	pio->pull = (val>>offset_pull) & 0x03;
+
+	/* dlevel */
+	val = LE32TOH(PIO_REG_DLEVEL(buf, port, port_num_pull));
+	pio->drv_level = (val>>offset_pull) & 0x03;
+
+	/* i/o data */
+	if (pio->mul_sel > 1)
+		pio->data = -1;
+	else {
+		val = LE32TOH(PIO_REG_DATA(buf, port));
+		pio->data = (val >> port_num) & 0x01;
+	}
+	return 1;
+}
+
+static int pio_set(char *buf, uint32_t port, uint32_t port_num, struct pio_status *pio)
+{
+	uint32_t *addr, val;
+	uint32_t port_num_func, port_num_pull;
+	uint32_t offset_func, offset_pull;
+
+	port_num_func = port_num >> 3;
+	offset_func = ((port_num & 0x07) << 2);
+
+	port_num_pull = port_num >> 4;
+	offset_pull = ((port_num & 0x0f) << 1);
+
+	/* func */
+	if (pio->mul_sel >= 0) {
+		addr = (uint32_t*)PIO_REG_CFG(buf, port, port_num_func);
+		val = le32toh(*addr);
+		val &= ~(0x07 << offset_func);
+		val |=  (pio->mul_sel & 0x07) << offset_func;
+		*addr = htole32(val);
+	}
+
+	/* pull */
+	if (pio->pull >= 0) {
+		addr = (uint32_t*)PIO_REG_PULL(buf, port, port_num_pull);
+		val = le32toh(*addr);
+		val &= ~(0x03 << offset_pull);
+		val |=  (pio->pull & 0x03) << offset_pull;
+		*addr = htole32(val);
+	}
+
+	/* dlevel */
+	if (pio->drv_level >= 0) {
+		addr = (uint32_t*)PIO_REG_DLEVEL(buf, port, port_num_pull);
+		val = le32toh(*addr);
+		val &= ~(0x03 << offset_pull);
+		val |=  (pio->drv_level & 0x03) << offset_pull;
+		*addr = htole32(val);
+	}
+
+	/* data */
+	if (pio->data >= 0) {
+		addr = (uint32_t*)PIO_REG_DATA(buf, port);
+		val = le32toh(*addr);
+		if (pio->data)
+			val |= (1u << port_num);
+		else
+			val &= ~(1u << port_num);
+		*addr = htole32(val);
+	}
+
+	return 1;
+}
+
+static void pio_print(int port, int port_nr, struct pio_status *pio)
+{
+	printf("P%c%d", 'A'+port, port_nr);
+	printf("<%x>", pio->mul_sel);
+	printf("<%x>", pio->pull);
+	printf("<%x>", pio->drv_level);
+	if (pio->data >= 0)
+		printf("<%x>", pio->data);
+	fputc('\n', stdout);
+}
+
+static void print(const char *buf)
+{
+	int port, i;
+	struct pio_status pio;
+	for (port=0; port < PIO_NR_PORTS; port++) {
+		for (i=0; i<32; i++) {
+			if (pio_get(buf, port, i, &pio)) {
+				pio_print(port, i, &pio);
+			}
+		}
+	}
+}
+
+static void parse_pin(int *port, int *pin, const char *name)
+{
+	if (*name == 'P') name++;
+	*port = *name++ - 'A';
+	*pin = atoi(name);
+}
+
+static void cmd_show_pin(char *buf, const char *pin)
+{
+	int port, port_nr;
+	struct pio_status pio;
+	parse_pin(&port, &port_nr, pin);
+	if (pio_get(buf, port, port_nr, &pio))
+		pio_print(port, port_nr, &pio);
+}
+
+static int parse_int(int *dst, const char *in)
+{
+	int value;
+	char *next;
+	errno = 0;
+	value = strtol(in, &next, 0);
+	if (!errno && next != in) {
+		*dst = value;
+		return 0;
+	}
+	return -1;
+}
+
+static void cmd_set_pin(char *buf, const char *pin)
+{
+	int port, port_nr;
+	const char *t = pin;
+	struct pio_status pio;
+	parse_pin(&port, &port_nr, pin);
+	if (!pio_get(buf, port, port_nr, &pio))
+		return;
+	if ((t = strchr(pin, '='))) {
+		pio.mul_sel = 1;
+		if (t) {
+			t++;
+			parse_int(&pio.data, t);
+		}
+		if (t)
+			t = strchr(t, ',');
+		if (t) {
+			t++;
+			parse_int(&pio.drv_level, t);
+		}
+	} else if ((t = strchr(pin, '?'))) {
+		pio.mul_sel = 0;
+		pio.data = 0;
+		pio.drv_level = 0;
+		if (t) {
+			t++;
+			parse_int(&pio.pull, t);
+		}
+	} else if ((t = strchr(pin, '<'))) {
+		if (t) {
+			t++;
+			parse_int(&pio.mul_sel, t);
+		}
+		if (t)
+			t = strchr(t, '<');
+		if (t) {
+			t++;
+			parse_int(&pio.pull, t);
+		}
+		if (t)
+			t = strchr(t, '<');
+		if (t) {
+			t++;
+			parse_int(&pio.drv_level, t);
+		}
+		if (t)
+			t = strchr(t, '<');
+		if (t) {
+			t++;
+			parse_int(&pio.data, t);
+		}
+	}
+	pio_set(buf, port, port_nr, &pio);
+}
+
+/*
+ * Time base for cmd_oscillate(), in seconds. This needs POSIX timers
+ * (CLOCK_MONOTONIC), as only a monotonic clock gives stable intervals.
+ */
+static double pio_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Wait until the given point in time: sleep for longer intervals, and
+ * busy-wait for the remaining PIO_SLEEP_SLACK (or for short intervals).
+ */
+#define PIO_SLEEP_SLACK	100e-6
+
+static void pio_wait_until(double t)
+{
+	double remaining = t - pio_time() - PIO_SLEEP_SLACK;
+
+	if (remaining > 0) {
+		struct timespec ts = {
+			.tv_sec = remaining,
+			.tv_nsec = (remaining - (long)remaining) * 1e9,
+		};
+		nanosleep(&ts, NULL);
+	}
+	while (pio_time() < t)
+		;
+}
+
+/*
+ * Pxx[,Pyy...]*count[@hz] - configure the pins as outputs, then toggle all
+ * of them 'count' times. The two DATA register values get precomputed for
+ * each port involved, so that the loop only has to store them. With a rate
+ * given, the toggles are paced to 'hz' per second, otherwise they happen
+ * as fast as possible. Reports the toggle frequency achieved.
+ */
+static void cmd_oscillate(char *buf, const char *pin)
+{
+	struct {
+		volatile uint32_t *addr; /* DATA register */
+		uint32_t word[2]; /* toggled and original value */
+	} ports[PIO_NR_PORTS];
+	int port, port_nr, nports = 0;
+	int i, j, n = 0;
+	double hz = 0, start, elapsed;
+	const char *t = pin;
+
+	while (t && *t == 'P') {
+		struct pio_status pio;
+		parse_pin(&port, &port_nr, t);
+		if (port < 0 || port >= PIO_NR_PORTS || port_nr < 0 || port_nr > 31) {
+			fprintf(stderr, "invalid pin: %s\n", t);
+			return;
+		}
+		if (!pio_get(buf, port, port_nr, &pio))
+			return;
+		pio.mul_sel = 1;
+		pio_set(buf, port, port_nr, &pio);
+
+		for (j = 0; j < nports; j++)
+			if (ports[j].addr == (uint32_t *)PIO_REG_DATA(buf, port))
+				break;
+		if (j == nports) {
+			ports[nports].addr = (uint32_t *)PIO_REG_DATA(buf, port);
+			ports[nports++].word[0] = 0;
+		}
+		ports[j].word[0] |= 1u << port_nr; /* the mask, for now */
+
+		t = strpbrk(t, ",*");
+		if (t && *t == ',')
+			t++;
+	}
+
+	t = strchr(pin, '*');
+	parse_int(&n, t+1);
+	if ((t = strchr(t, '@')))
+		hz = strtod(t+1, NULL);
+
+	for (j = 0; j < nports; j++) {
+		uint32_t val = le32toh(*ports[j].addr);
+		ports[j].word[1] = htole32(val);
+		ports[j].word[0] = htole32(val ^ ports[j].word[0]);
+	}
+
+	start = pio_time();
+	for (i = 0; i < n; i++) {
+		if (hz > 0)
+			pio_wait_until(start + i / hz);
+		for (j = 0; j < nports; j++)
+			*ports[j].addr = ports[j].word[i & 1];
+	}
+	/* the last toggle's interval ends at n / hz; n intervals for n toggles */
+	if (hz > 0)
+		pio_wait_until(start + n / hz);
+	elapsed = pio_time() - start;
+
+	if (n > 0 && elapsed > 0)
+		printf("%d toggles in %.6f s, %.1f Hz\n", n, elapsed, n / elapsed);
+}
+
+static void cmd_clean(char *buf)
+{
+	int port, i;
+	struct pio_status pio;
+	for (port=0; port < PIO_NR_PORTS; port++) {
+		for (i=0; i<32; i++) {
+			if (pio_get(buf, port, i, &pio)) {
+				if (pio.mul_sel == 0) {
+					pio.data = 0;
+					pio_set(buf, port, i, &pio);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Execute a single pin command on the PIO register copy in 'buf'. Returns
+ * false (without doing anything) if 'command' isn't a known command.
+ */
+bool pio_command(char *buf, const char *command)
+{
+	if (*command == 'P') {
+		if (strchr(command, '<'))
+			cmd_set_pin(buf, command);
+		else if (strchr(command, '='))
+			cmd_set_pin(buf, command);
+		else if (strchr(command, '?'))
+			cmd_set_pin(buf, command);
+		else if (strchr(command, '*'))
+			cmd_oscillate(buf, command);
+		else
+			cmd_show_pin(buf, command);
+	}
+	else if (strcmp(command, "print") == 0)
+		print(buf);
+	else if (strcmp(command, "clean") == 0)
+		cmd_clean(buf);
+	else
+		return false;
+	return true;
+}
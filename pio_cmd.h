@@ -0,0 +1,34 @@
+/*
+ * (C) Copyright 2011 Henrik Nordstrom <henrik@henriknordstrom.net>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+
+#ifndef _SUNXI_TOOLS_PIO_CMD_H
+#define _SUNXI_TOOLS_PIO_CMD_H
+
+#include <stdbool.h>
+
+/*
+ * sunxi-pio pin commands, working on a (little endian) copy of the PIO
+ * registers - either in memory, or mapped from the device.
+ */
+#define PIO_BASE	0x01c20800
+#define PIO_REG_SIZE	0x228 /*0x300*/
+
+bool pio_command(char *buf, const char *command);
+
+#endif /* _SUNXI_TOOLS_PIO_CMD_H */
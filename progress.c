@@ -58,6 +58,13 @@ const char *format_ETA(double remaining)
 	return "--:--";
 }
 
+/*
+ * Minimum time between two progress callbacks (in seconds). Updates arriving
+ * faster only get accumulated, which keeps output formatting away from most
+ * iterations of the transfer loop. The final update always gets through.
+ */
+#define PROGRESS_INTERVAL	0.1
+
 /* Private progress state variable */
 
 typedef struct {
@@ -65,6 +72,8 @@ typedef struct {
 	size_t total;
 	size_t done;
 	double start; /* start point (timestamp) for rate and ETA calculation */
+	double last; /* time of the last callback */
+	const char *tag; /* identifies the device for progress_json() */
 } progress_private_t;
 
 static progress_private_t progress = {
@@ -80,14 +89,27 @@ void progress_start(progress_cb_t callback, size_t expected_total)
 	progress.total = expected_total;
 	progress.done = 0;
 	progress.start = gettime(); /* reset start time */
+	progress.last = 0.;
 }
 
 /* Update progress status, passing information to the callback function. */
 void progress_update(size_t bytes_done)
 {
 	progress.done += bytes_done;
-	if (progress.callback)
+	if (progress.callback) {
+		double now = gettime();
+		if (progress.done < progress.total &&
+		    now - progress.last < PROGRESS_INTERVAL)
+			return; /* rate limit */
+		progress.last = now;
 		progress.callback(progress.total, progress.done);
+	}
+}
+
+/* Set a tag (e.g. the USB device) to include with progress_json() output */
+void progress_set_tag(const char *tag)
+{
+	progress.tag = tag;
 }
 
 /* Return relative / "elapsed" time, since progress_start() */
@@ -163,3 +185,22 @@ void progress_gauge_xxx(size_t total, size_t done)
 		fflush(stdout);
 	}
 }
+
+/*
+ * Machine-readable progress: one JSON object per line (on stdout), meant
+ * to be consumed by other programs. Rate is in bytes per second, elapsed
+ * time and ETA in seconds.
+ */
+void progress_json(size_t total, size_t done)
+{
+	double elapsed = progress_elapsed();
+	double speed = rate(done, elapsed);
+
+	printf("{");
+	if (progress.tag)
+		printf("\"device\": \"%s\", ", progress.tag);
+	printf("\"bytes\": %zu, \"total\": %zu, \"rate\": %.1f, "
+	       "\"elapsed\": %.3f, \"eta\": %.3f}\n", done, total, speed,
+	       elapsed, estimate(total - done, speed));
+	fflush(stdout);
+}
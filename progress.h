@@ -32,10 +32,12 @@ double estimate(size_t remaining, double rate);
 
 void progress_start(progress_cb_t callback, size_t expected_total);
 void progress_update(size_t bytes_done);
+void progress_set_tag(const char *tag);
 
 /* progress callback implementations for various display styles */
 void progress_bar(size_t total, size_t done);
 void progress_gauge(size_t total, size_t done);
 void progress_gauge_xxx(size_t total, size_t done);
+void progress_json(size_t total, size_t done);
 
 #endif /* _SUNXI_TOOLS_PROGRESS_H */
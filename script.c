@@ -24,32 +24,106 @@
 
 #include "script.h"
 
+/*
+ * Sections and entries are indexed by name (FNV-1a hash). New ones get
+ * appended to the end of their hash chain, so the first match found there
+ * is also the first one in list order.
+ */
+static uint32_t script_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name) {
+		h ^= (uint8_t)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/*
+ * Sections and entries get allocated from an arena owned by the script,
+ * a list of large chunks which are only released by script_delete(). The
+ * first chunk is part of the script allocation itself.
+ */
+#define SCRIPT_CHUNK_SIZE	(64 * 1024)
+#define SCRIPT_ALIGN		sizeof(void *)
+
+struct script_chunk {
+	struct script_chunk *next;
+	size_t size, used;
+	/* data follows */
+};
+
+static void *script_alloc(struct script *script, size_t size)
+{
+	struct script_chunk *chunk = script->chunks;
+	void *p;
+
+	size = (size + SCRIPT_ALIGN - 1) & ~(size_t)(SCRIPT_ALIGN - 1);
+	if (chunk->size - chunk->used < size) {
+		size_t n = size > SCRIPT_CHUNK_SIZE ? size : SCRIPT_CHUNK_SIZE;
+		if (!(chunk = malloc(sizeof(*chunk) + n)))
+			return NULL;
+		chunk->size = n;
+		chunk->used = 0;
+		chunk->next = script->chunks;
+		script->chunks = chunk;
+	}
+
+	p = (char *)(chunk + 1) + chunk->used;
+	chunk->used += size;
+	return p;
+}
+
 /*
  */
 struct script *script_new(void)
 {
 	struct script *script;
-	if ((script = malloc(sizeof(*script))))
+	if ((script = malloc(sizeof(*script) + sizeof(struct script_chunk) +
+			     SCRIPT_CHUNK_SIZE))) {
 		list_init(&script->sections);
+		memset(script->section_hash, 0, sizeof(script->section_hash));
+
+		script->chunks = (struct script_chunk *)(script + 1);
+		script->chunks->next = NULL;
+		script->chunks->size = SCRIPT_CHUNK_SIZE;
+		script->chunks->used = 0;
+	}
 	return script;
 }
 
 void script_delete(struct script *script)
 {
-	struct list_entry *o;
+	struct script_chunk *chunk;
 
 	assert(script);
 
-	while ((o = list_last(&script->sections))) {
-		struct script_section *section = container_of(o,
-			       struct script_section, sections);
-
-		script_section_delete(section);
+	/* everything but the first chunk, which belongs to the script */
+	while ((chunk = script->chunks)->next) {
+		script->chunks = chunk->next;
+		free(chunk);
 	}
 
 	free(script);
 }
 
+void script_reset(struct script *script)
+{
+	struct script_chunk *chunk;
+
+	assert(script);
+
+	while ((chunk = script->chunks)->next) {
+		script->chunks = chunk->next;
+		free(chunk);
+	}
+	script->chunks->used = 0;
+
+	list_init(&script->sections);
+	memset(script->section_hash, 0, sizeof(script->section_hash));
+}
+
 /*
  */
 struct script_section *script_section_new(struct script *script,
@@ -60,7 +134,7 @@ struct script_section *script_section_new(struct script *script,
 	assert(script);
 	assert(name && *name);
 
-	if ((section = malloc(sizeof(*section)))) {
+	if ((section = script_alloc(script, sizeof(*section)))) {
 		size_t l = strlen(name);
 		if (l>31) /* truncate */
 			l=31;
@@ -69,6 +143,15 @@ struct script_section *script_section_new(struct script *script,
 
 		list_init(&section->entries);
 		list_append(&script->sections, &section->sections);
+
+		struct script_section **p = &script->section_hash[
+			script_hash(section->name) % SCRIPT_SECTION_HASH];
+		while (*p)
+			p = &(*p)->hash_next;
+		*p = section;
+		section->hash_next = NULL;
+		section->script = script;
+		memset(section->entry_hash, 0, sizeof(section->entry_hash));
 	}
 	return section;
 }
@@ -88,21 +171,28 @@ void script_section_delete(struct script_section *section)
 
 	if (!list_empty(&section->sections))
 		list_remove(&section->sections);
+
+	if (section->script) {
+		struct script_section **p = &section->script->section_hash[
+			script_hash(section->name) % SCRIPT_SECTION_HASH];
+		while (*p != section)
+			p = &(*p)->hash_next;
+		*p = section->hash_next;
+		section->script = NULL;
+	}
 }
 
 struct script_section *script_find_section(struct script *script,
 					   const char *name)
 {
-	struct list_entry *o;
 	struct script_section *section;
 
 	assert(script);
 	assert(name);
 
-	for (o = list_first(&script->sections); o;
-	     o = list_next(&script->sections, o)) {
-		section = container_of(o, struct script_section, sections);
-
+	for (section = script->section_hash[script_hash(name) %
+					    SCRIPT_SECTION_HASH];
+	     section; section = section->hash_next) {
 		if (strcmp(section->name, name) == 0)
 			return section;
 	}
@@ -132,12 +222,18 @@ static inline void script_entry_append(struct script_section *section,
 	entry->type = type;
 
 	list_append(&section->entries, &entry->entries);
+
+	struct script_entry **p = &section->entry_hash[
+		script_hash(entry->name) % SCRIPT_ENTRY_HASH];
+	while (*p)
+		p = &(*p)->hash_next;
+	*p = entry;
+	entry->hash_next = NULL;
+	entry->section = section;
 }
 
 void script_entry_delete(struct script_entry *entry)
 {
-	void *container;
-
 	assert(entry);
 	assert(entry->type == SCRIPT_VALUE_TYPE_SINGLE_WORD ||
 	       entry->type == SCRIPT_VALUE_TYPE_STRING ||
@@ -147,24 +243,16 @@ void script_entry_delete(struct script_entry *entry)
 	if (!list_empty(&entry->entries))
 		list_remove(&entry->entries);
 
-	switch(entry->type) {
-	case SCRIPT_VALUE_TYPE_SINGLE_WORD:
-		container = container_of(entry, struct script_single_entry, entry);
-		break;
-	case SCRIPT_VALUE_TYPE_STRING:
-		container = container_of(entry, struct script_string_entry, entry);
-		break;
-	case SCRIPT_VALUE_TYPE_GPIO:
-		container = container_of(entry, struct script_gpio_entry, entry);
-		break;
-	case SCRIPT_VALUE_TYPE_NULL:
-		container = container_of(entry, struct script_null_entry, entry);
-		break;
-	default:
-		abort();
+	if (entry->section) {
+		struct script_entry **p = &entry->section->entry_hash[
+			script_hash(entry->name) % SCRIPT_ENTRY_HASH];
+		while (*p != entry)
+			p = &(*p)->hash_next;
+		*p = entry->hash_next;
+		entry->section = NULL;
 	}
 
-	free(container);
+	/* memory stays in the arena, until the script gets deleted */
 }
 
 struct script_null_entry *script_null_entry_new(struct script_section *section,
@@ -175,7 +263,7 @@ struct script_null_entry *script_null_entry_new(struct script_section *section,
 	assert(section);
 	assert(name && *name);
 
-	if ((entry = malloc(sizeof(*entry)))) {
+	if ((entry = script_alloc(section->script, sizeof(*entry)))) {
 		script_entry_append(section, &entry->entry,
 				    SCRIPT_VALUE_TYPE_NULL, name);
 	}
@@ -192,7 +280,7 @@ struct script_single_entry *script_single_entry_new(struct script_section *secti
 	assert(section);
 	assert(name && *name);
 
-	if ((entry = malloc(sizeof(*entry)))) {
+	if ((entry = script_alloc(section->script, sizeof(*entry)))) {
 		entry->value = value;
 
 		script_entry_append(section, &entry->entry,
@@ -212,7 +300,8 @@ struct script_string_entry *script_string_entry_new(struct script_section *secti
 	assert(name);
 	assert(s);
 
-	if ((entry = malloc(sizeof(*entry)+l+1))) {
+	if ((entry = script_alloc(section->script,
+				  sizeof(*entry)+l+1))) {
 		entry->l = l;
 		memcpy(entry->string, s, l);
 		entry->string[l] = '\0';
@@ -234,7 +323,7 @@ struct script_gpio_entry *script_gpio_entry_new(struct script_section *section,
 	assert(section);
 	assert(name && *name);
 
-	if ((entry = malloc(sizeof(*entry)))) {
+	if ((entry = script_alloc(section->script, sizeof(*entry)))) {
 		entry->port = port;
 		entry->port_num = num;
 		for (int i=0; i<4; i++)
@@ -250,16 +339,13 @@ struct script_gpio_entry *script_gpio_entry_new(struct script_section *section,
 struct script_entry *script_find_entry(struct script_section *section,
 				       const char *name)
 {
-	struct list_entry *o;
 	struct script_entry *ep;
 
 	assert(section);
 	assert(name);
 
-	for (o = list_first(&section->entries); o;
-	     o = list_next(&section->entries, o)) {
-		ep = container_of(o, struct script_entry, entries);
-
+	for (ep = section->entry_hash[script_hash(name) % SCRIPT_ENTRY_HASH];
+	     ep; ep = ep->hash_next) {
 		if (strcmp(ep->name, name) == 0)
 			return ep;
 	}
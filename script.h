@@ -21,9 +21,21 @@
 
 #define GPIO_BANK_MAX	14 /* N, (zero-based) index 13 */
 
+#define SCRIPT_SECTION_HASH	256 /* buckets of the section name index */
+#define SCRIPT_ENTRY_HASH	32 /* buckets of the entry name index */
+
+struct script_entry;
+struct script_chunk;
+
 /** head of the data tree */
 struct script {
 	struct list_entry sections;
+
+	/* arena holding all sections and entries of the tree */
+	struct script_chunk *chunks;
+
+	/* name index, each chain follows the order of the list */
+	struct script_section *section_hash[SCRIPT_SECTION_HASH];
 };
 
 /** head of each section */
@@ -32,6 +44,10 @@ struct script_section {
 
 	struct list_entry sections;
 	struct list_entry entries;
+
+	struct script *script;
+	struct script_section *hash_next;
+	struct script_entry *entry_hash[SCRIPT_ENTRY_HASH];
 };
 
 /** types of values */
@@ -49,6 +65,9 @@ struct script_entry {
 	enum script_value_type type;
 
 	struct list_entry entries;
+
+	struct script_section *section;
+	struct script_entry *hash_next;
 };
 
 /** null entry */
@@ -81,13 +100,16 @@ struct script_gpio_entry {
 
 /** create a new script tree */
 struct script *script_new(void);
-/** deletes a tree recursively */
+/** deletes a tree, releasing all of its memory */
 void script_delete(struct script *);
+/** empties a tree, keeping (the first chunk of) its memory for reuse */
+void script_reset(struct script *);
 
 /** create a new section appended to a given tree */
 struct script_section *script_section_new(struct script *script,
 					  const char *name);
-/** deletes a section recursvely and removes it from the script */
+/** deletes a section recursvely and removes it from the script
+ * (its memory gets released along with the tree) */
 void script_section_delete(struct script_section *section);
 
 /** find existing section */
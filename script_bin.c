@@ -42,89 +42,46 @@
 /*
  * generator
  */
-size_t script_bin_size(struct script *script,
-		       size_t *sections, size_t *entries)
-{
-	size_t words = 0, bin_size = 0;
-	struct list_entry *ls, *le;
-	struct script_section *section;
-	struct script_entry *entry;
-	struct script_string_entry *string;
 
-	*sections = *entries = 0;
+/** growable, zero-filled output buffer */
+struct bin_buffer {
+	char *data;
+	size_t size, used;
+};
 
-	/* count */
-	for (ls = list_first(&script->sections); ls;
-	     ls = list_next(&script->sections, ls)) {
-		section = container_of(ls, struct script_section, sections);
-		size_t c = 0;
-
-		for (le = list_first(&section->entries); le;
-		     le = list_next(&section->entries, le)) {
-			size_t size = 0;
-			entry = container_of(le, struct script_entry, entries);
-			c++;
+/** reserve @size more bytes at the end of a buffer, returns their offset */
+static int bin_buffer_add(struct bin_buffer *b, size_t size, size_t *offset)
+{
+	if (b->used + size > b->size) {
+		size_t n = b->size ? b->size : 4096;
+		char *p;
 
-			switch(entry->type) {
-			case SCRIPT_VALUE_TYPE_NULL:
-			case SCRIPT_VALUE_TYPE_SINGLE_WORD:
-				size = sizeof(uint32_t);
-				break;
-			case SCRIPT_VALUE_TYPE_STRING:
-				string = container_of(entry, struct script_string_entry,
-						      entry);
-				size = string->l;
-				break;
-			case SCRIPT_VALUE_TYPE_GPIO:
-				size = sizeof(struct script_bin_gpio_value);
-				break;
-			default:
-				abort();
-			}
-			words += WORDS(size);
-		}
-		*sections += 1;
-		*entries += c;
+		while (n < b->used + size)
+			n *= 2;
+		if ((p = realloc(b->data, n)) == NULL)
+			return 0;
+		memset(p + b->size, 0, n - b->size);
+		b->data = p;
+		b->size = n;
 	}
-
-	bin_size = sizeof(struct script_bin_head) +
-		(*sections)*sizeof(struct script_bin_section) +
-		(*entries)*sizeof(struct script_bin_entry) +
-		words*sizeof(uint32_t);
-	pr_debug("sections:%zu entries:%zu data:%zu/%zu -> %zu\n",
-		 *sections, *entries, words, words*sizeof(uint32_t),
-		 bin_size);
-	return bin_size;
+	*offset = b->used;
+	b->used += size;
+	return 1;
 }
 
-int script_generate_bin(void *bin, size_t bin_size,
-			struct script *script,
-			size_t sections, size_t entries)
+/*
+ * The tree is traversed once: section headers, entries and data go to
+ * separate buffers, with offsets relative to the start of each. After
+ * concatenating them into the final layout the offsets get patched.
+ */
+void *script_generate_bin(struct script *script, size_t *bin_size)
 {
-	struct script_bin_head *head;
+	struct bin_buffer sections = { 0 }, entries = { 0 }, data = { 0 };
+	struct script_bin_head *head = NULL;
 	struct script_bin_section *section;
 	struct script_bin_entry *entry;
-	void *data;
-
 	struct list_entry *ls, *le;
-
-	head = bin;
-	section = head->section;
-	entry = (void*)section+sections*sizeof(*section);
-	data = (void*)entry+entries*sizeof(*entry);
-
-	pr_debug("head....:%p\n", head);
-	pr_debug("section.:%p (offset:%zu, each:%zu)\n", section,
-		 (void*)section-bin, sizeof(*section));
-	pr_debug("entry...:%p (offset:%zu, each:%zu)\n", entry,
-		 (void*)entry-bin, sizeof(*entry));
-	pr_debug("data....:%p (offset:%zu)\n", data,
-		 (void*)data-bin);
-
-	head->sections = sections;
-	head->filesize = bin_size;
-	head->version[0] = 1;
-	head->version[1] = 2;
+	size_t so, eo, dof, n, i;
 
 	for (ls = list_first(&script->sections); ls;
 	     ls = list_next(&script->sections, ls)) {
@@ -132,8 +89,11 @@ int script_generate_bin(void *bin, size_t bin_size,
 		size_t c = 0;
 		s = container_of(ls, struct script_section, sections);
 
+		if (!bin_buffer_add(&sections, sizeof(*section), &so))
+			goto done;
+		section = PTR(sections.data, so);
 		memcpy(section->name, s->name, strlen(s->name));
-		section->offset = ((void*)entry-bin)>>2;
+		section->offset = entries.used>>2;
 
 		for (le = list_first(&s->entries); le;
 		     le = list_next(&s->entries, le)) {
@@ -141,34 +101,49 @@ int script_generate_bin(void *bin, size_t bin_size,
 			e = container_of(le, struct script_entry, entries);
 			size_t size = 0;
 
+			switch(e->type) {
+			case SCRIPT_VALUE_TYPE_SINGLE_WORD:
+			case SCRIPT_VALUE_TYPE_NULL:
+				size = sizeof(uint32_t);
+				break;
+			case SCRIPT_VALUE_TYPE_STRING: {
+				struct script_string_entry *string;
+				string = container_of(e, struct script_string_entry, entry);
+				/* align */
+				size = WORDS(string->l)*sizeof(uint32_t);
+				}; break;
+			case SCRIPT_VALUE_TYPE_GPIO:
+				size = sizeof(struct script_bin_gpio_value);
+				break;
+			default:
+				abort();
+			}
+
+			if (!bin_buffer_add(&entries, sizeof(*entry), &eo) ||
+			    !bin_buffer_add(&data, size, &dof))
+				goto done;
+			entry = PTR(entries.data, eo);
+
 			memcpy(entry->name, e->name, strlen(e->name));
-			entry->offset = ((void*)data-bin)>>2;
-			entry->pattern = (e->type<<16);
+			entry->offset = dof>>2;
+			entry->pattern = (e->type<<16) | (size>>2);
 
 			switch(e->type) {
 			case SCRIPT_VALUE_TYPE_SINGLE_WORD: {
 				struct script_single_entry *single;
-				int32_t *bdata = data;
+				int32_t *bdata = PTR(data.data, dof);
 				single = container_of(e, struct script_single_entry, entry);
 
 				*bdata = single->value;
-				size = sizeof(*bdata);
 				}; break;
 			case SCRIPT_VALUE_TYPE_STRING: {
 				struct script_string_entry *string;
 				string = container_of(e, struct script_string_entry, entry);
-				size = string->l;
-				memcpy(data, string->string, size);
-				/* align */
-				size += sizeof(uint32_t)-1;
-				size /= sizeof(uint32_t);
-				size *= sizeof(uint32_t);
+				memcpy(PTR(data.data, dof), string->string, string->l);
 				}; break;
-			case SCRIPT_VALUE_TYPE_MULTI_WORD:
-				abort();
 			case SCRIPT_VALUE_TYPE_GPIO: {
 				struct script_gpio_entry *gpio;
-				struct script_bin_gpio_value *bdata = data;
+				struct script_bin_gpio_value *bdata = PTR(data.data, dof);
 				gpio = container_of(e, struct script_gpio_entry, entry);
 				bdata->port = gpio->port;
 				bdata->port_num = gpio->port_num;
@@ -176,31 +151,55 @@ int script_generate_bin(void *bin, size_t bin_size,
 				bdata->pull = gpio->data[1];
 				bdata->drv_level = gpio->data[2];
 				bdata->data = gpio->data[3];
-				size = sizeof(*bdata);
 				}; break;
-			case SCRIPT_VALUE_TYPE_NULL:
-				size = sizeof(uint32_t);
+			default:
 				break;
 			}
 
-			data += size;
-			entry->pattern |= (size>>2);
-			pr_debug("%s.%s <%p> (type:%d, words:%d (%zu), offset:%d)\n",
-				 section->name, entry->name, entry,
+			pr_debug("%s.%s (type:%d, words:%d (%zu), offset:%d)\n",
+				 s->name, entry->name,
 				 (entry->pattern>>16) & 0xffff,
 				 (entry->pattern>>0) & 0xffff, size,
 				 entry->offset);
 			c++;
-			entry++;
 		}
 
+		section = PTR(sections.data, so);
 		section->length = c;
-		pr_debug("%s <%p> (length:%d, offset:%d)\n",
-			 section->name, section, section->length, section->offset);
-
-		section++;
+		pr_debug("%s (length:%d)\n", section->name, section->length);
 	}
-	return 1;
+
+	*bin_size = sizeof(*head) + sections.used + entries.used + data.used;
+	if ((head = malloc(*bin_size)) == NULL)
+		goto done;
+
+	head->sections = sections.used / sizeof(*section);
+	head->filesize = *bin_size;
+	head->version[0] = 1;
+	head->version[1] = 2;
+
+	section = head->section;
+	entry = PTR(section, sections.used);
+	memcpy(section, sections.data, sections.used);
+	memcpy(entry, entries.data, entries.used);
+	memcpy(PTR(entry, entries.used), data.data, data.used);
+
+	/* turn offsets into absolute (word) offsets within the file */
+	n = ((char *)entry - (char *)head)>>2;
+	for (i = 0; i < head->sections; i++)
+		section[i].offset += n;
+	n += entries.used>>2;
+	for (i = 0; i < entries.used / sizeof(*entry); i++)
+		entry[i].offset += n;
+
+	pr_debug("sections:%u entries:%zu data:%zu -> %zu\n",
+		 head->sections, entries.used / sizeof(*entry),
+		 data.used, *bin_size);
+done:
+	free(sections.data);
+	free(entries.data);
+	free(data.data);
+	return head;
 }
 
 /*
@@ -319,13 +318,15 @@ failure:
 #define SCRIPT_BIN_VERSION_LIMIT 0x10
 #define SCRIPT_BIN_SECTION_LIMIT 0x100
 
-int script_decompile_bin(void *bin, size_t bin_size,
-			 const char *filename,
-			 struct script *script)
+static int check_bin_head(void *bin, size_t bin_size, const char *filename)
 {
-	unsigned int i;
 	struct script_bin_head *head = bin;
 
+	if (bin_size < sizeof(*head)) {
+		pr_err("Malformed data: size %zu too small.\n", bin_size);
+		return 0;
+	}
+
 	if ((head->version[0] > SCRIPT_BIN_VERSION_LIMIT) ||
 	    (head->version[1] > SCRIPT_BIN_VERSION_LIMIT)) {
 		pr_err("Malformed data: version %u.%u.\n",
@@ -344,6 +345,19 @@ int script_decompile_bin(void *bin, size_t bin_size,
 	pr_info("%s: size: %zu (%u sections), header value: %u\n", filename,
 		bin_size, head->sections, head->filesize);
 
+	return 1;
+}
+
+int script_decompile_bin(void *bin, size_t bin_size,
+			 const char *filename,
+			 struct script *script)
+{
+	unsigned int i;
+	struct script_bin_head *head = bin;
+
+	if (!check_bin_head(bin, bin_size, filename))
+		return 0;
+
 	/* TODO: SANITY: compare head.sections with bin_size */
 	for (i=0; i < head->sections; i++) {
 		struct script_bin_section *section = &head->section[i];
@@ -354,3 +368,64 @@ int script_decompile_bin(void *bin, size_t bin_size,
 	}
 	return 1;
 }
+
+/*
+ * Check if the section is one of 'sections', flagging every entry that
+ * matches it as found (names may be given more than once)
+ */
+static int match_section_name(const char *const *sections,
+			      const struct script_bin_section *section,
+			      char *found)
+{
+	char name[32];
+	int match = 0;
+
+	/* same truncation as script_section_new() does */
+	memcpy(name, section->name, 31);
+	name[31] = '\0';
+
+	for (int i = 0; sections[i]; i++)
+		if (strcmp(sections[i], name) == 0)
+			match = found[i] = 1;
+	return match;
+}
+
+int script_decompile_bin_sections(void *bin, size_t bin_size,
+				  const char *filename,
+				  const char *const *sections,
+				  struct script *script,
+				  int (*emit)(struct script *, void *),
+				  void *arg)
+{
+	struct script_bin_head *head = bin;
+	unsigned int i, count = 0;
+	int ret = 1;
+
+	if (!check_bin_head(bin, bin_size, filename))
+		return 0;
+
+	while (sections && sections[count])
+		count++;
+	char found[count + 1];
+	memset(found, 0, sizeof(found));
+
+	for (i=0; ret && i < head->sections; i++) {
+		struct script_bin_section *section = &head->section[i];
+
+		if (sections && !match_section_name(sections, section, found))
+			continue;
+
+		script_reset(script);
+		ret = decompile_section(bin, bin_size, filename,
+					section, script) &&
+		      emit(script, arg);
+	}
+
+	for (i = 0; ret && i < count; i++)
+		if (!found[i]) {
+			pr_err("%s: section [%s] not found\n",
+			       filename, sections[i]);
+			ret = 0;
+		}
+	return ret;
+}
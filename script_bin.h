@@ -49,12 +49,20 @@ struct script_bin_gpio_value {
 	int32_t data;
 };
 
-size_t script_bin_size(struct script *script,
-		       size_t *sections, size_t *entries);
-
-int script_generate_bin(void *bin, size_t bin_size, struct script *script,
-			size_t sections, size_t entries);
+/** generate the binary representation, returns a malloc'ed buffer */
+void *script_generate_bin(struct script *script, size_t *bin_size);
 int script_decompile_bin(void *bin, size_t bin_size,
 			 const char *filename,
 			 struct script *script);
+/**
+ * decompile one section at a time into 'script' (emptied before each), and
+ * pass it on to 'emit'. 'sections' optionally is a NULL terminated list of
+ * names, restricting this to the sections given (which all must exist).
+ */
+int script_decompile_bin_sections(void *bin, size_t bin_size,
+				  const char *filename,
+				  const char *const *sections,
+				  struct script *script,
+				  int (*emit)(struct script *, void *),
+				  void *arg);
 #endif
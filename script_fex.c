@@ -174,16 +174,38 @@ static inline char *rtrim(const char *s, char *p)
 	return p;
 }
 
+/** copy the next line of a memory buffer, with the semantics of fgets() */
+static inline int next_line(char *buffer, size_t size,
+			    const char **data, const char *end)
+{
+	size_t l = end - *data;
+	const char *nl;
+
+	if (l == 0)
+		return 0;
+	if (l > size-1)
+		l = size-1;
+	if ((nl = memchr(*data, '\n', l)))
+		l = nl - *data + 1;
+
+	memcpy(buffer, *data, l);
+	buffer[l] = '\0';
+	*data += l;
+	return 1;
+}
+
 /**
  */
-int script_parse_fex(FILE *in, const char *filename, struct script *script)
+int script_parse_fex(const char *data, size_t size, const char *filename,
+		     struct script *script)
 {
 	char buffer[MAX_LINE+1];
+	const char *end = data + size;
 	int ok = 1;
 	struct script_section *last_section = NULL;
 
 	/* TODO: deal with longer lines correctly (specially in comments) */
-	for(size_t line = 1; ok && fgets(buffer, sizeof(buffer), in); line++) {
+	for(size_t line = 1; ok && next_line(buffer, sizeof(buffer), &data, end); line++) {
 		char *s = skip_blank(buffer); /* beginning */
 		char *pe = s; /* \0... to be found */
 
@@ -369,7 +391,5 @@ parse_error:
 		}
 	};
 
-	if (ferror(in))
-		ok = 0;
 	return ok;
 }
@@ -17,7 +17,8 @@
 #ifndef _SUBXI_TOOLS_SCRIPT_FEX_H
 #define _SUBXI_TOOLS_SCRIPT_FEX_H
 
-int script_parse_fex(FILE *in, const char *filename, struct script *script);
+int script_parse_fex(const char *data, size_t size, const char *filename,
+		     struct script *script);
 int script_generate_fex(FILE *out, const char *filename, struct script *script);
 
 #endif
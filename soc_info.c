@@ -25,6 +25,47 @@
 #include <stdio.h>
 #include <unistd.h>
 
+/* only the size of the thunk matters here, see SOC_SRAM_LAYOUT() below */
+enum {
+	FEL_TO_SPL_THUNK_SIZE = sizeof((uint32_t[]){
+		#include "fel-to-spl-thunk.h"
+	})
+};
+
+
+/*
+ * Compile-time sanity checks for the SoC descriptors: STATIC_CHECK() yields
+ * 0 if 'cond' holds and breaks the build otherwise, so it can be used within
+ * the table initializers.
+ */
+#define STATIC_CHECK(cond)	(sizeof(char[(cond) ? 1 : -1]) - 1)
+
+#define SWAP_BUFFERS_COUNT(...) \
+	(sizeof((sram_swap_buffers[]){ __VA_ARGS__ }) / sizeof(sram_swap_buffers))
+
+/* space needed for the thunk code, SPL address and the swap buffers table */
+#define THUNK_SPACE(count) \
+	(FEL_TO_SPL_THUNK_SIZE + sizeof(uint32_t) + \
+	 ((count) + 1) * sizeof(sram_swap_buffers))
+
+/*
+ * Describe the thunk location and the swap buffers of a SoC, verifying that
+ * they fit into the thunk area (which is what aw_fel_write_and_execute_spl()
+ * is going to upload there).
+ */
+#define SOC_SRAM_LAYOUT(addr, size, ...) \
+	.thunk_addr   = (addr), \
+	.thunk_size   = (size) \
+		+ STATIC_CHECK(SWAP_BUFFERS_COUNT(__VA_ARGS__) \
+			       <= SOC_MAX_SWAP_BUFFERS) \
+		+ STATIC_CHECK(THUNK_SPACE(SWAP_BUFFERS_COUNT(__VA_ARGS__)) \
+			       <= (size)), \
+	.swap_buffers = { __VA_ARGS__ }
+
+/* The MMU translation table address must be 16K aligned */
+#define SOC_MMU_TT_ADDR(addr) \
+	.mmu_tt_addr  = (addr) + STATIC_CHECK(((addr) & 0x3FFF) == 0)
+
 /*
  * The FEL code from BROM in A10/A13/A20 sets up two stacks for itself. One
  * at 0x2000 (and growing down) for the IRQ handler. And another one at 0x7000
@@ -34,15 +75,13 @@
  * important too (overwriting them kills FEL). On A10/A13/A20 we can use
  * the SRAM sections A3/A4 (0x8000-0xBFFF) for this purpose.
  */
-sram_swap_buffers a10_a13_a20_sram_swap_buffers[] = {
-	/* 0x1C00-0x1FFF (IRQ stack) */
-	{ .buf1 = 0x1C00, .buf2 = 0xA400, .size = 0x0400 },
-	/* 0x5C00-0x6FFF (Stack) */
-	{ .buf1 = 0x5C00, .buf2 = 0xA800, .size = 0x1400 },
-	/* 0x7C00-0x7FFF (Something important) */
-	{ .buf1 = 0x7C00, .buf2 = 0xBC00, .size = 0x0400 },
-	{ .size = 0 }  /* End of the table */
-};
+#define A10_A13_A20_SRAM_SWAP_BUFFERS \
+	/* 0x1C00-0x1FFF (IRQ stack) */ \
+	{ .buf1 = 0x1C00, .buf2 = 0xA400, .size = 0x0400 }, \
+	/* 0x5C00-0x6FFF (Stack) */ \
+	{ .buf1 = 0x5C00, .buf2 = 0xA800, .size = 0x1400 }, \
+	/* 0x7C00-0x7FFF (Something important) */ \
+	{ .buf1 = 0x7C00, .buf2 = 0xBC00, .size = 0x0400 }
 
 /*
  * A31 is very similar to A10/A13/A20, except that it has no SRAM at 0x8000.
@@ -51,11 +90,9 @@ sram_swap_buffers a10_a13_a20_sram_swap_buffers[] = {
  * also safely use it as the backup storage because the MMU is temporarily
  * disabled during the time of the SPL execution.
  */
-sram_swap_buffers a31_sram_swap_buffers[] = {
-	{ .buf1 = 0x1800, .buf2 = 0x20000, .size = 0x800 },
-	{ .buf1 = 0x5C00, .buf2 = 0x20800, .size = 0x8000 - 0x5C00 },
-	{ .size = 0 }  /* End of the table */
-};
+#define A31_SRAM_SWAP_BUFFERS \
+	{ .buf1 = 0x1800, .buf2 = 0x20000, .size = 0x800 }, \
+	{ .buf1 = 0x5C00, .buf2 = 0x20800, .size = 0x8000 - 0x5C00 }
 
 /*
  * A64 has 32KiB of SRAM A at 0x10000 and a large SRAM C at 0x18000. SRAM A
@@ -63,115 +100,109 @@ sram_swap_buffers a31_sram_swap_buffers[] = {
  * representing a singe large contiguous area. Everything is the same as on
  * A10/A13/A20, but just shifted by 0x10000.
  */
-sram_swap_buffers a64_sram_swap_buffers[] = {
-	/* 0x11C00-0x11FFF (IRQ stack) */
-	{ .buf1 = 0x11C00, .buf2 = 0x1A400, .size = 0x0400 },
-	/* 0x15C00-0x16FFF (Stack) */
-	{ .buf1 = 0x15C00, .buf2 = 0x1A800, .size = 0x1400 },
-	/* 0x17C00-0x17FFF (Something important) */
-	{ .buf1 = 0x17C00, .buf2 = 0x1BC00, .size = 0x0400 },
-	{ .size = 0 }  /* End of the table */
-};
+#define A64_SRAM_SWAP_BUFFERS \
+	/* 0x11C00-0x11FFF (IRQ stack) */ \
+	{ .buf1 = 0x11C00, .buf2 = 0x1A400, .size = 0x0400 }, \
+	/* 0x15C00-0x16FFF (Stack) */ \
+	{ .buf1 = 0x15C00, .buf2 = 0x1A800, .size = 0x1400 }, \
+	/* 0x17C00-0x17FFF (Something important) */ \
+	{ .buf1 = 0x17C00, .buf2 = 0x1BC00, .size = 0x0400 }
 
 /*
  * Use the SRAM section at 0x44000 as the backup storage. This is the memory,
  * which is normally shared with the OpenRISC core (should we do an extra check
  * to ensure that this core is powered off and can't interfere?).
  */
-sram_swap_buffers ar100_abusing_sram_swap_buffers[] = {
-	{ .buf1 = 0x1800, .buf2 = 0x44000, .size = 0x800 },
-	{ .buf1 = 0x5C00, .buf2 = 0x44800, .size = 0x8000 - 0x5C00 },
-	{ .size = 0 }  /* End of the table */
-};
+#define AR100_ABUSING_SRAM_SWAP_BUFFERS \
+	{ .buf1 = 0x1800, .buf2 = 0x44000, .size = 0x800 }, \
+	{ .buf1 = 0x5C00, .buf2 = 0x44800, .size = 0x8000 - 0x5C00 }
 
 /*
  * A80 has 40KiB SRAM A1 at 0x10000 where the SPL has to be loaded to. The
  * secure SRAM B at 0x20000 is used as backup area for FEL stacks and data.
  */
-sram_swap_buffers a80_sram_swap_buffers[] = {
-	{ .buf1 = 0x11800, .buf2 = 0x20000, .size = 0x800 },
-	{ .buf1 = 0x15400, .buf2 = 0x20800, .size = 0x18000 - 0x15400 },
-	{ .size = 0 }  /* End of the table */
-};
+#define A80_SRAM_SWAP_BUFFERS \
+	{ .buf1 = 0x11800, .buf2 = 0x20000, .size = 0x800 }, \
+	{ .buf1 = 0x15400, .buf2 = 0x20800, .size = 0x18000 - 0x15400 }
 
-soc_info_t soc_info_table[] = {
+static const soc_info_t soc_info_table[] = {
 	{
 		.soc_id       = 0x1623, /* Allwinner A10 */
+		.name         = "A10",
 		.scratch_addr = 0x1000,
-		.thunk_addr   = 0xA200, .thunk_size = 0x200,
-		.swap_buffers = a10_a13_a20_sram_swap_buffers,
+		SOC_SRAM_LAYOUT(0xA200, 0x200, A10_A13_A20_SRAM_SWAP_BUFFERS),
 		.needs_l2en   = true,
 		.sid_addr     = 0x01C23800,
 	},{
 		.soc_id       = 0x1625, /* Allwinner A10s, A13, R8 */
+		.name         = "A13",
 		.scratch_addr = 0x1000,
-		.thunk_addr   = 0xA200, .thunk_size = 0x200,
-		.swap_buffers = a10_a13_a20_sram_swap_buffers,
+		SOC_SRAM_LAYOUT(0xA200, 0x200, A10_A13_A20_SRAM_SWAP_BUFFERS),
 		.needs_l2en   = true,
 		.sid_addr     = 0x01C23800,
 	},{
 		.soc_id       = 0x1651, /* Allwinner A20 */
+		.name         = "A20",
 		.scratch_addr = 0x1000,
-		.thunk_addr   = 0xA200, .thunk_size = 0x200,
-		.swap_buffers = a10_a13_a20_sram_swap_buffers,
+		SOC_SRAM_LAYOUT(0xA200, 0x200, A10_A13_A20_SRAM_SWAP_BUFFERS),
 		.sid_addr     = 0x01C23800,
 	},{
 		.soc_id       = 0x1650, /* Allwinner A23 */
+		.name         = "A23",
 		.scratch_addr = 0x1000,
-		.thunk_addr   = 0x46E00, .thunk_size = 0x200,
-		.swap_buffers = ar100_abusing_sram_swap_buffers,
+		SOC_SRAM_LAYOUT(0x46E00, 0x200, AR100_ABUSING_SRAM_SWAP_BUFFERS),
 		.sid_addr     = 0x01C23800,
 	},{
 		.soc_id       = 0x1633, /* Allwinner A31 */
+		.name         = "A31",
 		.scratch_addr = 0x1000,
-		.thunk_addr   = 0x22E00, .thunk_size = 0x200,
-		.swap_buffers = a31_sram_swap_buffers,
+		SOC_SRAM_LAYOUT(0x22E00, 0x200, A31_SRAM_SWAP_BUFFERS),
 	},{
 		.soc_id       = 0x1667, /* Allwinner A33, R16 */
+		.name         = "A33",
 		.scratch_addr = 0x1000,
-		.thunk_addr   = 0x46E00, .thunk_size = 0x200,
-		.swap_buffers = ar100_abusing_sram_swap_buffers,
+		SOC_SRAM_LAYOUT(0x46E00, 0x200, AR100_ABUSING_SRAM_SWAP_BUFFERS),
 		.sid_addr     = 0x01C23800,
 	},{
 		.soc_id       = 0x1689, /* Allwinner A64 */
+		.name         = "A64",
 		.spl_addr     = 0x10000,
 		.scratch_addr = 0x11000,
-		.thunk_addr   = 0x1A200, .thunk_size = 0x200,
-		.swap_buffers = a64_sram_swap_buffers,
+		SOC_SRAM_LAYOUT(0x1A200, 0x200, A64_SRAM_SWAP_BUFFERS),
 		.sid_addr     = 0x01C14200,
 		.rvbar_reg    = 0x017000A0,
 	},{
 		.soc_id       = 0x1639, /* Allwinner A80 */
+		.name         = "A80",
 		.spl_addr     = 0x10000,
 		.scratch_addr = 0x11000,
-		.thunk_addr   = 0x23400, .thunk_size = 0x200,
-		.swap_buffers = a80_sram_swap_buffers,
+		SOC_SRAM_LAYOUT(0x23400, 0x200, A80_SRAM_SWAP_BUFFERS),
 	},{
 		.soc_id       = 0x1673, /* Allwinner A83T */
+		.name         = "A83T",
 		.scratch_addr = 0x1000,
-		.thunk_addr   = 0x46E00, .thunk_size = 0x200,
-		.swap_buffers = ar100_abusing_sram_swap_buffers,
+		SOC_SRAM_LAYOUT(0x46E00, 0x200, AR100_ABUSING_SRAM_SWAP_BUFFERS),
 		.sid_addr     = 0x01C14200,
 	},{
 		.soc_id       = 0x1680, /* Allwinner H3, H2+ */
+		.name         = "H3",
 		.scratch_addr = 0x1000,
-		.mmu_tt_addr  = 0x8000,
-		.thunk_addr   = 0xA200, .thunk_size = 0x200,
-		.swap_buffers = a10_a13_a20_sram_swap_buffers,
+		SOC_MMU_TT_ADDR(0x8000),
+		SOC_SRAM_LAYOUT(0xA200, 0x200, A10_A13_A20_SRAM_SWAP_BUFFERS),
 		.sid_addr     = 0x01C14200,
 	},{
 		.soc_id       = 0x1718, /* Allwinner H5 */
+		.name         = "H5",
 		.spl_addr     = 0x10000,
 		.scratch_addr = 0x11000,
-		.thunk_addr   = 0x1A200, .thunk_size = 0x200,
-		.swap_buffers = a64_sram_swap_buffers,
+		SOC_SRAM_LAYOUT(0x1A200, 0x200, A64_SRAM_SWAP_BUFFERS),
 		.sid_addr     = 0x01C14200,
 		.rvbar_reg    = 0x017000A0,
-	},{
-		.swap_buffers = NULL /* End of the table */
-	}
+	},
 };
 
+#define SOC_INFO_COUNT	(sizeof(soc_info_table) / sizeof(soc_info_table[0]))
+
 /*
  * This generic record assumes BROM with similar properties to A10/A13/A20/A31,
  * but no extra SRAM sections beyond 0x8000. It also assumes that the IRQ
@@ -182,39 +213,33 @@ soc_info_t soc_info_table[] = {
  *
  * The size limit for the ".text + .data" sections is ~21 KiB.
  */
-sram_swap_buffers generic_sram_swap_buffers[] = {
-	{ .buf1 = 0x1C00, .buf2 = 0x5800, .size = 0x400 },
-	{ .size = 0 }  /* End of the table */
-};
-
-soc_info_t generic_soc_info = {
+static const soc_info_t generic_soc_info = {
+	.name         = "unknown",
 	.scratch_addr = 0x1000,
-	.thunk_addr   = 0x5680, .thunk_size = 0x180,
-	.swap_buffers = generic_sram_swap_buffers,
+	SOC_SRAM_LAYOUT(0x5680, 0x180,
+		{ .buf1 = 0x1C00, .buf2 = 0x5800, .size = 0x400 }),
 };
 
 /* functions to retrieve SoC information */
 
-soc_info_t *get_soc_info_from_id(uint32_t soc_id)
+/*
+ * The table is small and flat (no pointers to chase), so a scan over it is
+ * cheap. Callers are expected to cache the result per device anyway.
+ */
+const soc_info_t *get_soc_info_from_id(uint32_t soc_id)
 {
-	soc_info_t *result = NULL;
-	int i;
-
-	for (i = 0; soc_info_table[i].swap_buffers; i++)
-		if (soc_info_table[i].soc_id == soc_id) {
-			result = &soc_info_table[i];
-			break;
-		}
-
-	if (!result) {
-		printf("Warning: no 'soc_sram_info' data for your SoC (id=%04X)\n",
-		       soc_id);
-		result = &generic_soc_info;
-	}
-	return result;
+	size_t i;
+
+	for (i = 0; i < SOC_INFO_COUNT; i++)
+		if (soc_info_table[i].soc_id == soc_id)
+			return &soc_info_table[i];
+
+	printf("Warning: no 'soc_sram_info' data for your SoC (id=%04X)\n",
+	       soc_id);
+	return &generic_soc_info;
 }
 
-soc_info_t *get_soc_info_from_version(struct aw_fel_version *buf)
+const soc_info_t *get_soc_info_from_version(struct aw_fel_version *buf)
 {
 	return get_soc_info_from_id(buf->soc_id);
 }
@@ -53,7 +53,9 @@ typedef struct {
  *
  * Note: the entries in the 'swap_buffers' tables need to be sorted by 'buf1'
  * addresses. And the 'buf1' addresses are the BROM data buffers, while 'buf2'
- * addresses are the intended backup locations.
+ * addresses are the intended backup locations. The tables are stored in the
+ * SoC descriptors themselves (terminated by an entry with zero 'size'), so
+ * each one is a single self-contained constant record.
  *
  * Also for performance reasons, we optionally want to have MMU enabled with
  * optimal section attributes configured (the code from the BROM should use
@@ -67,8 +69,11 @@ typedef struct {
  * the 'mmu_tt_addr' field in the 'soc_sram_info' structure. The 'mmu_tt_addr'
  * address must be 16K aligned.
  */
+#define SOC_MAX_SWAP_BUFFERS	3
+
 typedef struct {
 	uint32_t           soc_id;       /* ID of the SoC */
+	const char        *name;         /* SoC name, for display */
 	uint32_t           spl_addr;     /* SPL load address */
 	uint32_t           scratch_addr; /* A safe place to upload & run code */
 	uint32_t           thunk_addr;   /* Address of the thunk code */
@@ -77,11 +82,11 @@ typedef struct {
 	uint32_t           mmu_tt_addr;  /* MMU translation table address */
 	uint32_t           sid_addr;     /* base address for SID_KEY[0-3] registers */
 	uint32_t           rvbar_reg;    /* MMIO address of RVBARADDR0_L register */
-	sram_swap_buffers *swap_buffers;
+	sram_swap_buffers  swap_buffers[SOC_MAX_SWAP_BUFFERS + 1];
 } soc_info_t;
 
 
-soc_info_t *get_soc_info_from_id(uint32_t soc_id);
-soc_info_t *get_soc_info_from_version(struct aw_fel_version *buf);
+const soc_info_t *get_soc_info_from_id(uint32_t soc_id);
+const soc_info_t *get_soc_info_from_version(struct aw_fel_version *buf);
 
 #endif /* _SUNXI_TOOLS_SOC_INFO_H */
@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2016  The sunxi-tools contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * fexbench.c
+ *
+ * Benchmark for the script conversion code used by fexc. It generates
+ * synthetic .fex data of growing size and times script_parse_fex(),
+ * script_generate_bin(), script_decompile_bin() and script_generate_fex()
+ * separately, reporting the (best) time per entry for each of them.
+ *
+ * It fails if a conversion round trip doesn't reproduce its input, if the
+ * time per entry grows too much with the input size (suggesting nonlinear
+ * behaviour), or if a phase got slower than in a saved baseline.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "script.h"
+#include "script_bin.h"
+#include "script_fex.h"
+
+#define MIN_TIME	0.2	/* seconds spent on each measurement, at least */
+#define MIN_ROUNDS	3
+#define SCALING_LIMIT	4.0	/* per entry, largest vs. smallest input */
+
+/* (script_decompile_bin() refuses more than 256 sections as malformed) */
+static const struct {
+	unsigned sections, entries;
+} sizes[] = {
+	{ 16, 16 }, { 64, 32 }, { 256, 64 }, { 256, 256 },
+};
+#define NSIZES	(sizeof(sizes) / sizeof(sizes[0]))
+
+enum phase {
+	PARSE_FEX, GENERATE_BIN, DECOMPILE_BIN, GENERATE_FEX, NPHASES
+};
+
+static const char *phase_names[NPHASES] = {
+	"parse_fex", "generate_bin", "decompile_bin", "generate_fex",
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* (stderr gets silenced, as the script code is chatty about what it does) */
+static void die(const char *msg)
+{
+	printf("fexbench: %s\n", msg);
+	exit(1);
+}
+
+/* synthetic .fex data, mixing integer, string and GPIO values */
+static char *generate_fex_data(unsigned sections, unsigned entries,
+			       size_t *size)
+{
+	size_t max = (size_t)sections * (entries + 1) * 64;
+	char *buf = malloc(max), *p = buf;
+	unsigned s, e;
+
+	if (!buf)
+		die("out of memory");
+
+	for (s = 0; s < sections; s++) {
+		p += sprintf(p, "[section%u]\n", s);
+		for (e = 0; e < entries; e++) {
+			switch (e % 4) {
+			case 0:
+				p += sprintf(p, "int%u = %u\n", e, s * e);
+				break;
+			case 1:
+				p += sprintf(p, "str%u = \"value %u.%u\"\n",
+					     e, s, e);
+				break;
+			case 2:
+				p += sprintf(p, "gpio%u = port:P%c%02u<%u><1>"
+					     "<default><default>\n", e,
+					     'A' + (s + e) % GPIO_BANK_MAX,
+					     e % 32, e % 7);
+				break;
+			default:
+				p += sprintf(p, "hex%u = 0x%x\n", e, s << 16 | e);
+				break;
+			}
+		}
+	}
+
+	*size = p - buf;
+	return buf;
+}
+
+/* render a script as .fex text into a malloc'ed buffer */
+static char *script_to_fex(struct script *script, size_t *size)
+{
+	FILE *f = tmpfile();
+	char *buf;
+	long len;
+
+	if (!f || !script_generate_fex(f, "<tmp>", script))
+		die("script_generate_fex() failed");
+	len = ftell(f);
+	buf = malloc(len + 1);
+	rewind(f);
+	if (!buf || fread(buf, 1, len, f) != (size_t)len)
+		die("reading back .fex output failed");
+	fclose(f);
+
+	*size = len;
+	return buf;
+}
+
+/*
+ * Run each phase repeatedly for at least MIN_TIME, and store the
+ * best time of a single run in 'best' (in seconds)
+ */
+static void measure(const char *fex, size_t fex_size, double best[NPHASES])
+{
+	FILE *null = fopen("/dev/null", "w");
+	struct script *script;
+	void *bin;
+	size_t bin_size;
+	int phase;
+
+	if (!null)
+		die("can't open /dev/null");
+
+	script = script_new();
+	if (!script || !script_parse_fex(fex, fex_size, "<bench>", script))
+		die("script_parse_fex() failed");
+	bin = script_generate_bin(script, &bin_size);
+	if (!bin)
+		die("script_generate_bin() failed");
+
+	for (phase = 0; phase < NPHASES; phase++) {
+		double total = 0, start, elapsed;
+		int rounds;
+
+		best[phase] = 1e9;
+		for (rounds = 0; rounds < MIN_ROUNDS || total < MIN_TIME;
+		     rounds++) {
+			struct script *tmp = NULL;
+			void *tmp_bin = NULL;
+			int ok = 1;
+
+			if (phase == PARSE_FEX || phase == DECOMPILE_BIN)
+				tmp = script_new();
+
+			start = now();
+			switch (phase) {
+			case PARSE_FEX:
+				ok = script_parse_fex(fex, fex_size, "<bench>",
+						      tmp);
+				break;
+			case GENERATE_BIN:
+				ok = (tmp_bin = script_generate_bin(script,
+							&bin_size)) != NULL;
+				break;
+			case DECOMPILE_BIN:
+				ok = script_decompile_bin(bin, bin_size,
+							  "<bench>", tmp);
+				break;
+			case GENERATE_FEX:
+				ok = script_generate_fex(null, "<bench>",
+							 script);
+				fflush(null);
+				break;
+			}
+			elapsed = now() - start;
+
+			if (!ok)
+				die("conversion failed");
+			if (tmp)
+				script_delete(tmp);
+			free(tmp_bin);
+
+			total += elapsed;
+			if (elapsed < best[phase])
+				best[phase] = elapsed;
+		}
+	}
+
+	free(bin);
+	script_delete(script);
+	fclose(null);
+}
+
+/* .fex -> script -> .bin -> script -> .fex has to preserve the contents */
+static void check_roundtrip(const char *fex, size_t fex_size)
+{
+	struct script *a = script_new(), *b = script_new();
+	char *fex_a, *fex_b;
+	size_t bin_size, size_a, size_b;
+	void *bin;
+
+	if (!a || !b || !script_parse_fex(fex, fex_size, "<bench>", a))
+		die("script_parse_fex() failed");
+	bin = script_generate_bin(a, &bin_size);
+	if (!bin || !script_decompile_bin(bin, bin_size, "<bench>", b))
+		die("binary conversion failed");
+
+	fex_a = script_to_fex(a, &size_a);
+	fex_b = script_to_fex(b, &size_b);
+	if (size_a != size_b || memcmp(fex_a, fex_b, size_a))
+		die("round trip via .bin doesn't match");
+
+	free(fex_a);
+	free(fex_b);
+	free(bin);
+	script_delete(a);
+	script_delete(b);
+}
+
+static void usage(const char *cmd)
+{
+	fprintf(stderr, "Usage: %s [-b baseline] [-s save] [-t tolerance]\n"
+		"	-b file:	compare against results saved earlier\n"
+		"	-s file:	save the results (ns per entry)\n"
+		"	-t factor:	allowed slowdown vs. baseline (1.5)\n",
+		cmd);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *baseline = NULL, *save = NULL;
+	double tolerance = 1.5;
+	double ns[NSIZES][NPHASES];
+	int failed = 0, opt;
+	size_t i;
+	int phase;
+
+	while ((opt = getopt(argc, argv, "b:s:t:")) != -1) {
+		switch (opt) {
+		case 'b': baseline = optarg; break;
+		case 's': save = optarg; break;
+		case 't': tolerance = strtod(optarg, NULL); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!freopen("/dev/null", "w", stderr))
+		die("can't open /dev/null");
+
+	printf("%9s %7s", "sections", "entries");
+	for (phase = 0; phase < NPHASES; phase++)
+		printf(" %13s", phase_names[phase]);
+	printf("  (ns/entry)\n");
+
+	for (i = 0; i < NSIZES; i++) {
+		unsigned n = sizes[i].sections * sizes[i].entries;
+		double best[NPHASES];
+		size_t fex_size;
+		char *fex;
+
+		fex = generate_fex_data(sizes[i].sections, sizes[i].entries,
+					&fex_size);
+		check_roundtrip(fex, fex_size);
+		measure(fex, fex_size, best);
+		free(fex);
+
+		printf("%9u %7u", sizes[i].sections, sizes[i].entries);
+		for (phase = 0; phase < NPHASES; phase++) {
+			ns[i][phase] = best[phase] * 1e9 / n;
+			printf(" %13.1f", ns[i][phase]);
+		}
+		printf("\n");
+	}
+
+	for (phase = 0; phase < NPHASES; phase++) {
+		double ratio = ns[NSIZES - 1][phase] / ns[0][phase];
+		if (ratio > SCALING_LIMIT) {
+			printf("FAIL: %s is %.1fx slower per entry at %ux%u "
+			       "than at %ux%u\n", phase_names[phase], ratio,
+			       sizes[NSIZES - 1].sections,
+			       sizes[NSIZES - 1].entries,
+			       sizes[0].sections, sizes[0].entries);
+			failed = 1;
+		}
+	}
+
+	if (baseline) {
+		FILE *f = fopen(baseline, "r");
+		unsigned s, e;
+		char name[32];
+		double ref;
+
+		if (!f) {
+			printf("%s: %s\n", baseline, strerror(errno));
+			return 1;
+		}
+		while (fscanf(f, "%u %u %31s %lf", &s, &e, name, &ref) == 4) {
+			for (i = 0; i < NSIZES; i++) {
+				if (sizes[i].sections != s || sizes[i].entries != e)
+					continue;
+				for (phase = 0; phase < NPHASES; phase++) {
+					if (strcmp(name, phase_names[phase]) ||
+					    ns[i][phase] <= ref * tolerance)
+						continue;
+					printf("FAIL: %s at %ux%u: %.1f ns/entry,"
+					       " baseline %.1f\n", name, s, e,
+					       ns[i][phase], ref);
+					failed = 1;
+				}
+			}
+		}
+		fclose(f);
+	}
+
+	if (save) {
+		FILE *f = fopen(save, "w");
+
+		if (!f) {
+			printf("%s: %s\n", save, strerror(errno));
+			return 1;
+		}
+		for (i = 0; i < NSIZES; i++)
+			for (phase = 0; phase < NPHASES; phase++)
+				fprintf(f, "%u %u %s %.1f\n", sizes[i].sections,
+					sizes[i].entries, phase_names[phase],
+					ns[i][phase]);
+		fclose(f);
+	}
+
+	if (!failed)
+		printf("OK\n");
+	return failed;
+}
@@ -11,3 +11,16 @@ ${FEX2BIN} ${TESTFILE}.fex ${TESTFILE}.bin
 # have bin2fex explicitly read /dev/stdin, to force use of fexc.c's "read_all()"
 cat ${TESTFILE}.bin | ${BIN2FEX} /dev/stdin > /dev/null
 rm -f ${TESTFILE}.bin
+
+# --section filter: a name given twice must be matched (and output) only once
+SECTIONFEX=$(mktemp)
+printf '[foo]\na = 1\n\n[bar]\nb = "x"\n' > ${SECTIONFEX}.fex
+${FEX2BIN} ${SECTIONFEX}.fex ${SECTIONFEX}.bin
+OUT=$(${BIN2FEX} -s foo -s foo ${SECTIONFEX}.bin 2> /dev/null) || {
+	echo "bin2fex: duplicate --section name failed"; exit 1; }
+[ "${OUT}" == "$(printf '[foo]\na = 1')" ] || {
+	echo "bin2fex: unexpected --section output:"; echo "${OUT}"; exit 1; }
+# unknown section names have to fail, though
+${BIN2FEX} -s foo -s none ${SECTIONFEX}.bin > /dev/null 2>&1 && {
+	echo "bin2fex: missing --section name not reported"; exit 1; }
+rm -f ${SECTIONFEX} ${SECTIONFEX}.fex ${SECTIONFEX}.bin
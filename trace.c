@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2016  The sunxi-tools contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "trace.h"
+#include "progress.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_MAX_PHASES	32
+#define TRACE_NAME_LEN		24
+
+bool trace_active = false;
+
+static FILE *trace_file;
+static double trace_start; /* time base, all timestamps are relative */
+static bool trace_first;
+
+static struct trace_phase {
+	char name[TRACE_NAME_LEN];
+	unsigned int requests;
+	size_t bytes;
+	double elapsed;
+} phases[TRACE_MAX_PHASES];
+static struct trace_phase *current;
+static double phase_start;
+static size_t phase_count;
+
+/* output a JSON string; phase names come from the command line */
+static void trace_string(const char *str)
+{
+	fputc('"', trace_file);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(trace_file, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(trace_file, "\\u%04x", (unsigned char)*str);
+		else
+			fputc(*str, trace_file);
+	}
+	fputc('"', trace_file);
+}
+
+/* output a Chrome trace "complete" event, with times in microseconds */
+static void trace_emit(const char *name, const char *cat, double start,
+		       double end, uint32_t addr, size_t bytes)
+{
+	fprintf(trace_file, "%s\n{\"name\": ", trace_first ? "[" : ",");
+	trace_string(name);
+	fputs(", \"cat\": ", trace_file);
+	trace_string(cat);
+	fprintf(trace_file, ", \"ph\": \"X\", \"ts\": %.1f, \"dur\": %.1f, "
+		"\"pid\": %d, \"tid\": 0, \"args\": {\"addr\": \"0x%08X\", "
+		"\"bytes\": %zu}}", (start - trace_start) * 1e6,
+		(end - start) * 1e6, (int)getpid(), addr, bytes);
+	trace_first = false;
+}
+
+bool trace_open(const char *filename)
+{
+	trace_file = fopen(filename, "w");
+	if (!trace_file) {
+		perror(filename);
+		return false;
+	}
+	/* also finish the trace (and show totals) if we bail out early */
+	atexit(trace_close);
+	trace_active = true;
+	trace_first = true;
+	trace_start = gettime();
+	trace_phase("startup");
+	return true;
+}
+
+/* end the current phase, adding its time to the totals */
+static void trace_end_phase(void)
+{
+	double now = gettime();
+
+	if (!current)
+		return;
+	current->elapsed += now - phase_start;
+	trace_emit(current->name, "phase", phase_start, now, 0, 0);
+	current = NULL;
+}
+
+void trace_phase(const char *name)
+{
+	size_t i;
+
+	if (!trace_active)
+		return;
+	trace_end_phase();
+
+	for (i = 0; i < phase_count; i++)
+		if (strncmp(phases[i].name, name, TRACE_NAME_LEN - 1) == 0)
+			break;
+	if (i == phase_count) {
+		if (phase_count == TRACE_MAX_PHASES)
+			i--; /* out of slots, lump the rest together */
+		else
+			phase_count++;
+		strncpy(phases[i].name, name, TRACE_NAME_LEN - 1);
+	}
+	current = &phases[i];
+	phase_start = gettime();
+}
+
+void trace_request(const char *name, double start, uint32_t addr, size_t bytes)
+{
+	if (!trace_active)
+		return;
+	trace_emit(name, current->name, start, gettime(), addr, bytes);
+	current->requests++;
+	current->bytes += bytes;
+}
+
+void trace_bulk(bool in, double start, double end, size_t bytes)
+{
+	if (!trace_active)
+		return;
+	trace_emit(in ? "bulk-in" : "bulk-out", current->name,
+		   start, end, 0, bytes);
+}
+
+void trace_close(void)
+{
+	size_t i;
+
+	if (!trace_active)
+		return;
+	trace_end_phase();
+	fputs(trace_first ? "[]\n" : "\n]\n", trace_file);
+	fclose(trace_file);
+	trace_active = false;
+
+	fprintf(stderr, "%-24s %8s %12s %10s %10s\n",
+		"phase", "requests", "bytes", "seconds", "kB/s");
+	for (i = 0; i < phase_count; i++)
+		fprintf(stderr, "%-24s %8u %12zu %10.3f %10.1f\n",
+			phases[i].name, phases[i].requests, phases[i].bytes,
+			phases[i].elapsed,
+			kilo(rate(phases[i].bytes, phases[i].elapsed)));
+}
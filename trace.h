@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2016  The sunxi-tools contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SUNXI_TOOLS_TRACE_H
+#define _SUNXI_TOOLS_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Timing instrumentation. Events get written in Chrome trace format (load
+ * the file with chrome://tracing or Perfetto), grouped by the "phase" that
+ * was active when they occurred. trace_close() prints per-phase totals, and
+ * gets called automatically on exit.
+ */
+extern bool trace_active;
+
+bool trace_open(const char *filename);
+void trace_close(void);
+
+/* start a new phase, ending the current one */
+void trace_phase(const char *name);
+
+/* record a FEL request; 'bytes' of payload count towards the phase totals */
+void trace_request(const char *name, double start, uint32_t addr, size_t bytes);
+/*
+ * record a single USB bulk transfer (chunk), from the time it actually got
+ * started - not queued - until 'end'
+ */
+void trace_bulk(bool in, double start, double end, size_t bytes);
+
+#endif /* _SUNXI_TOOLS_TRACE_H */